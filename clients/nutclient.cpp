@@ -17,9 +17,14 @@
    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "nutclient.h"
 
 #include <sstream>
+#include <algorithm>
 
 #include <errno.h>
 #include <string.h>
@@ -37,6 +42,15 @@
 #  include <unistd.h> /* close */
 #  include <netdb.h> /* gethostbyname */
 #  include <fcntl.h>
+#  include <netinet/tcp.h>
+#  include <poll.h>
+#  include <sys/time.h>
+#  ifdef HAVE_SYS_EPOLL_H
+#    include <sys/epoll.h>
+#  endif
+#  ifdef HAVE_PTHREAD
+#    include <pthread.h>
+#  endif
 #  define INVALID_SOCKET -1
 #  define SOCKET_ERROR -1
 #  define closesocket(s) close(s) 
@@ -47,6 +61,12 @@
 #endif /* WIN32 */
 /* End of Windows/Linux Socket compatibility layer: */
 
+#ifdef WITH_OPENSSL
+#  include <openssl/err.h>
+#  include <openssl/ssl.h>
+#  include <openssl/x509v3.h>
+#endif /* WITH_OPENSSL */
+
 
 /* Include nut common utility functions or define simple ones if not */
 #ifdef HAVE_NUTCOMMON
@@ -95,11 +115,18 @@ class Socket
 {
 public:
 	Socket();
+	~Socket();
 
 	void connect(const std::string& host, int port)throw(nut::IOException);
 	void disconnect();
 	bool isConnected()const;
 
+	static bool hasTLS();
+	void startTLS(const std::string& host, const std::string& caPath)throw(nut::IOException);
+	bool isTLS()const;
+	bool isTLSSessionReused()const;
+	void forgetTLSSession();
+
 	void setTimeout(long timeout);
 	bool hasTimeout()const{return _tv.tv_sec>=0;}
 
@@ -107,23 +134,55 @@ public:
 	size_t write(const void* buf, size_t sz)throw(nut::IOException);
 
 	std::string read()throw(nut::IOException);
+	const char* readLine(size_t& len)throw(nut::IOException);
 	void write(const std::string& str)throw(nut::IOException);
 
 
 private:
 	SOCKET _sock;
 	struct timeval	_tv;
-	std::string _buffer; /* Received buffer, string because data should be text only. */
+	/* Received data, not yet handed out lines are between _begin and _end. */
+	char _buffer[8192];
+	size_t _begin, _end;
+	std::string _line; /* Lines too long for _buffer. */
+
+#ifdef WITH_OPENSSL
+	static int newSession(SSL* ssl, SSL_SESSION* session);
+
+	SSL_CTX* _ctx;
+	std::string _caPath; /* CA directory _ctx was set up with. */
+	SSL* _ssl;
+	SSL_SESSION* _session; /* Last session, to resume it on the next handshake. */
+#endif /* WITH_OPENSSL */
 };
 
 Socket::Socket():
 _sock(INVALID_SOCKET),
-_tv()
+_tv(),
+_begin(0),
+_end(0)
+#ifdef WITH_OPENSSL
+,_ctx(NULL)
+,_ssl(NULL)
+,_session(NULL)
+#endif /* WITH_OPENSSL */
 {
 	_tv.tv_sec = -1;
 	_tv.tv_usec = 0;
 }
 
+Socket::~Socket()
+{
+	disconnect();
+	forgetTLSSession();
+#ifdef WITH_OPENSSL
+	if(_ctx)
+	{
+		SSL_CTX_free(_ctx);
+	}
+#endif /* WITH_OPENSSL */
+}
+
 void Socket::setTimeout(long timeout)
 {
 	_tv.tv_sec = timeout;
@@ -285,12 +344,21 @@ void Socket::connect(const std::string& host, int port)throw(nut::IOException)
 
 void Socket::disconnect()
 {
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		SSL_shutdown(_ssl);
+		SSL_free(_ssl);
+		_ssl = NULL;
+	}
+#endif /* WITH_OPENSSL */
 	if(_sock != INVALID_SOCKET)
 	{
 		::closesocket(_sock);
 		_sock = INVALID_SOCKET;
 	}
-	_buffer.clear();
+	_begin = _end = 0;
+	_line.clear();
 }
 
 bool Socket::isConnected()const
@@ -298,6 +366,155 @@ bool Socket::isConnected()const
 	return _sock!=INVALID_SOCKET;
 }
 
+bool Socket::hasTLS()
+{
+#ifdef WITH_OPENSSL
+	return true;
+#else /* WITH_OPENSSL */
+	return false;
+#endif /* WITH_OPENSSL */
+}
+
+#ifdef WITH_OPENSSL
+
+/* Keep the sessions the server hands out, TLS 1.3 ones come after the handshake. */
+int Socket::newSession(SSL* ssl, SSL_SESSION* session)
+{
+	Socket* sock = static_cast<Socket*>(SSL_get_app_data(ssl));
+	if(sock->_session)
+	{
+		SSL_SESSION_free(sock->_session);
+	}
+	sock->_session = session;
+	return 1; /* The reference is ours now. */
+}
+
+static std::string sslError(const std::string& msg)
+{
+	unsigned long err = ERR_get_error();
+	ERR_clear_error();
+	if(err==0)
+	{
+		return msg;
+	}
+	return msg + ": " + ERR_reason_error_string(err);
+}
+
+#endif /* WITH_OPENSSL */
+
+void Socket::startTLS(const std::string& host, const std::string& caPath)throw(nut::IOException)
+{
+#ifdef WITH_OPENSSL
+	if(!isConnected())
+	{
+		throw nut::NotConnectedException();
+	}
+
+	if(_ctx && caPath!=_caPath)
+	{
+		forgetTLSSession();
+		SSL_CTX_free(_ctx);
+		_ctx = NULL;
+	}
+
+	if(!_ctx)
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		_ctx = SSL_CTX_new(TLS_client_method());
+#else
+		SSL_library_init();
+		SSL_load_error_strings();
+		_ctx = SSL_CTX_new(SSLv23_client_method());
+#endif
+		if(!_ctx)
+		{
+			throw nut::IOException(sslError("Cannot create TLS context"));
+		}
+		SSL_CTX_set_options(_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
+		if(!caPath.empty() && SSL_CTX_load_verify_locations(_ctx, NULL, caPath.c_str())!=1)
+		{
+			SSL_CTX_free(_ctx);
+			_ctx = NULL;
+			throw nut::IOException(sslError("Cannot load certificates from " + caPath));
+		}
+		_caPath = caPath;
+
+		/* Sessions are kept by each socket, to resume them on reconnection. */
+		SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(_ctx, newSession);
+	}
+
+	_ssl = SSL_new(_ctx);
+	if(!_ssl || SSL_set_fd(_ssl, _sock)!=1)
+	{
+		disconnect();
+		throw nut::IOException(sslError("Cannot create TLS connection"));
+	}
+	SSL_set_app_data(_ssl, this);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	X509_VERIFY_PARAM* param = SSL_get0_param(_ssl);
+	bool isAddress = X509_VERIFY_PARAM_set1_ip_asc(param, host.c_str())==1;
+	if(!isAddress)
+	{
+		SSL_set_tlsext_host_name(_ssl, host.c_str());
+		X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+		X509_VERIFY_PARAM_set1_host(param, host.c_str(), 0);
+	}
+#endif
+	if(!caPath.empty())
+	{
+		SSL_set_verify(_ssl, SSL_VERIFY_PEER, NULL);
+	}
+
+	if(_session)
+	{
+		SSL_set_session(_ssl, _session);
+	}
+
+	if(SSL_connect(_ssl)!=1)
+	{
+		std::string err = sslError("TLS handshake failed");
+		/* Don't try to resume a session the server refused. */
+		forgetTLSSession();
+		disconnect();
+		throw nut::IOException(err);
+	}
+#else /* WITH_OPENSSL */
+	throw nut::IOException("TLS is not available");
+#endif /* WITH_OPENSSL */
+}
+
+bool Socket::isTLS()const
+{
+#ifdef WITH_OPENSSL
+	return _ssl!=NULL;
+#else /* WITH_OPENSSL */
+	return false;
+#endif /* WITH_OPENSSL */
+}
+
+bool Socket::isTLSSessionReused()const
+{
+#ifdef WITH_OPENSSL
+	return _ssl!=NULL && SSL_session_reused(_ssl);
+#else /* WITH_OPENSSL */
+	return false;
+#endif /* WITH_OPENSSL */
+}
+
+void Socket::forgetTLSSession()
+{
+#ifdef WITH_OPENSSL
+	if(_session)
+	{
+		SSL_SESSION_free(_session);
+		_session = NULL;
+	}
+#endif /* WITH_OPENSSL */
+}
+
 size_t Socket::read(void* buf, size_t sz)throw(nut::IOException)
 {
 	if(!isConnected())
@@ -305,7 +522,13 @@ size_t Socket::read(void* buf, size_t sz)throw(nut::IOException)
 		throw nut::NotConnectedException();
 	}
 
-	if(_tv.tv_sec>=0)
+	bool pending = false;
+#ifdef WITH_OPENSSL
+	/* TLS may already hold decrypted data the socket doesn't know about */
+	pending = _ssl!=NULL && SSL_pending(_ssl)>0;
+#endif /* WITH_OPENSSL */
+
+	if(_tv.tv_sec>=0 && !pending)
 	{
 		fd_set fds;
 		FD_ZERO(&fds);
@@ -316,6 +539,25 @@ size_t Socket::read(void* buf, size_t sz)throw(nut::IOException)
 		}
 	}
 
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		int res = SSL_read(_ssl, buf, sz);
+		if(res>0)
+		{
+			return (size_t) res;
+		}
+		if(SSL_get_error(_ssl, res)==SSL_ERROR_ZERO_RETURN)
+		{
+			return 0;
+		}
+		std::string err = sslError("Error while reading on TLS connection");
+		SSL_set_quiet_shutdown(_ssl, 1);
+		disconnect();
+		throw nut::IOException(err);
+	}
+#endif /* WITH_OPENSSL */
+
 	ssize_t res = ::read(_sock, buf, sz);
 	if(res==-1)
 	{
@@ -343,6 +585,21 @@ size_t Socket::write(const void* buf, size_t sz)throw(nut::IOException)
 		}
 	}
 
+#ifdef WITH_OPENSSL
+	if(_ssl)
+	{
+		int res = SSL_write(_ssl, buf, sz);
+		if(res>0)
+		{
+			return (size_t) res;
+		}
+		std::string err = sslError("Error while writing on TLS connection");
+		SSL_set_quiet_shutdown(_ssl, 1);
+		disconnect();
+		throw nut::IOException(err);
+	}
+#endif /* WITH_OPENSSL */
+
 	ssize_t res = ::write(_sock, buf, sz);
 	if(res==-1)
 	{
@@ -354,27 +611,65 @@ size_t Socket::write(const void* buf, size_t sz)throw(nut::IOException)
 
 std::string Socket::read()throw(nut::IOException)
 {
-	std::string res;
-	char buff[256];
+	size_t len;
+	const char* line = readLine(len);
+	return std::string(line, len);
+}
+
+/*
+ * Return the next line (without its newline) and its length.
+ * The line is not copied: it stays valid until the next read.
+ */
+const char* Socket::readLine(size_t& len)throw(nut::IOException)
+{
+	bool overflow = false;
+	size_t scan = _begin;
 
 	while(true)
 	{
 		// Look at already read data in _buffer
-		if(!_buffer.empty())
+		const char* nl = static_cast<const char*>(memchr(_buffer + scan, '\n', _end - scan));
+		if(nl!=NULL)
+		{
+			const char* line = _buffer + _begin;
+			len = nl - line;
+			_begin = nl - _buffer + 1;
+			if(!overflow)
+			{
+				return line;
+			}
+			_line.append(line, len);
+			len = _line.size();
+			return _line.data();
+		}
+
+		// Keep the start of the line and make room after it
+		if(_begin>0)
+		{
+			memmove(_buffer, _buffer + _begin, _end - _begin);
+			_end -= _begin;
+			_begin = 0;
+		}
+		if(_end==sizeof(_buffer))
 		{
-			size_t idx = _buffer.find('\n');
-			if(idx!=std::string::npos)
+			if(!overflow)
 			{
-				res += _buffer.substr(0, idx);
-				_buffer.erase(0, idx+1);
-				return res;
+				_line.clear();
+				overflow = true;
 			}
-			res += _buffer;
+			_line.append(_buffer, _end);
+			_end = 0;
 		}
+		scan = _end;
 
-		// Read new buffer
-		size_t sz = read(&buff, 256);
-		_buffer.assign(buff, sz);
+		// Read new data
+		size_t sz = read(_buffer + _end, sizeof(_buffer) - _end);
+		if(sz==0)
+		{
+			disconnect();
+			throw nut::IOException("Connection closed by server");
+		}
+		_end += sz;
 	}
 }
 
@@ -383,7 +678,11 @@ void Socket::write(const std::string& str)throw(nut::IOException)
 //	write(str.c_str(), str.size());
 //	write("\n", 1);
 	std::string buff = str + "\n";
-	write(buff.c_str(), buff.size());
+	size_t sent = 0;
+	while(sent < buff.size())
+	{
+		sent += write(buff.c_str() + sent, buff.size() - sent);
+	}
 }
 
 }/* namespace internal */
@@ -450,6 +749,47 @@ std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(
   return res;
 }
 
+std::map<std::string,std::vector<std::string> > Client::getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+  std::map<std::string,std::vector<std::string> > res;
+
+  std::set<std::string> supported = getDeviceVariableNames(dev);
+  for(std::set<std::string>::const_iterator it=names.begin(); it!=names.end(); ++it)
+  {
+    const std::string& name = *it;
+    if(supported.find(name) != supported.end())
+    {
+      res[name] = getDeviceVariableValue(dev, name);
+    }
+  }
+
+  return res;
+}
+
+std::map<std::string,std::string> Client::getDeviceVariableDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+  std::map<std::string,std::string> res;
+
+  for(std::set<std::string>::const_iterator it=names.begin(); it!=names.end(); ++it)
+  {
+    res[*it] = getDeviceVariableDescription(dev, *it);
+  }
+
+  return res;
+}
+
+std::map<std::string,std::string> Client::getDeviceCommandDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+  std::map<std::string,std::string> res;
+
+  for(std::set<std::string>::const_iterator it=names.begin(); it!=names.end(); ++it)
+  {
+    res[*it] = getDeviceCommandDescription(dev, *it);
+  }
+
+  return res;
+}
+
 bool Client::hasDeviceCommand(const std::string& dev, const std::string& name)throw(NutException)
 {
   std::set<std::string> names = getDeviceCommandNames(dev);
@@ -467,6 +807,8 @@ TcpClient::TcpClient():
 Client(),
 _host("localhost"),
 _port(3493),
+_pipeline(32),
+_tls(false),
 _socket(new internal::Socket)
 {
 	// Do not connect now
@@ -474,6 +816,8 @@ _socket(new internal::Socket)
 
 TcpClient::TcpClient(const std::string& host, int port)throw(IOException):
 Client(),
+_pipeline(32),
+_tls(false),
 _socket(new internal::Socket)
 {
 	connect(host, port);
@@ -486,6 +830,10 @@ TcpClient::~TcpClient()
 
 void TcpClient::connect(const std::string& host, int port)throw(IOException)
 {
+	if(host!=_host || port!=_port)
+	{
+		_socket->forgetTLSSession();
+	}
 	_host = host;
 	_port = port;
 	connect();
@@ -494,6 +842,62 @@ void TcpClient::connect(const std::string& host, int port)throw(IOException)
 void TcpClient::connect()throw(nut::IOException)
 {
 	_socket->connect(_host, _port);
+	if(_tls)
+	{
+		// TLS was asked for: never go on in clear text
+		try
+		{
+			negotiateTLS(_caPath);
+		}
+		catch(IOException&)
+		{
+			_socket->disconnect();
+			throw;
+		}
+		catch(NutException& ex)
+		{
+			_socket->disconnect();
+			throw IOException("STARTTLS failed: " + ex.str());
+		}
+	}
+}
+
+void TcpClient::startTLS(const std::string& caPath)throw(NutException)
+{
+	negotiateTLS(caPath);
+	_tls = true;
+	_caPath = caPath;
+}
+
+void TcpClient::negotiateTLS(const std::string& caPath)throw(NutException)
+{
+	if(!internal::Socket::hasTLS())
+	{
+		throw NutException("TLS is not available");
+	}
+	if(_socket->isTLS())
+	{
+		return;
+	}
+
+	std::string res = sendQuery("STARTTLS");
+	detectError(res);
+	if(res!="OK STARTTLS")
+	{
+		throw NutException("Invalid response");
+	}
+
+	_socket->startTLS(_host, caPath);
+}
+
+bool TcpClient::isTLS()const
+{
+	return _socket->isTLS();
+}
+
+bool TcpClient::isTLSSessionReused()const
+{
+	return _socket->isTLSSessionReused();
 }
 
 std::string TcpClient::getHost()const
@@ -526,6 +930,16 @@ long TcpClient::getTimeout()const
 	return _timeout;
 }
 
+void TcpClient::setPipelineDepth(size_t depth)
+{
+	_pipeline = depth>0 ? depth : 1;
+}
+
+size_t TcpClient::getPipelineDepth()const
+{
+	return _pipeline;
+}
+
 void TcpClient::authenticate(const std::string& user, const std::string& passwd)
 	throw(NutException)
 {
@@ -607,6 +1021,19 @@ std::string TcpClient::getDeviceVariableDescription(const std::string& dev, cons
 	return get("DESC", dev + " " + name)[0];
 }
 
+std::map<std::string,std::string> TcpClient::getDeviceVariableDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+	std::map<std::string,std::string> map;
+
+	std::map<std::string,std::vector<std::string> > res = get("DESC", dev, names);
+	for(std::map<std::string,std::vector<std::string> >::iterator it=res.begin(); it!=res.end(); ++it)
+	{
+		map[it->first] = it->second.empty() ? "" : it->second[0];
+	}
+
+	return map;
+}
+
 std::vector<std::string> TcpClient::getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException)
 {
 	return get("VAR", dev + " " + name);
@@ -621,9 +1048,65 @@ std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValu
 	for(size_t n=0; n<res.size(); ++n)
 	{
 		std::vector<std::string>& vals = res[n];
-		std::string var = vals[0];
+		std::string var;
+		var.swap(vals[0]);
 		vals.erase(vals.begin());
-		map[var] = vals;
+		map[var].swap(vals);
+	}
+
+	return map;
+}
+
+std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+	// upsd answers at most this many variables per GET VARS
+	const size_t maxvars = 32;
+
+	std::map<std::string,std::vector<std::string> >  map;
+	std::string prefix = "VAR " + dev;
+
+	std::set<std::string>::const_iterator it = names.begin();
+	while(it != names.end())
+	{
+		std::string req = "VARS " + dev;
+		for(size_t n=0; n<maxvars && it!=names.end(); ++n, ++it)
+		{
+			req += " " + *it;
+		}
+
+		std::string res = sendQuery("GET " + req);
+		detectError(res);
+		if(res != ("BEGIN GET VARS " + dev))
+		{
+			throw NutException("Invalid response");
+		}
+
+		std::string end = "END GET VARS " + dev;
+		std::vector<std::string> vals;
+		while(true)
+		{
+			size_t len;
+			const char* line = _socket->readLine(len);
+			if(len==end.size() && memcmp(line, end.data(), len)==0)
+			{
+				break;
+			}
+			if(len<prefix.size() || memcmp(line, prefix.data(), prefix.size())!=0)
+			{
+				detectError(std::string(line, len));
+				throw NutException("Invalid response");
+			}
+
+			explode(line, len, prefix.size(), vals);
+			if(vals.empty())
+			{
+				throw NutException("Invalid response");
+			}
+			std::string var;
+			var.swap(vals[0]);
+			vals.erase(vals.begin());
+			map[var].swap(vals);
+		}
 	}
 
 	return map;
@@ -663,6 +1146,19 @@ std::string TcpClient::getDeviceCommandDescription(const std::string& dev, const
 	return get("CMDDESC", dev + " " + name)[0];
 }
 
+std::map<std::string,std::string> TcpClient::getDeviceCommandDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException)
+{
+	std::map<std::string,std::string> map;
+
+	std::map<std::string,std::vector<std::string> > res = get("CMDDESC", dev, names);
+	for(std::map<std::string,std::vector<std::string> >::iterator it=res.begin(); it!=res.end(); ++it)
+	{
+		map[it->first] = it->second.empty() ? "" : it->second[0];
+	}
+
+	return map;
+}
+
 void TcpClient::executeDeviceCommand(const std::string& dev, const std::string& name)throw(NutException)
 {
 	detectError(sendQuery("INSTCMD " + dev + " " + name));
@@ -708,6 +1204,35 @@ std::vector<std::string> TcpClient::get
 	return explode(res, req.size());
 }
 
+std::map<std::string,std::vector<std::string> > TcpClient::get
+	(const std::string& subcmd, const std::string& dev, const std::set<std::string>& names) throw(NutException)
+{
+	std::vector<std::string> reqs;
+	for(std::set<std::string>::const_iterator it=names.begin(); it!=names.end(); ++it)
+	{
+		reqs.push_back("GET " + subcmd + " " + dev + " " + *it);
+	}
+
+	// Every answer is read before looking at them, so that an error
+	// does not leave the following ones pending on the connection.
+	std::vector<std::string> res = sendQueries(reqs);
+
+	std::map<std::string,std::vector<std::string> > map;
+	size_t n = 0;
+	for(std::set<std::string>::const_iterator it=names.begin(); it!=names.end(); ++it, ++n)
+	{
+		std::string req = subcmd + " " + dev + " " + *it;
+		detectError(res[n]);
+		if(res[n].substr(0, req.size()) != req)
+		{
+			throw NutException("Invalid response");
+		}
+		map[*it] = explode(res[n], req.size());
+	}
+
+	return map;
+}
+
 std::vector<std::vector<std::string> > TcpClient::list
 	(const std::string& subcmd, const std::string& params) throw(NutException)
 {
@@ -723,21 +1248,24 @@ std::vector<std::vector<std::string> > TcpClient::list
 		throw NutException("Invalid response");
 	}
 
+	std::string end = "END LIST " + req;
 	std::vector<std::vector<std::string> > arr;
 	while(true)
 	{
-		res = _socket->read();
-		detectError(res);
-		if(res == ("END LIST " + req))
+		size_t len;
+		const char* line = _socket->readLine(len);
+		if(len==end.size() && memcmp(line, end.data(), len)==0)
 		{
 			return arr;
 		}
-		if(res.substr(0, req.size()) == req)
+		if(len>=req.size() && memcmp(line, req.data(), req.size())==0)
 		{
-			arr.push_back(explode(res, req.size()));
+			arr.push_back(std::vector<std::string>());
+			explode(line, len, req.size(), arr.back());
 		}
 		else
 		{
+			detectError(std::string(line, len));
 			throw NutException("Invalid response");
 		}
 	}
@@ -749,6 +1277,37 @@ std::string TcpClient::sendQuery(const std::string& req)throw(IOException)
 	return _socket->read();
 }
 
+std::vector<std::string> TcpClient::sendQueries(const std::vector<std::string>& reqs)throw(IOException)
+{
+	std::vector<std::string> res;
+	res.reserve(reqs.size());
+
+	// Write up to _pipeline queries at once, then collect their answers:
+	// upsd answers in order, one line per GET.
+	for(size_t first=0; first<reqs.size(); first+=_pipeline)
+	{
+		size_t last = first + _pipeline;
+		if(last > reqs.size())
+		{
+			last = reqs.size();
+		}
+
+		std::string buff = reqs[first];
+		for(size_t n=first+1; n<last; ++n)
+		{
+			buff += "\n" + reqs[n];
+		}
+		_socket->write(buff);
+
+		for(size_t n=first; n<last; ++n)
+		{
+			res.push_back(_socket->read());
+		}
+	}
+
+	return res;
+}
+
 void TcpClient::detectError(const std::string& req)throw(NutException)
 {
 	if(req.substr(0,3)=="ERR")
@@ -760,131 +1319,1477 @@ void TcpClient::detectError(const std::string& req)throw(NutException)
 std::vector<std::string> TcpClient::explode(const std::string& str, size_t begin)
 {
 	std::vector<std::string> res;
+	explode(str.data(), str.size(), begin, res);
+	return res;
+}
+
+void TcpClient::explode(const char* str, size_t len, size_t begin, std::vector<std::string>& res)
+{
+	const char* p = str + begin;
+	const char* end = str + len;
 	std::string temp;
 
-	enum STATE {
-		INIT,
-		SIMPLE_STRING,
-		QUOTED_STRING,
-		SIMPLE_ESCAPE,
-		QUOTED_ESCAPE
-	} state = INIT;
+	res.clear();
 
-	for(size_t idx=begin; idx<str.size(); ++idx)
+	while(p<end)
 	{
-		char c = str[idx];
-		switch(state)
+		if(*p==' ' /* || *p=='\t' */)
+		{
+			++p;
+			continue;
+		}
+
+		bool quoted = (*p=='"');
+		if(quoted)
+		{
+			++p;
+		}
+
+		// Copy the token by runs up to the next escape or delimiter
+		temp.clear();
+		while(p<end)
 		{
-		case INIT:
-			if(c==' ' /* || c=='\t' */)
-			{ /* Do nothing */ }
-			else if(c=='"')
+			const char* run = p;
+			while(p<end && *p!='"' && *p!='\\' && (quoted || *p!=' '))
 			{
-				state = QUOTED_STRING;
+				++p;
 			}
-			else if(c=='\\')
+			temp.append(run, p - run);
+
+			if(p==end || *p!='\\')
+			{
+				break;
+			}
+			if(++p==end)
 			{
-				state = SIMPLE_ESCAPE;
+				break;
+			}
+			if(*p=='\\' || *p=='"' || (!quoted && *p==' '))
+			{
+				temp += *p;
 			}
-			/* What about bad characters ? */
 			else
 			{
-				temp += c;
-				state = SIMPLE_STRING;
+				/* What about bad escapes ? Keep them as they are. */
+				temp += '\\';
+				temp += *p;
+			}
+			++p;
+		}
+
+		if(p==end)
+		{
+			if(!temp.empty())
+			{
+				res.push_back(temp);
+			}
+			break;
+		}
+
+		res.push_back(temp);
+		if(quoted || *p==' ')
+		{
+			++p;
+		}
+		/* else a quoted string follows right after a simple one */
+	}
+}
+
+std::string TcpClient::escape(const std::string& str)
+{
+	std::string res = "\"";
+	
+	for(size_t n=0; n<str.size(); n++)
+	{
+		char c = str[n];
+		if(c=='"')
+			res += "\\\"";
+		else if(c=='\\')
+			res += "\\\\";
+		else
+			res += c;
+	}
+
+	res += '"';
+	return res; 
+}
+
+/*
+ *
+ * Asynchronous client implementation
+ *
+ */
+
+/* Most requests in flight on a connection, well below what upsd queues. */
+static const size_t ASYNC_PIPELINE = 32;
+
+static long long nowMs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+namespace internal
+{
+
+/**
+ * Host name resolution of an AsyncConnection.
+ * getaddrinfo() runs in a thread of its own (inline without threads),
+ * which writes a byte to a pipe once done, so that the event loop never
+ * waits for a name server.
+ */
+class Resolver
+{
+public:
+	Resolver(const std::string& host, int port);
+
+	/**
+	 * Start the resolution.
+	 * \return Descriptor readable once done, -1 on failure.
+	 */
+	int start();
+	/**
+	 * Retrieve the outcome, once the descriptor is readable.
+	 * \param res Set to the addresses, to free with freeaddrinfo().
+	 * \return 0 or the getaddrinfo() error code.
+	 */
+	int result(struct addrinfo** res);
+	/**
+	 * Forget the resolver, deleted at once if done, else by its thread.
+	 */
+	void release();
+
+private:
+	~Resolver();
+
+	static void* run(void* arg);
+	bool finish();
+
+	std::string _host;
+	char _port[NI_MAXSERV];
+	struct addrinfo* _res;
+	int _status;
+	int _pipe[2];
+	bool _running;
+	bool _released;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t _lock;
+#endif
+};
+
+Resolver::Resolver(const std::string& host, int port):
+_host(host),
+_res(NULL),
+_status(EAI_FAIL),
+_running(false),
+_released(false)
+{
+	snprintf(_port, sizeof(_port), "%hu", (unsigned short int)port);
+	_pipe[0] = _pipe[1] = -1;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&_lock, NULL);
+#endif
+}
+
+Resolver::~Resolver()
+{
+	if(_pipe[0]>=0)
+	{
+		::close(_pipe[0]);
+		::close(_pipe[1]);
+	}
+	if(_res)
+	{
+		freeaddrinfo(_res);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&_lock);
+#endif
+}
+
+int Resolver::start()
+{
+	if(pipe(_pipe)<0)
+	{
+		_pipe[0] = _pipe[1] = -1;
+		return -1;
+	}
+
+	_running = true;
+
+#ifdef HAVE_PTHREAD
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, run, this)==0)
+	{
+		pthread_detach(thread);
+		return _pipe[0];
+	}
+#endif
+
+	run(this);
+	return _pipe[0];
+}
+
+void* Resolver::run(void* arg)
+{
+	Resolver* r = static_cast<Resolver*>(arg);
+	struct addrinfo hints;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	r->_status = getaddrinfo(r->_host.c_str(), r->_port, &hints, &r->_res);
+
+	if(!r->finish())
+	{
+		delete r;
+	}
+	return NULL;
+}
+
+/*
+ * Tell the connection the resolution is done.
+ * Returns false if it was released meanwhile.
+ */
+bool Resolver::finish()
+{
+	bool wanted;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&_lock);
+#endif
+	_running = false;
+	wanted = !_released;
+	if(wanted && write(_pipe[1], "", 1)<0)
+	{
+		// Cannot happen, the pipe only ever holds this byte
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&_lock);
+#endif
+
+	return wanted;
+}
+
+int Resolver::result(struct addrinfo** res)
+{
+	int status;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&_lock);
+#endif
+	status = _status;
+	*res = _res;
+	_res = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&_lock);
+#endif
+
+	return status;
+}
+
+void Resolver::release()
+{
+	bool running;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&_lock);
+#endif
+	running = _running;
+	_released = true;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&_lock);
+#endif
+
+	if(!running)
+	{
+		delete this;
+	}
+}
+
+} /* namespace internal */
+
+
+AsyncListener::~AsyncListener()
+{
+}
+
+void AsyncListener::connected(AsyncConnection& /*conn*/)
+{
+}
+
+void AsyncListener::disconnected(AsyncConnection& /*conn*/, const std::string& /*reason*/, long /*retry*/)
+{
+}
+
+void AsyncListener::updated(AsyncConnection& /*conn*/)
+{
+}
+
+void AsyncListener::completed(AsyncConnection& /*conn*/, const std::string& /*request*/)
+{
+}
+
+void AsyncListener::failed(AsyncConnection& /*conn*/, const std::string& /*request*/, const std::string& /*error*/)
+{
+}
+
+
+AsyncConnection::DeviceCache::DeviceCache():
+numLogins(0),
+described(false)
+{
+}
+
+AsyncConnection::Request::Request(Type type_, const std::string& line_, const std::string& prefix_,
+	const std::string& dev_, const std::string& name_):
+type(type_),
+line(line_),
+prefix(prefix_),
+dev(dev_),
+name(name_)
+{
+}
+
+AsyncConnection::AsyncConnection(AsyncClient* client, const std::string& host, int port):
+Client(),
+_client(client),
+_host(host),
+_port(port),
+_fd(-1),
+_state(IDLE),
+_resolver(NULL),
+_watchFd(-1),
+_watchWrite(false),
+_inList(false),
+_refreshing(false),
+_loggingOut(false),
+_timer(0),
+_lastActivity(0),
+_delay(0),
+_lastUpdate(0)
+{
+	// Connect at the next AsyncClient::run()
+}
+
+AsyncConnection::~AsyncConnection()
+{
+	close();
+}
+
+AsyncClient* AsyncConnection::getAsyncClient()const
+{
+	return _client;
+}
+
+std::string AsyncConnection::getHost()const
+{
+	return _host;
+}
+
+int AsyncConnection::getPort()const
+{
+	return _port;
+}
+
+bool AsyncConnection::isConnected()const
+{
+	return _state==CONNECTED;
+}
+
+time_t AsyncConnection::getLastUpdate()const
+{
+	return _lastUpdate;
+}
+
+void AsyncConnection::refresh()
+{
+	switch(_state)
+	{
+	case STOPPED:
+		_state = IDLE;
+		_delay = 0;
+		/* fall through */
+	case IDLE:
+		_timer = 0;
+		break;
+	case CONNECTED:
+		if(!_refreshing)
+		{
+			_timer = 0;
+		}
+		break;
+	case RESOLVING:
+	case CONNECTING:
+		break;
+	}
+}
+
+void AsyncConnection::authenticate(const std::string& user, const std::string& passwd)throw(NutException)
+{
+	_user = user;
+	_passwd = passwd;
+
+	if(_state==CONNECTED)
+	{
+		send(Request::AUTH, "USERNAME " + _user, "");
+		send(Request::AUTH, "PASSWORD " + _passwd, "");
+		flush();
+	}
+}
+
+void AsyncConnection::logout()throw(NutException)
+{
+	if(_state==CONNECTED)
+	{
+		// upsd closes the connection after answering
+		_loggingOut = true;
+		send(Request::COMMAND, "LOGOUT", "");
+		flush();
+	}
+	else
+	{
+		close();
+		_state = STOPPED;
+	}
+}
+
+const AsyncConnection::DeviceCache& AsyncConnection::getDeviceCache(const std::string& dev)const throw(NutException)
+{
+	std::map<std::string,DeviceCache>::const_iterator it = _devices.find(dev);
+	if(it==_devices.end())
+	{
+		throw NutException("UNKNOWN-UPS");
+	}
+	return it->second;
+}
+
+std::set<std::string> AsyncConnection::getDeviceNames()throw(NutException)
+{
+	std::set<std::string> names;
+	for(std::map<std::string,DeviceCache>::const_iterator it=_devices.begin(); it!=_devices.end(); ++it)
+	{
+		names.insert(it->first);
+	}
+	return names;
+}
+
+std::string AsyncConnection::getDeviceDescription(const std::string& name)throw(NutException)
+{
+	return getDeviceCache(name).description;
+}
+
+std::set<std::string> AsyncConnection::getDeviceVariableNames(const std::string& dev)throw(NutException)
+{
+	const DeviceCache& cache = getDeviceCache(dev);
+	std::set<std::string> names;
+	for(std::map<std::string,std::vector<std::string> >::const_iterator it=cache.variables.begin(); it!=cache.variables.end(); ++it)
+	{
+		names.insert(it->first);
+	}
+	return names;
+}
+
+std::set<std::string> AsyncConnection::getDeviceRWVariableNames(const std::string& dev)throw(NutException)
+{
+	return getDeviceCache(dev).rw;
+}
+
+std::string AsyncConnection::getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException)
+{
+	const DeviceCache& cache = getDeviceCache(dev);
+	std::map<std::string,std::string>::const_iterator it = cache.variableDescriptions.find(name);
+	return it!=cache.variableDescriptions.end() ? it->second : "";
+}
+
+std::vector<std::string> AsyncConnection::getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException)
+{
+	const DeviceCache& cache = getDeviceCache(dev);
+	std::map<std::string,std::vector<std::string> >::const_iterator it = cache.variables.find(name);
+	if(it==cache.variables.end())
+	{
+		throw NutException("VAR-NOT-SUPPORTED");
+	}
+	return it->second;
+}
+
+std::map<std::string,std::vector<std::string> > AsyncConnection::getDeviceVariableValues(const std::string& dev)throw(NutException)
+{
+	return getDeviceCache(dev).variables;
+}
+
+void AsyncConnection::setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException)
+{
+	sendCommand("SET VAR " + dev + " " + name + " " + TcpClient::escape(value));
+}
+
+void AsyncConnection::setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException)
+{
+	std::string query = "SET VAR " + dev + " " + name;
+	for(size_t n=0; n<values.size(); ++n)
+	{
+		query += " " + TcpClient::escape(values[n]);
+	}
+	sendCommand(query);
+}
+
+std::set<std::string> AsyncConnection::getDeviceCommandNames(const std::string& dev)throw(NutException)
+{
+	return getDeviceCache(dev).commands;
+}
+
+std::string AsyncConnection::getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)
+{
+	const DeviceCache& cache = getDeviceCache(dev);
+	std::map<std::string,std::string>::const_iterator it = cache.commandDescriptions.find(name);
+	return it!=cache.commandDescriptions.end() ? it->second : "";
+}
+
+void AsyncConnection::executeDeviceCommand(const std::string& dev, const std::string& name)throw(NutException)
+{
+	sendCommand("INSTCMD " + dev + " " + name);
+}
+
+void AsyncConnection::deviceLogin(const std::string& dev)throw(NutException)
+{
+	sendCommand("LOGIN " + dev);
+}
+
+void AsyncConnection::deviceMaster(const std::string& dev)throw(NutException)
+{
+	sendCommand("MASTER " + dev);
+}
+
+void AsyncConnection::deviceForcedShutdown(const std::string& dev)throw(NutException)
+{
+	sendCommand("FSD " + dev);
+}
+
+int AsyncConnection::deviceGetNumLogins(const std::string& dev)throw(NutException)
+{
+	return getDeviceCache(dev).numLogins;
+}
+
+void AsyncConnection::send(Request::Type type, const std::string& line, const std::string& prefix,
+	const std::string& dev, const std::string& name)
+{
+	_queue.push_back(Request(type, line, prefix, dev, name));
+}
+
+void AsyncConnection::sendCommand(const std::string& line)throw(NutException)
+{
+	if(_state!=CONNECTED)
+	{
+		throw NotConnectedException();
+	}
+	send(Request::COMMAND, line, "");
+	flush();
+}
+
+/*
+ * Move queued requests in flight (up to ASYNC_PIPELINE) and write as much
+ * as the socket takes, the rest is written when it becomes writable.
+ */
+void AsyncConnection::flush()
+{
+	if(_state!=CONNECTED)
+	{
+		return;
+	}
+
+	if(_pending.empty() && !_queue.empty())
+	{
+		_lastActivity = nowMs();
+	}
+	while(_pending.size()<ASYNC_PIPELINE && !_queue.empty())
+	{
+		_out += _queue.front().line + "\n";
+		_pending.push_back(_queue.front());
+		_queue.pop_front();
+	}
+
+	size_t sent = 0;
+	while(sent<_out.size())
+	{
+#ifdef MSG_NOSIGNAL
+		ssize_t ret = ::send(_fd, _out.data() + sent, _out.size() - sent, MSG_NOSIGNAL);
+#else
+		ssize_t ret = ::send(_fd, _out.data() + sent, _out.size() - sent, 0);
+#endif
+		if(ret<0)
+		{
+			if(errno==EINTR)
+			{
+				continue;
+			}
+			if(errno==EAGAIN || errno==EWOULDBLOCK)
+			{
+				break;
+			}
+			fail(strerror(errno));
+			return;
+		}
+		sent += ret;
+	}
+	_out.erase(0, sent);
+
+	_client->watch(this);
+}
+
+long long AsyncConnection::nextTimer()const
+{
+	switch(_state)
+	{
+	case IDLE:
+	case RESOLVING:
+	case CONNECTING:
+		return _timer;
+	case CONNECTED:
+		if(!_pending.empty())
+		{
+			return _lastActivity + _client->_timeout;
+		}
+		return _refreshing ? -1 : _timer;
+	default:
+		return -1;
+	}
+}
+
+void AsyncConnection::handleTimers(long long now)
+{
+	switch(_state)
+	{
+	case IDLE:
+		if(now>=_timer)
+		{
+			startConnect();
+		}
+		break;
+	case RESOLVING:
+	case CONNECTING:
+		if(now>=_timer)
+		{
+			fail("Connection timeout");
+		}
+		break;
+	case CONNECTED:
+		if(!_pending.empty())
+		{
+			if(now>=_lastActivity + _client->_timeout)
+			{
+				fail("Timeout");
+			}
+		}
+		else if(!_refreshing && now>=_timer)
+		{
+			startRefresh();
+		}
+		break;
+	case STOPPED:
+		break;
+	}
+}
+
+void AsyncConnection::startConnect()
+{
+	_resolver = new internal::Resolver(_host, _port);
+	_fd = _resolver->start();
+
+	if (_fd < 0) {
+		fail(strerror(errno));
+		return;
+	}
+
+	_state = RESOLVING;
+	_timer = nowMs() + _client->_timeout;
+	_client->watch(this);
+}
+
+void AsyncConnection::onResolved()
+{
+	struct addrinfo	*res, *ai;
+	int	v, fd, one = 1;
+	std::string	reason = "Cannot connect to host";
+
+	v = _resolver->result(&res);
+
+	// The pipe goes with the resolver
+	_fd = -1;
+	_client->watch(this);
+	_resolver->release();
+	_resolver = NULL;
+
+	// Temporary failures (EAI_AGAIN) are retried like any other
+	if (v != 0) {
+		fail(gai_strerror(v));
+		return;
+	}
+
+	// Take the first address the connection can be started to, failures
+	// past that point are retried like any other.
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+		if (fd < 0) {
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		if ((::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) || (errno == EINPROGRESS)) {
+			_fd = fd;
+			break;
+		}
+
+		reason = strerror(errno);
+		::close(fd);
+	}
+
+	freeaddrinfo(res);
+
+	if (_fd < 0) {
+		fail(reason);
+		return;
+	}
+
+	// Requests are already written in batches
+	setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	_state = CONNECTING;
+	_client->watch(this);
+}
+
+void AsyncConnection::onConnected()
+{
+	_state = CONNECTED;
+	_client->watch(this);
+
+	if(!_user.empty())
+	{
+		send(Request::AUTH, "USERNAME " + _user, "");
+		send(Request::AUTH, "PASSWORD " + _passwd, "");
+	}
+
+	if(_client->_listener)
+	{
+		_client->_listener->connected(*this);
+	}
+
+	if(_state==CONNECTED)
+	{
+		startRefresh();
+	}
+}
+
+void AsyncConnection::startRefresh()
+{
+	_refreshing = true;
+	send(Request::LIST_UPS, "LIST UPS", "UPS");
+	flush();
+}
+
+void AsyncConnection::close()
+{
+	if(_resolver)
+	{
+		// Its pipe is closed once its thread is done
+		_fd = -1;
+		_client->watch(this);
+		_resolver->release();
+		_resolver = NULL;
+	}
+	else if(_fd>=0)
+	{
+		int fd = _fd;
+		_fd = -1;
+		_client->watch(this);
+		::close(fd);
+	}
+
+	_in.clear();
+	_out.clear();
+	_queue.clear();
+	_pending.clear();
+	_inList = false;
+	_listed.clear();
+	_refreshing = false;
+}
+
+/*
+ * Close the connection and schedule the next attempt, doubling the delay
+ * at each failure.  It is reset once a refresh went through.
+ */
+void AsyncConnection::fail(const std::string& reason)
+{
+	std::vector<std::string> lost;
+	for(size_t n=0; n<_pending.size(); ++n)
+	{
+		if(_pending[n].type==Request::COMMAND)
+		{
+			lost.push_back(_pending[n].line);
+		}
+	}
+	for(size_t n=0; n<_queue.size(); ++n)
+	{
+		if(_queue[n].type==Request::COMMAND)
+		{
+			lost.push_back(_queue[n].line);
+		}
+	}
+
+	close();
+
+	long retry = -1;
+	if(_loggingOut)
+	{
+		_loggingOut = false;
+		_state = STOPPED;
+	}
+	else
+	{
+		if(_delay==0)
+		{
+			_delay = _client->_minDelay;
+		}
+		else if(_delay < _client->_maxDelay / 2)
+		{
+			_delay *= 2;
+		}
+		else
+		{
+			_delay = _client->_maxDelay;
+		}
+		retry = _delay / 2 + rand() % (_delay / 2 + 1);
+
+		_state = IDLE;
+		_timer = nowMs() + retry;
+	}
+
+	AsyncListener* listener = _client->_listener;
+	if(listener)
+	{
+		for(size_t n=0; n<lost.size(); ++n)
+		{
+			listener->failed(*this, lost[n], reason);
+		}
+		listener->disconnected(*this, reason, retry);
+	}
+}
+
+void AsyncConnection::handleEvents(bool readable, bool writable, bool error)
+{
+	if(_state==RESOLVING)
+	{
+		if(readable || error)
+		{
+			onResolved();
+		}
+		return;
+	}
+
+	if(_state==CONNECTING)
+	{
+		if(!writable && !error)
+		{
+			return;
+		}
+
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if(getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len)<0)
+		{
+			err = errno;
+		}
+		if(err!=0)
+		{
+			fail(strerror(err));
+			return;
+		}
+
+		onConnected();
+		return;
+	}
+
+	if(_state!=CONNECTED)
+	{
+		return;
+	}
+
+	if(writable)
+	{
+		flush();
+		if(_state!=CONNECTED)
+		{
+			return;
+		}
+	}
+
+	if(!readable && !error)
+	{
+		return;
+	}
+
+	char buf[8192];
+	ssize_t ret;
+	while((ret = ::recv(_fd, buf, sizeof(buf), 0))!=0)
+	{
+		if(ret<0)
+		{
+			if(errno==EINTR)
+			{
+				continue;
+			}
+			if(errno==EAGAIN || errno==EWOULDBLOCK)
+			{
+				break;
+			}
+			fail(strerror(errno));
+			return;
+		}
+		_in.append(buf, ret);
+	}
+	_lastActivity = nowMs();
+
+	// Lines are handled in place, handleLine() returns false once the
+	// connection is gone (and _in with it).
+	size_t begin = 0, end;
+	while((end = _in.find('\n', begin))!=std::string::npos)
+	{
+		if(!handleLine(_in.data() + begin, end - begin))
+		{
+			return;
+		}
+		begin = end + 1;
+	}
+	_in.erase(0, begin);
+
+	if(ret==0)
+	{
+		fail(_loggingOut ? "Logged out" : "Connection closed by server");
+		return;
+	}
+
+	flush();
+}
+
+bool AsyncConnection::handleLine(const char* line, size_t len)
+{
+	if(_pending.empty())
+	{
+		fail("Invalid response");
+		return false;
+	}
+
+	Request& req = _pending.front();
+	AsyncListener* listener = _client->_listener;
+
+	if(!_inList && len>=4 && memcmp(line, "ERR ", 4)==0)
+	{
+		Request done = req;
+		_pending.pop_front();
+		if(listener)
+		{
+			listener->failed(*this, done.line, std::string(line + 4, len - 4));
+		}
+	}
+	else if(req.type<=Request::LIST_CMD)
+	{
+		if(!_inList)
+		{
+			std::string begin = "BEGIN LIST " + req.prefix;
+			if(len!=begin.size() || memcmp(line, begin.data(), len)!=0)
+			{
+				fail("Invalid response");
+				return false;
+			}
+			_inList = true;
+			_listed.clear();
+			return true;
+		}
+
+		if(len==9 + req.prefix.size() && memcmp(line, "END LIST ", 9)==0
+			&& memcmp(line + 9, req.prefix.data(), req.prefix.size())==0)
+		{
+			Request done = req;
+			_pending.pop_front();
+			_inList = false;
+			handleList(done);
+		}
+		else if(len>req.prefix.size() && memcmp(line, req.prefix.data(), req.prefix.size())==0)
+		{
+			_listed.push_back(std::vector<std::string>());
+			TcpClient::explode(line, len, req.prefix.size(), _listed.back());
+			return true;
+		}
+		else
+		{
+			fail("Invalid response");
+			return false;
+		}
+	}
+	else if(req.type<=Request::GET_NUMLOGINS)
+	{
+		if(len<req.prefix.size() || memcmp(line, req.prefix.data(), req.prefix.size())!=0)
+		{
+			fail("Invalid response");
+			return false;
+		}
+		Request done = req;
+		_pending.pop_front();
+		handleGet(done, line, len);
+	}
+	else
+	{
+		if(len<2 || memcmp(line, "OK", 2)!=0)
+		{
+			fail("Invalid response");
+			return false;
+		}
+		Request done = req;
+		_pending.pop_front();
+		if(done.type==Request::COMMAND && listener)
+		{
+			listener->completed(*this, done.line);
+		}
+	}
+
+	if(_state!=CONNECTED)
+	{
+		return false;
+	}
+
+	if(_refreshing && _pending.empty() && _queue.empty())
+	{
+		_refreshing = false;
+		_delay = 0;
+		_lastUpdate = time(NULL);
+		_timer = nowMs() + _client->_pollInterval;
+		if(listener)
+		{
+			listener->updated(*this);
+		}
+	}
+
+	return _state==CONNECTED;
+}
+
+void AsyncConnection::handleList(Request& req)
+{
+	switch(req.type)
+	{
+	case Request::LIST_UPS:
+	{
+		std::map<std::string,DeviceCache> devices;
+		for(size_t n=0; n<_listed.size(); ++n)
+		{
+			if(_listed[n].empty())
+			{
+				continue;
 			}
-			break;
-		case SIMPLE_STRING:
-			if(c==' ' /* || c=='\t' */)
+			const std::string& dev = _listed[n][0];
+			std::map<std::string,DeviceCache>::iterator it = _devices.find(dev);
+			DeviceCache& cache = devices[dev];
+			if(it!=_devices.end())
 			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = INIT;
+				cache = it->second;
 			}
-			else if(c=='\\')
+			cache.description = _listed[n].size()>1 ? _listed[n][1] : "";
+
+			send(Request::LIST_VAR, "LIST VAR " + dev, "VAR " + dev, dev);
+			send(Request::LIST_RW, "LIST RW " + dev, "RW " + dev, dev);
+			send(Request::LIST_CMD, "LIST CMD " + dev, "CMD " + dev, dev);
+			send(Request::GET_NUMLOGINS, "GET NUMLOGINS " + dev, "NUMLOGINS " + dev, dev);
+		}
+		// Devices gone from the server are forgotten
+		_devices.swap(devices);
+		break;
+	}
+	case Request::LIST_VAR:
+	{
+		DeviceCache& cache = _devices[req.dev];
+		cache.variables.clear();
+		for(size_t n=0; n<_listed.size(); ++n)
+		{
+			if(_listed[n].empty())
 			{
-				state = SIMPLE_ESCAPE;
+				continue;
 			}
-			else if(c=='"')
+			std::vector<std::string>& values = cache.variables[_listed[n][0]];
+			values.assign(_listed[n].begin() + 1, _listed[n].end());
+
+			if(_client->_fetchDescriptions && !cache.described)
 			{
-				/* if(!temp.empty()) : Must not occur */
-					res.push_back(temp);
-				temp.clear();
-				state = QUOTED_STRING;
+				const std::string& name = _listed[n][0];
+				send(Request::GET_DESC, "GET DESC " + req.dev + " " + name,
+					"DESC " + req.dev + " " + name, req.dev, name);
 			}
-			/* What about bad characters ? */
-			else
-			{
-				temp += c;
-			}		
-			break;
-		case QUOTED_STRING:
-			if(c=='\\')
+		}
+		break;
+	}
+	case Request::LIST_RW:
+	{
+		DeviceCache& cache = _devices[req.dev];
+		cache.rw.clear();
+		for(size_t n=0; n<_listed.size(); ++n)
+		{
+			if(!_listed[n].empty())
 			{
-				state = QUOTED_ESCAPE;
+				cache.rw.insert(_listed[n][0]);
 			}
-			else if(c=='"')
+		}
+		break;
+	}
+	case Request::LIST_CMD:
+	{
+		DeviceCache& cache = _devices[req.dev];
+		cache.commands.clear();
+		for(size_t n=0; n<_listed.size(); ++n)
+		{
+			if(_listed[n].empty())
 			{
-				res.push_back(temp);
-				temp.clear();
-				state = INIT;
+				continue;
 			}
-			/* What about bad characters ? */
-			else
+			cache.commands.insert(_listed[n][0]);
+
+			if(_client->_fetchDescriptions && !cache.described)
 			{
-				temp += c;
+				const std::string& name = _listed[n][0];
+				send(Request::GET_CMDDESC, "GET CMDDESC " + req.dev + " " + name,
+					"CMDDESC " + req.dev + " " + name, req.dev, name);
 			}
-			break;
-		case SIMPLE_ESCAPE:
-			if(c=='\\' || c=='"' || c==' ' /* || c=='\t'*/)
+		}
+		// LIST CMD comes after LIST VAR: both descriptions are on their way
+		if(_client->_fetchDescriptions)
+		{
+			cache.described = true;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	_listed.clear();
+}
+
+void AsyncConnection::handleGet(Request& req, const char* line, size_t len)
+{
+	std::vector<std::string> res;
+	TcpClient::explode(line, len, req.prefix.size(), res);
+	std::string value = res.empty() ? "" : res[0];
+
+	std::map<std::string,DeviceCache>::iterator it = _devices.find(req.dev);
+	if(it==_devices.end())
+	{
+		return;
+	}
+
+	switch(req.type)
+	{
+	case Request::GET_DESC:
+		it->second.variableDescriptions[req.name] = value;
+		break;
+	case Request::GET_CMDDESC:
+		it->second.commandDescriptions[req.name] = value;
+		break;
+	case Request::GET_NUMLOGINS:
+		it->second.numLogins = atoi(value.c_str());
+		break;
+	default:
+		break;
+	}
+}
+
+
+AsyncClient::AsyncClient():
+_listener(NULL),
+_pollInterval(5000),
+_timeout(10000),
+_minDelay(1000),
+_maxDelay(60000),
+_fetchDescriptions(false),
+_stop(false),
+_running(0),
+_epoll(-1)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	// poll() is used instead if this fails
+	_epoll = epoll_create(64);
+#endif
+}
+
+AsyncClient::~AsyncClient()
+{
+	for(size_t n=0; n<_connections.size(); ++n)
+	{
+		delete _connections[n];
+	}
+	for(size_t n=0; n<_removed.size(); ++n)
+	{
+		delete _removed[n];
+	}
+	if(_epoll>=0)
+	{
+		::close(_epoll);
+	}
+}
+
+AsyncConnection* AsyncClient::addServer(const std::string& host, int port)
+{
+	AsyncConnection* conn = new AsyncConnection(this, host, port);
+	_connections.push_back(conn);
+	return conn;
+}
+
+void AsyncClient::removeServer(AsyncConnection* conn)
+{
+	for(std::vector<AsyncConnection*>::iterator it=_connections.begin(); it!=_connections.end(); ++it)
+	{
+		if(*it==conn)
+		{
+			_connections.erase(it);
+			if(_running>0)
 			{
-				temp += c;
+				// Events of this run() may still point to it
+				conn->close();
+				_removed.push_back(conn);
 			}
 			else
 			{
-				temp += '\\' + c; // Really do this ?
-			}
-			state = SIMPLE_STRING;
-			break;
-		case QUOTED_ESCAPE:
-			if(c=='\\' || c=='"')
-			{
-				temp += c;
+				delete conn;
 			}
-			else
+			return;
+		}
+	}
+}
+
+std::vector<AsyncConnection*> AsyncClient::getConnections()const
+{
+	return _connections;
+}
+
+void AsyncClient::setListener(AsyncListener* listener)
+{
+	_listener = listener;
+}
+
+AsyncListener* AsyncClient::getListener()const
+{
+	return _listener;
+}
+
+void AsyncClient::setPollInterval(long interval)
+{
+	_pollInterval = interval;
+}
+
+long AsyncClient::getPollInterval()const
+{
+	return _pollInterval;
+}
+
+void AsyncClient::setTimeout(long timeout)
+{
+	_timeout = timeout;
+}
+
+long AsyncClient::getTimeout()const
+{
+	return _timeout;
+}
+
+void AsyncClient::setReconnectDelay(long min, long max)
+{
+	_minDelay = min>0 ? min : 1;
+	_maxDelay = max>_minDelay ? max : _minDelay;
+}
+
+void AsyncClient::setFetchDescriptions(bool fetch)
+{
+	_fetchDescriptions = fetch;
+}
+
+/*
+ * Tell the poller which events a connection waits for, if they changed.
+ * The previous descriptor must still be open.
+ */
+void AsyncClient::watch(AsyncConnection* conn)
+{
+	int fd = conn->_fd;
+	bool write = (conn->_state==AsyncConnection::CONNECTING) || !conn->_out.empty();
+
+	if(fd==conn->_watchFd && (fd<0 || write==conn->_watchWrite))
+	{
+		return;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if(_epoll>=0)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | (write ? (int)EPOLLOUT : 0);
+		ev.data.ptr = conn;
+
+		if(conn->_watchFd>=0 && conn->_watchFd!=fd)
+		{
+			epoll_ctl(_epoll, EPOLL_CTL_DEL, conn->_watchFd, &ev);
+		}
+		if(fd>=0)
+		{
+			epoll_ctl(_epoll, fd==conn->_watchFd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+		}
+	}
+#endif
+
+	conn->_watchFd = fd;
+	conn->_watchWrite = write;
+}
+
+bool AsyncClient::run(long timeout)
+{
+	_running++;
+	bool ret = wait(timeout);
+	_running--;
+
+	if(_running==0)
+	{
+		for(size_t n=0; n<_removed.size(); ++n)
+		{
+			delete _removed[n];
+		}
+		_removed.clear();
+	}
+
+	return ret;
+}
+
+bool AsyncClient::isRemoved(AsyncConnection* conn)const
+{
+	return std::find(_removed.begin(), _removed.end(), conn)!=_removed.end();
+}
+
+/*
+ * Body of run().  Listeners called from here may remove connections, so
+ * each one is checked against _removed before use.
+ */
+bool AsyncClient::wait(long timeout)
+{
+	long long now = nowMs(), next = -1;
+	size_t n, active = 0;
+
+	std::vector<AsyncConnection*> timed(_connections);
+	for(n=0; n<timed.size(); ++n)
+	{
+		if(!isRemoved(timed[n]))
+		{
+			timed[n]->handleTimers(now);
+		}
+	}
+
+	for(n=0; n<_connections.size(); ++n)
+	{
+		long long t = _connections[n]->nextTimer();
+		if(t>=0 && (next<0 || t<next))
+		{
+			next = t;
+		}
+		if(_connections[n]->_fd>=0 || t>=0)
+		{
+			active++;
+		}
+	}
+
+	if(active==0)
+	{
+		return false;
+	}
+
+	if(next>=0)
+	{
+		long long left = next - nowMs();
+		if(left<0)
+		{
+			left = 0;
+		}
+		if(timeout<0 || left<timeout)
+		{
+			timeout = (long)left;
+		}
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if(_epoll>=0)
+	{
+		struct epoll_event events[64];
+		int count = epoll_wait(_epoll, events, 64, timeout);
+
+		for(int i=0; i<count; ++i)
+		{
+			AsyncConnection* conn = static_cast<AsyncConnection*>(events[i].data.ptr);
+			if(isRemoved(conn))
 			{
-				temp += '\\' + c; // Really do this ?
+				continue;
 			}
-			state = QUOTED_STRING;
-			break;
+			conn->handleEvents((events[i].events & EPOLLIN)!=0, (events[i].events & EPOLLOUT)!=0,
+				(events[i].events & (EPOLLERR | EPOLLHUP))!=0);
 		}
+
+		return true;
 	}
+#endif
 
-	if(!temp.empty())
+	std::vector<struct pollfd> fds;
+	std::vector<AsyncConnection*> conns;
+	for(n=0; n<_connections.size(); ++n)
 	{
-		res.push_back(temp);
+		AsyncConnection* conn = _connections[n];
+		if(conn->_fd<0)
+		{
+			continue;
+		}
+		struct pollfd pfd;
+		pfd.fd = conn->_fd;
+		pfd.events = POLLIN | (conn->_watchWrite ? POLLOUT : 0);
+		pfd.revents = 0;
+		fds.push_back(pfd);
+		conns.push_back(conn);
 	}
 
-	return res;
+	int count = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout);
+
+	for(n=0; n<fds.size() && count>0; ++n)
+	{
+		if(fds[n].revents)
+		{
+			count--;
+			if(isRemoved(conns[n]))
+			{
+				continue;
+			}
+			conns[n]->handleEvents((fds[n].revents & POLLIN)!=0, (fds[n].revents & POLLOUT)!=0,
+				(fds[n].revents & (POLLERR | POLLHUP | POLLNVAL))!=0);
+		}
+	}
+
+	return true;
 }
 
-std::string TcpClient::escape(const std::string& str)
+void AsyncClient::loop()
 {
-	std::string res = "\"";
-	
-	for(size_t n=0; n<str.size(); n++)
+	_stop = false;
+	while(!_stop && run())
 	{
-		char c = str[n];
-		if(c=='"')
-			res += "\\\"";
-		else if(c=='\\')
-			res += "\\\\";
-		else
-			res += c;
 	}
+}
 
-	res += '"';
-	return res; 
+void AsyncClient::stop()
+{
+	_stop = true;
 }
 
 /*
@@ -966,6 +2871,23 @@ std::map<std::string,std::vector<std::string> > Device::getVariableValues()
 	return getClient()->getDeviceVariableValues(getName());
 }
 
+std::map<std::string,std::vector<std::string> > Device::getVariableValues(const std::set<std::string>& names)
+	throw(NutException)
+{
+	return getClient()->getDeviceVariableValues(getName(), names);
+}
+
+std::map<std::string,std::string> Device::getVariableDescriptions()throw(NutException)
+{
+  return getClient()->getDeviceVariableDescriptions(getName(), getVariableNames());
+}
+
+std::map<std::string,std::string> Device::getVariableDescriptions(const std::set<std::string>& names)
+	throw(NutException)
+{
+  return getClient()->getDeviceVariableDescriptions(getName(), names);
+}
+
 std::set<std::string> Device::getVariableNames()throw(NutException)
 {
   return getClient()->getDeviceVariableNames(getName());
@@ -1049,6 +2971,11 @@ Command Device::getCommand(const std::string& name)throw(NutException)
     return Command(NULL, "");
 }
 
+std::map<std::string,std::string> Device::getCommandDescriptions()throw(NutException)
+{
+  return getClient()->getDeviceCommandDescriptions(getName(), getCommandNames());
+}
+
 void Device::executeCommand(const std::string& name)throw(NutException)
 {
   getClient()->executeDeviceCommand(getName(), name);
@@ -1375,6 +3302,24 @@ long nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client)
 	return -1;
 }
 
+int nutclient_tcp_start_tls(NUTCLIENT_TCP_t client, const char* capath)
+{
+	if(client)
+	{
+		nut::TcpClient* cl = dynamic_cast<nut::TcpClient*>((nut::Client*)client);
+		if(cl)
+		{
+			try
+			{
+				cl->startTLS(capath ? capath : "");
+				return 0;
+			}
+			catch(...){}
+		}
+	}
+	return -1;
+}
+
 
 void nutclient_authenticate(NUTCLIENT_t client, const char* login, const char* passwd)
 {
@@ -27,19 +27,25 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <exception>
 
+#include <time.h>
+
 namespace nut
 {
 
 namespace internal
 {
 class Socket;
+class Resolver;
 } /* namespace internal */
 
 
 class Client;
 class TcpClient;
+class AsyncClient;
+class AsyncConnection;
 class Device;
 class Variable;
 class Command;
@@ -207,6 +213,13 @@ public:
 	 * \return Variable description if provided.
 	 */
 	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException)=0;
+	/**
+	 * Retrieve the descriptions of some variables.
+	 * \param dev Device name
+	 * \param names Variable names
+	 * \return Variable descriptions indexed by variable names.
+	 */
+	virtual std::map<std::string,std::string> getDeviceVariableDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	/**
 	 * Retrieve values of a variable.
 	 * \param dev Device name
@@ -220,6 +233,14 @@ public:
 	 * \return Variable values indexed by variable names.
 	 */
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
+	/**
+	 * Retrieve values of some variables of a device.
+	 * \param dev Device name
+	 * \param names Variable names
+	 * \return Variable values indexed by variable names, variables
+	 * not supported by the device are left out.
+	 */
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	/**
 	 * Intend to set the value of a variable.
 	 * \param dev Device name
@@ -261,6 +282,13 @@ public:
 	 * \return Command description if provided.
 	 */
 	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException)=0;
+	/**
+	 * Retrieve the descriptions of some commands.
+	 * \param dev Device name
+	 * \param names Command names
+	 * \return Command descriptions indexed by command names.
+	 */
+	virtual std::map<std::string,std::string> getDeviceCommandDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	/**
 	 * Intend to execute a command.
 	 * \param dev Device name
@@ -297,6 +325,7 @@ protected:
  */
 class TcpClient : public Client
 {
+	friend class AsyncConnection;
 public:
 	/**
 	 * Construct a nut TcpClient object.
@@ -325,6 +354,28 @@ public:
 	 */
 	void connect()throw(nut::IOException);
 
+	/**
+	 * Switch the connection to TLS with STARTTLS.
+	 * Once done, connect() switches again to TLS when reconnecting, and
+	 * resumes the previous TLS session if the server still knows it.
+	 * If that fails, connect() drops the connection and throws an
+	 * IOException: it never goes on in clear text.
+	 * \param caPath Directory of trusted CA certificates (as prepared by
+	 * c_rehash) to verify the server certificate and host name with, empty
+	 * not to verify them.
+	 */
+	void startTLS(const std::string& caPath = "")throw(NutException);
+
+	/**
+	 * Test if the connection uses TLS.
+	 */
+	bool isTLS()const;
+
+	/**
+	 * Test if the TLS handshake resumed a previous session.
+	 */
+	bool isTLSSessionReused()const;
+
 	/**
 	 * Test if the connection is active.
 	 * \return tru if the connection is active.
@@ -347,6 +398,19 @@ public:
 	 */
 	long getTimeout()const;
 
+	/**
+	 * Set how many queries batch requests (like getDeviceVariableDescriptions())
+	 * write to the server before reading the answers.
+	 * \param depth Number of queries in flight, 1 to send them one by one.
+	 */
+	void setPipelineDepth(size_t depth);
+
+	/**
+	 * Retrieve the pipeline depth.
+	 * \returns Number of queries batch requests keep in flight.
+	 */
+	size_t getPipelineDepth()const;
+
 	/**
 	 * Retriueve the host name of the server the client is connected to.
 	 * \return Server host name
@@ -368,13 +432,16 @@ public:
 	virtual std::set<std::string> getDeviceVariableNames(const std::string& dev)throw(NutException);
 	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev)throw(NutException);
 	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::map<std::string,std::string> getDeviceVariableDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException);
 	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	virtual void setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException);
 	virtual void setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException);
 
 	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev)throw(NutException);
 	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::map<std::string,std::string> getDeviceCommandDescriptions(const std::string& dev, const std::set<std::string>& names)throw(NutException);
 	virtual void executeDeviceCommand(const std::string& dev, const std::string& name)throw(NutException);
 
  	virtual void deviceLogin(const std::string& dev)throw(NutException);
@@ -384,25 +451,387 @@ public:
 
 protected:
 	std::string sendQuery(const std::string& req)throw(nut::IOException);
+	std::vector<std::string> sendQueries(const std::vector<std::string>& reqs)throw(nut::IOException);
 	static void detectError(const std::string& req)throw(nut::NutException);
 
 	std::vector<std::string> get(const std::string& subcmd, const std::string& params = "")
 		throw(nut::NutException);
 
+	std::map<std::string,std::vector<std::string> > get(const std::string& subcmd, const std::string& dev, const std::set<std::string>& names)
+		throw(nut::NutException);
+
 	std::vector<std::vector<std::string> > list(const std::string& subcmd, const std::string& params = "")
 		throw(nut::NutException);
 
+	void negotiateTLS(const std::string& caPath)throw(NutException);
+
 	static std::vector<std::string> explode(const std::string& str, size_t begin=0);
+	static void explode(const char* str, size_t len, size_t begin, std::vector<std::string>& res);
 	static std::string escape(const std::string& str);
 
 private:
 	std::string _host;
 	int _port;
 	long _timeout;
+	size_t _pipeline;
+	bool _tls; // STARTTLS on every connection, once asked for
+	std::string _caPath;
 	internal::Socket* _socket;
 };
 
 
+/**
+ * Receives the events of an AsyncClient.
+ * The methods are called from AsyncClient::run() and do nothing by default:
+ * override the ones of interest.  They must not remove connections from
+ * the AsyncClient.
+ */
+class AsyncListener
+{
+public:
+	virtual ~AsyncListener();
+
+	/**
+	 * The connection to the server is up, the first refresh is on its way.
+	 * \param conn Connection.
+	 */
+	virtual void connected(AsyncConnection& conn);
+	/**
+	 * The connection was lost or could not be established.
+	 * \param conn Connection.
+	 * \param reason What happened.
+	 * \param retry Milliseconds before the next attempt, negative if the
+	 * connection will not be retried (after logout()).
+	 */
+	virtual void disconnected(AsyncConnection& conn, const std::string& reason, long retry);
+	/**
+	 * Every device of the server has been refreshed.
+	 * \param conn Connection.
+	 */
+	virtual void updated(AsyncConnection& conn);
+	/**
+	 * A request has been accepted by the server.
+	 * Only called for requests sent on behalf of the application (SET VAR,
+	 * INSTCMD, LOGIN...), not for the ones refreshing the devices.
+	 * \param conn Connection.
+	 * \param request The request, as sent to the server.
+	 */
+	virtual void completed(AsyncConnection& conn, const std::string& request);
+	/**
+	 * A request has been refused by the server, or the connection was lost
+	 * before the answer came.
+	 * \param conn Connection.
+	 * \param request The request, as sent to the server.
+	 * \param error Error returned by the server (like "ACCESS-DENIED").
+	 */
+	virtual void failed(AsyncConnection& conn, const std::string& request, const std::string& error);
+};
+
+/**
+ * Connection of an AsyncClient to one NUTD server.
+ *
+ * The devices of the server are refreshed in the background, and the
+ * Client methods reading them answer from the last refresh without
+ * blocking, so that Device, Variable and Command work on a connection like
+ * on a TcpClient.  Methods changing something on the server (setting a
+ * variable, executing a command...) send the request and return at once:
+ * the outcome is reported to the AsyncListener.
+ *
+ * Connections are created with AsyncClient::addServer() and belong to the
+ * AsyncClient.
+ */
+class AsyncConnection : public Client
+{
+	friend class AsyncClient;
+public:
+	virtual ~AsyncConnection();
+
+	/**
+	 * Retrieve the AsyncClient the connection belongs to.
+	 */
+	AsyncClient* getAsyncClient()const;
+	/**
+	 * Retrieve the host name of the server.
+	 */
+	std::string getHost()const;
+	/**
+	 * Retrieve the port of the server.
+	 */
+	int getPort()const;
+	/**
+	 * Test if the connection is up.
+	 */
+	bool isConnected()const;
+	/**
+	 * Retrieve when the devices were last completely refreshed.
+	 * \return Time of the last refresh, 0 if none yet.
+	 */
+	time_t getLastUpdate()const;
+	/**
+	 * Refresh the devices as soon as possible instead of waiting for the
+	 * next poll.  If the connection is down, try to reconnect now.
+	 */
+	void refresh();
+
+	/**
+	 * Set the user name and password, sent now and at every reconnection.
+	 */
+	virtual void authenticate(const std::string& user, const std::string& passwd)throw(NutException);
+	/**
+	 * Log out and close the connection, which is not retried until
+	 * refresh() is called.
+	 */
+	virtual void logout()throw(NutException);
+
+	virtual std::set<std::string> getDeviceNames()throw(NutException);
+	virtual std::string getDeviceDescription(const std::string& name)throw(NutException);
+
+	virtual std::set<std::string> getDeviceVariableNames(const std::string& dev)throw(NutException);
+	virtual std::set<std::string> getDeviceRWVariableNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceVariableDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::vector<std::string> getDeviceVariableValue(const std::string& dev, const std::string& name)throw(NutException);
+	virtual std::map<std::string,std::vector<std::string> > getDeviceVariableValues(const std::string& dev)throw(NutException);
+	virtual void setDeviceVariable(const std::string& dev, const std::string& name, const std::string& value)throw(NutException);
+	virtual void setDeviceVariable(const std::string& dev, const std::string& name, const std::vector<std::string>& values)throw(NutException);
+
+	virtual std::set<std::string> getDeviceCommandNames(const std::string& dev)throw(NutException);
+	virtual std::string getDeviceCommandDescription(const std::string& dev, const std::string& name)throw(NutException);
+	virtual void executeDeviceCommand(const std::string& dev, const std::string& name)throw(NutException);
+
+	virtual void deviceLogin(const std::string& dev)throw(NutException);
+	virtual void deviceMaster(const std::string& dev)throw(NutException);
+	virtual void deviceForcedShutdown(const std::string& dev)throw(NutException);
+	virtual int deviceGetNumLogins(const std::string& dev)throw(NutException);
+
+private:
+	AsyncConnection(AsyncClient* client, const std::string& host, int port);
+
+	/** What a device looked like at the last refresh. */
+	struct DeviceCache
+	{
+		DeviceCache();
+
+		std::string description;
+		std::map<std::string,std::vector<std::string> > variables;
+		std::set<std::string> rw;
+		std::set<std::string> commands;
+		std::map<std::string,std::string> variableDescriptions;
+		std::map<std::string,std::string> commandDescriptions;
+		int numLogins;
+		bool described;
+	};
+
+	/** Request waiting for its answer. */
+	struct Request
+	{
+		enum Type
+		{
+			LIST_UPS,
+			LIST_VAR,
+			LIST_RW,
+			LIST_CMD,
+			GET_DESC,
+			GET_CMDDESC,
+			GET_NUMLOGINS,
+			AUTH,
+			COMMAND
+		};
+
+		Request(Type type, const std::string& line, const std::string& prefix,
+			const std::string& dev = "", const std::string& name = "");
+
+		Type type;
+		std::string line;	/**< As sent, without the newline. */
+		std::string prefix;	/**< Start of the answer lines. */
+		std::string dev;
+		std::string name;
+	};
+
+	enum State
+	{
+		IDLE,		/**< Waiting to (re)connect. */
+		RESOLVING,	/**< Waiting for the host name resolution. */
+		CONNECTING,
+		CONNECTED,
+		STOPPED		/**< Logged out, not retried. */
+	};
+
+	const DeviceCache& getDeviceCache(const std::string& dev)const throw(NutException);
+	void send(Request::Type type, const std::string& line, const std::string& prefix,
+		const std::string& dev = "", const std::string& name = "");
+	void sendCommand(const std::string& line)throw(NutException);
+	void flush();
+
+	long long nextTimer()const;
+	void handleTimers(long long now);
+	void handleEvents(bool readable, bool writable, bool error);
+
+	void startConnect();
+	void onResolved();
+	void onConnected();
+	void fail(const std::string& reason);
+	void close();
+	void startRefresh();
+
+	bool handleLine(const char* line, size_t len);
+	void handleList(Request& req);
+	void handleGet(Request& req, const char* line, size_t len);
+
+	AsyncClient* _client;
+	std::string _host;
+	int _port;
+	int _fd;
+	State _state;
+	internal::Resolver* _resolver;	/**< While RESOLVING, _fd is its pipe. */
+
+	// Watched events, as last told to the poller
+	int _watchFd;
+	bool _watchWrite;
+
+	std::string _user;
+	std::string _passwd;
+
+	std::string _in;
+	std::string _out;
+	std::deque<Request> _queue;	/**< Not sent yet. */
+	std::deque<Request> _pending;	/**< Sent, waiting for the answer. */
+	bool _inList;
+	std::vector<std::vector<std::string> > _listed;
+	bool _refreshing;
+	bool _loggingOut;
+
+	long long _timer;	/**< Reconnection, refresh or connect timeout. */
+	long long _lastActivity;
+	long _delay;		/**< Current reconnection delay. */
+	time_t _lastUpdate;
+
+	std::map<std::string,DeviceCache> _devices;
+};
+
+/**
+ * Asynchronous NUTD client.
+ *
+ * Keeps connections to many NUTD servers from a single thread: every
+ * connection is non blocking, and run() waits for all of them at once
+ * (with epoll where available, poll otherwise).  The devices of every
+ * server are refreshed every poll interval.  Lost connections are retried
+ * after a delay doubling at each failure (with some jitter so that servers
+ * restarting do not get all their clients back at the same time), up to a
+ * maximum.
+ *
+ * \code
+ * nut::AsyncClient client;
+ * client.setListener(&myListener);
+ * client.addServer("ups1.example.com");
+ * client.addServer("ups2.example.com");
+ * client.loop();
+ * \endcode
+ *
+ * \note Host names are resolved in a thread of their own, so that a slow
+ * name server does not hold up the other connections.
+ */
+class AsyncClient
+{
+	friend class AsyncConnection;
+public:
+	AsyncClient();
+	/**
+	 * Close and delete all connections.
+	 */
+	~AsyncClient();
+
+	/**
+	 * Add a server, connected at the next run().
+	 * \param host Server host name.
+	 * \param port Server port.
+	 * \return The connection, owned by the AsyncClient.
+	 */
+	AsyncConnection* addServer(const std::string& host, int port = 3493);
+	/**
+	 * Close and delete a connection.
+	 * From a listener, the deletion waits until run() returns.
+	 */
+	void removeServer(AsyncConnection* conn);
+	/**
+	 * Retrieve all connections.
+	 */
+	std::vector<AsyncConnection*> getConnections()const;
+
+	/**
+	 * Set the object receiving the events, NULL for none.
+	 */
+	void setListener(AsyncListener* listener);
+	AsyncListener* getListener()const;
+
+	/**
+	 * Set how often the devices are refreshed.
+	 * \param interval Milliseconds between the end of a refresh and the
+	 * start of the next one.
+	 */
+	void setPollInterval(long interval);
+	long getPollInterval()const;
+
+	/**
+	 * Set how long to wait for a connection or an answer before giving up
+	 * on the connection.
+	 * \param timeout Timeout in milliseconds.
+	 */
+	void setTimeout(long timeout);
+	long getTimeout()const;
+
+	/**
+	 * Set the delays between reconnection attempts.
+	 * \param min Delay after the first failure, in milliseconds.
+	 * \param max Maximum delay, in milliseconds.
+	 */
+	void setReconnectDelay(long min, long max);
+
+	/**
+	 * Also retrieve the descriptions of variables and commands (once per
+	 * device, when it is first seen).  Disabled by default.
+	 */
+	void setFetchDescriptions(bool fetch);
+
+	/**
+	 * Wait for events and handle them.
+	 * \param timeout Maximum time to wait in milliseconds, negative to wait
+	 * until something happens.
+	 * \return false if there is nothing to wait for (no connection, or all
+	 * logged out).
+	 */
+	bool run(long timeout = -1);
+	/**
+	 * Call run() until stop() is called or there is nothing left to wait for.
+	 */
+	void loop();
+	/**
+	 * Make loop() return, may be called from a listener.
+	 */
+	void stop();
+
+private:
+	AsyncClient(const AsyncClient&);
+	AsyncClient& operator=(const AsyncClient&);
+
+	void watch(AsyncConnection* conn);
+	bool wait(long timeout);
+	bool isRemoved(AsyncConnection* conn)const;
+
+	std::vector<AsyncConnection*> _connections;
+	/** Removed while run() was busy with them, deleted when it returns */
+	std::vector<AsyncConnection*> _removed;
+	AsyncListener* _listener;
+	long _pollInterval;
+	long _timeout;
+	long _minDelay;
+	long _maxDelay;
+	bool _fetchDescriptions;
+	bool _stop;
+	/** Nesting of run() */
+	int _running;
+	int _epoll;
+};
+
 /**
  * Device attached to a client.
  * Device is a lightweight class which can be copied easily.
@@ -468,6 +897,23 @@ public:
 	 * \return Map of all variables values indexed by their names.
 	 */
 	std::map<std::string,std::vector<std::string> > getVariableValues()throw(NutException);
+	/**
+	 * Intend to retrieve values of some variables of the device.
+	 * \param names Names of the variables to get.
+	 * \return Map of the variables values indexed by their names.
+	 */
+	std::map<std::string,std::vector<std::string> > getVariableValues(const std::set<std::string>& names)throw(NutException);
+	/**
+	 * Intend to retrieve descriptions of all variables of the device.
+	 * \return Map of all variables descriptions indexed by their names.
+	 */
+	std::map<std::string,std::string> getVariableDescriptions()throw(NutException);
+	/**
+	 * Intend to retrieve descriptions of some variables of the device.
+	 * \param names Names of the variables.
+	 * \return Map of the variables descriptions indexed by their names.
+	 */
+	std::map<std::string,std::string> getVariableDescriptions(const std::set<std::string>& names)throw(NutException);
 	/**
 	 * Retrieve all variables names supported by the device.
 	 * \return Set of available variable names.
@@ -524,6 +970,11 @@ public:
 	 * \return Command object.
 	 */
 	Command getCommand(const std::string& name)throw(NutException);
+	/**
+	 * Intend to retrieve descriptions of all commands of the device.
+	 * \return Map of all commands descriptions indexed by their names.
+	 */
+	std::map<std::string,std::string> getCommandDescriptions()throw(NutException);
 	/**
 	 * Intend to execute a command on the device.
 	 * \param name Command name.
@@ -951,6 +1402,15 @@ void nutclient_tcp_set_timeout(NUTCLIENT_TCP_t client, long timeout);
  * \return Timeout value in seconds.
  */
 long nutclient_tcp_get_timeout(NUTCLIENT_TCP_t client);
+/**
+ * Switch a nut TCP client to TLS with STARTTLS.
+ * Reconnections switch to TLS again and resume the TLS session.
+ * \param client Nut TCP client handle.
+ * \param capath Directory of trusted CA certificates to verify the server
+ * with, NULL not to verify it.
+ * \return 0 if TLS is in use.
+ */
+int nutclient_tcp_start_tls(NUTCLIENT_TCP_t client, const char* capath);
 
 /** \} */
 
@@ -543,9 +543,10 @@ const char *upscli_strerror(UPSCONN_t *ups)
 }
 
 /* Read up to buflen bytes from fd and return the number of bytes
-   read. If no data is available within d_sec + d_usec, return 0.
+   read. If no data is available within timeout (wait forever if
+   tv_sec < 0), return 0.
    On error, a value < 0 is returned (errno indicates error). */
-static int upscli_select_read(const int fd, void *buf, const size_t buflen, const long d_sec, const long d_usec)
+static int upscli_select_read(const int fd, void *buf, const size_t buflen, const struct timeval *timeout)
 {
 	int		ret;
 	fd_set		fds;
@@ -554,10 +555,9 @@ static int upscli_select_read(const int fd, void *buf, const size_t buflen, cons
 	FD_ZERO(&fds);
 	FD_SET(fd, &fds);
 
-	tv.tv_sec = d_sec;
-	tv.tv_usec = d_usec;
+	tv = *timeout;
 
-	ret = select(fd + 1, &fds, NULL, NULL, &tv);
+	ret = select(fd + 1, &fds, NULL, NULL, (tv.tv_sec < 0) ? NULL : &tv);
 
 	if (ret < 1) {
 		return ret;
@@ -587,7 +587,7 @@ static int net_read(UPSCONN_t *ups, char *buf, size_t buflen)
 	}
 #endif
 
-	ret = upscli_select_read(ups->fd, buf, buflen, 5, 0);
+	ret = upscli_select_read(ups->fd, buf, buflen, &ups->timeout);
 
 	/* error reading data, server disconnected? */
 	if (ret < 0) {
@@ -604,9 +604,10 @@ static int net_read(UPSCONN_t *ups, char *buf, size_t buflen)
 }
 
 /* Write up to buflen bytes to fd and return the number of bytes
-   written. If no data is available within d_sec + d_usec, return 0.
+   written. If fd doesn't become writable within timeout (wait forever
+   if tv_sec < 0), return 0.
    On error, a value < 0 is returned (errno indicates error). */
-static int upscli_select_write(const int fd, const void *buf, const size_t buflen, const long d_sec, const long d_usec)
+static int upscli_select_write(const int fd, const void *buf, const size_t buflen, const struct timeval *timeout)
 {
 	int		ret;
 	fd_set		fds;
@@ -615,10 +616,9 @@ static int upscli_select_write(const int fd, const void *buf, const size_t bufle
 	FD_ZERO(&fds);
 	FD_SET(fd, &fds);
 
-	tv.tv_sec = d_sec;
-	tv.tv_usec = d_usec;
+	tv = *timeout;
 
-	ret = select(fd + 1, NULL, &fds, NULL, &tv);
+	ret = select(fd + 1, NULL, &fds, NULL, (tv.tv_sec < 0) ? NULL : &tv);
 
 	if (ret < 1) {
 		return ret;
@@ -648,7 +648,7 @@ static int net_write(UPSCONN_t *ups, const char *buf, size_t buflen)
 	}
 #endif
 
-	ret = upscli_select_write(ups->fd, buf, buflen, 0, 0);
+	ret = upscli_select_write(ups->fd, buf, buflen, &ups->timeout);
 
 	/* error writing data, server disconnected? */
 	if (ret < 0) {
@@ -865,6 +865,8 @@ int upscli_tryconnect(UPSCONN_t *ups, const char *host, int port, int flags,stru
 	memset(ups, 0, sizeof(*ups));
 	ups->upsclient_magic = UPSCLIENT_MAGIC;
 	ups->fd = -1;
+	ups->readsize = UPSCLI_READBUF_LEN;
+	ups->timeout.tv_sec = UPSCLI_TIMEOUT;
 
 	if (!host) {
 		ups->upserror = UPSCLI_ERR_NOSUCHHOST;
@@ -1326,6 +1328,120 @@ int upscli_list_next(UPSCONN_t *ups, unsigned int numq, const char **query,
 	return 1;
 }
 
+int upscli_getvars_start(UPSCONN_t *ups, const char *upsname, unsigned int numvar,
+		const char **var)
+{
+	char	cmd[UPSCLI_NETBUF_LEN * 8], tmp[UPSCLI_NETBUF_LEN];
+	const char	*query[UPSCLI_GETVARS_MAX + 2];
+	unsigned int	i;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if ((!upsname) || (numvar < 1) || (numvar > UPSCLI_GETVARS_MAX)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	query[0] = "VARS";
+	query[1] = upsname;
+
+	for (i = 0; i < numvar; i++) {
+		query[i + 2] = var[i];
+	}
+
+	/* create the string to send to upsd */
+	build_cmd(cmd, sizeof(cmd), "GET", numvar + 2, query);
+
+	/* a request that doesn't fit would lose variables */
+	if (strlen(cmd) >= sizeof(cmd) - 1) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (upscli_sendline(ups, cmd, strlen(cmd)) != 0) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return -1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	/* q: [GET] VARS <ups> <var>...  *
+	 * a: BEGIN GET VARS <ups>       */
+
+	if ((ups->pc_ctx.numargs < 4) ||
+		(strcasecmp(ups->pc_ctx.arglist[0], "BEGIN") != 0) ||
+		(strcasecmp(ups->pc_ctx.arglist[1], "GET") != 0) ||
+		(!verify_resp(2, query, &ups->pc_ctx.arglist[2]))) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int upscli_getvars_next(UPSCONN_t *ups, const char *upsname, unsigned int *numa,
+		char ***answer)
+{
+	char	tmp[UPSCLI_NETBUF_LEN];
+	const char	*query[2];
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (upscli_readline(ups, tmp, sizeof(tmp)) != 0) {
+		return -1;
+	}
+
+	if (upscli_errcheck(ups, tmp) != 0) {
+		return -1;
+	}
+
+	if (!pconf_line(&ups->pc_ctx, tmp)) {
+		ups->upserror = UPSCLI_ERR_PARSE;
+		return -1;
+	}
+
+	if (ups->pc_ctx.numargs < 2) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	/* see if this is the end */
+	if ((!strcmp(ups->pc_ctx.arglist[0], "END")) &&
+		(!strcmp(ups->pc_ctx.arglist[1], "GET"))) {
+		return 0;
+	}
+
+	/* q: VAR <ups>                *
+	 * a: VAR <ups> <var> <val>    */
+
+	query[0] = "VAR";
+	query[1] = upsname;
+
+	if ((ups->pc_ctx.numargs < 4) || (!verify_resp(2, query, ups->pc_ctx.arglist))) {
+		ups->upserror = UPSCLI_ERR_PROTOCOL;
+		return -1;
+	}
+
+	*numa = ups->pc_ctx.numargs;
+	*answer = ups->pc_ctx.arglist;
+
+	return 1;
+}
+
 int upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen)
 {
 	int	ret;
@@ -1383,11 +1499,22 @@ int upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
 		return -1;
 	}
 
-	for (recv = 0; recv < (buflen-1); recv++) {
+	if (!ups->readbuf) {
+		ups->readbuf = malloc(ups->readsize);
+
+		if (!ups->readbuf) {
+			ups->upserror = UPSCLI_ERR_NOMEM;
+			return -1;
+		}
+	}
+
+	for (recv = 0; recv < (buflen-1); ) {
+		const char	*start, *nl;
+		size_t	len;
 
 		if (ups->readidx == ups->readlen) {
 
-			ret = net_read(ups, ups->readbuf, sizeof(ups->readbuf));
+			ret = net_read(ups, ups->readbuf, ups->readsize);
 
 			if (ret < 1) {
 				upscli_disconnect(ups);
@@ -1398,9 +1525,25 @@ int upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
 			ups->readidx = 0;
 		}
 
-		buf[recv] = ups->readbuf[ups->readidx++];
+		start = ups->readbuf + ups->readidx;
+		len = ups->readlen - ups->readidx;
+
+		if (len > (buflen-1) - recv) {
+			len = (buflen-1) - recv;
+		}
 
-		if (buf[recv] == '\n') {
+		nl = memchr(start, '\n', len);
+
+		if (nl) {
+			len = nl - start;
+		}
+
+		memcpy(buf + recv, start, len);
+		recv += len;
+		ups->readidx += len;
+
+		if (nl) {
+			ups->readidx++;		/* drop the newline */
 			break;
 		}
 	}
@@ -1409,6 +1552,72 @@ int upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen)
 	return 0;
 }
 
+int upscli_settimeout(UPSCONN_t *ups, const struct timeval *timeout)
+{
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		return -1;
+	}
+
+	if (!timeout) {
+		ups->timeout.tv_sec = -1;
+		ups->timeout.tv_usec = 0;
+		return 0;
+	}
+
+	if ((timeout->tv_sec < 0) || (timeout->tv_usec < 0) || (timeout->tv_usec >= 1000000)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	ups->timeout = *timeout;
+	return 0;
+}
+
+int upscli_setbufsize(UPSCONN_t *ups, size_t size)
+{
+	char	*buf;
+
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		return -1;
+	}
+
+	/* don't drop anything that was received but not read yet */
+	if ((size < 1) || (size < ups->readlen - ups->readidx)) {
+		ups->upserror = UPSCLI_ERR_INVALIDARG;
+		return -1;
+	}
+
+	if (!ups->readbuf) {
+		ups->readsize = size;
+		return 0;
+	}
+
+	buf = malloc(size);
+
+	if (!buf) {
+		ups->upserror = UPSCLI_ERR_NOMEM;
+		return -1;
+	}
+
+	ups->readlen -= ups->readidx;
+	memcpy(buf, ups->readbuf + ups->readidx, ups->readlen);
+	ups->readidx = 0;
+
+	free(ups->readbuf);
+	ups->readbuf = buf;
+	ups->readsize = size;
+
+	return 0;
+}
+
 /* split upsname[@hostname[:port]] into separate components */
 int upscli_splitname(const char *buf, char **upsname, char **hostname, int *port)
 {
@@ -1514,6 +1723,11 @@ int upscli_disconnect(UPSCONN_t *ups)
 	free(ups->host);
 	ups->host = NULL;
 
+	free(ups->readbuf);
+	ups->readbuf = NULL;
+	ups->readlen = 0;
+	ups->readidx = 0;
+
 	if (ups->fd < 0) {
 		return 0;
 	}
@@ -1555,6 +1769,33 @@ int upscli_fd(UPSCONN_t *ups)
 	return ups->fd;
 }
 
+int upscli_pending(UPSCONN_t *ups)
+{
+	if (!ups) {
+		return -1;
+	}
+
+	if (ups->upsclient_magic != UPSCLIENT_MAGIC) {
+		return -1;
+	}
+
+	if (ups->readidx < ups->readlen) {
+		return 1;
+	}
+
+#ifdef WITH_OPENSSL
+	if (ups->ssl && (SSL_pending(ups->ssl) > 0)) {
+		return 1;
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if (ups->ssl && (SSL_DataPending(ups->ssl) > 0)) {
+		return 1;
+	}
+#endif	/* WITH_OPENSSL | WITH_NSS */
+
+	return 0;
+}
+
 int upscli_upserror(UPSCONN_t *ups)
 {
 	if (!ups) {
@@ -36,6 +36,11 @@ extern "C" {
 
 #define UPSCLI_ERRBUF_LEN	256
 #define UPSCLI_NETBUF_LEN	512	/* network i/o buffer */
+#define UPSCLI_READBUF_LEN	8192	/* default receive buffer */
+#define UPSCLI_TIMEOUT		5	/* default network timeout (seconds) */
+#define UPSCLI_GETVARS_MAX	32	/* variables per upscli_getvars_start() */
+
+#include <sys/time.h>
 
 #include "parseconf.h"
 
@@ -60,10 +65,13 @@ typedef struct {
 	void *ssl;
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-	char	readbuf[64];
+	char	*readbuf;	/* allocated on the first read */
+	size_t	readsize;
 	size_t	readlen;
 	size_t	readidx;
 
+	struct timeval	timeout;	/* tv_sec < 0: wait forever */
+
 }	UPSCONN_t;
 
 const char *upscli_strerror(UPSCONN_t *ups);
@@ -86,10 +94,21 @@ int upscli_list_start(UPSCONN_t *ups, unsigned int numq, const char **query);
 int upscli_list_next(UPSCONN_t *ups, unsigned int numq, const char **query,
 		unsigned int *numa, char ***answer);
 
+/* fetch up to UPSCLI_GETVARS_MAX variables of one UPS in a single request */
+int upscli_getvars_start(UPSCONN_t *ups, const char *upsname, unsigned int numvar,
+		const char **var);
+
+int upscli_getvars_next(UPSCONN_t *ups, const char *upsname, unsigned int *numa,
+		char ***answer);
+
 int upscli_sendline(UPSCONN_t *ups, const char *buf, size_t buflen);
 
 int upscli_readline(UPSCONN_t *ups, char *buf, size_t buflen);
 
+/* per connection settings, call them after connecting */
+int upscli_settimeout(UPSCONN_t *ups, const struct timeval *timeout);
+int upscli_setbufsize(UPSCONN_t *ups, size_t size);
+
 int upscli_splitname(const char *buf, char **upsname, char **hostname,
 			int *port);
 
@@ -100,6 +119,10 @@ int upscli_disconnect(UPSCONN_t *ups);
 /* these functions return elements from UPSCONN_t to avoid direct references */
 
 int upscli_fd(UPSCONN_t *ups);
+
+/* 1 if data was received but not read yet, so upscli_fd() may not poll as readable */
+int upscli_pending(UPSCONN_t *ups);
+
 int upscli_upserror(UPSCONN_t *ups);
 
 /* returns 1 if SSL mode is active for this connection */
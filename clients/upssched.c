@@ -52,11 +52,22 @@
 
 typedef struct ttype_s {
 	char	*name;
-	time_t	etime;
-	struct ttype_s	*next;
+	struct timeval	etime;
+	size_t	pos;			/* index in theap */
+	struct ttype_s	*next;		/* same bucket in tnames */
 } ttype_t;
 
-	ttype_t	*thead = NULL;
+/* Pending timers are kept in a binary min-heap ordered on etime, so the
+ * next one to expire is always theap[0], and in a hash table by name
+ * (oldest first in each bucket) for CANCEL.  With many timers queued,
+ * starting, cancelling or firing one is then O(log n) instead of walking
+ * all of them.
+ */
+#define TIMER_HASH		256
+
+	static	ttype_t	**theap = NULL;
+	static	size_t	tcount = 0, talloc = 0;
+	static	ttype_t	*tnames[TIMER_HASH];
 	static	conn_t	*connhead = NULL;
 	char	*cmdscript = NULL, *pipefn = NULL, *lockfn = NULL;
 	int	verbose = 0;		/* use for debugging */
@@ -98,48 +109,132 @@ static void exec_cmd(const char *cmd)
 	return;
 }
 
-static void removetimer(ttype_t *tfind)
+static unsigned int timer_hash(const char *name)
 {
-	ttype_t	*tmp, *last;
+	unsigned int	h = 0;
 
-	last = NULL;
-	tmp = thead;
+	while (*name) {
+		h = h * 31 + (unsigned char)*name++;
+	}
 
-	while (tmp) {
-		if (tmp == tfind) {	/* found it */
-			if (last == NULL)	/* deleting first */
-				thead = tmp->next;
-			else
-				last->next = tmp->next;
+	return h % TIMER_HASH;
+}
 
-			free(tmp->name);
-			free(tmp);
-			return;
+static int timer_before(const ttype_t *a, const ttype_t *b)
+{
+	return timercmp(&a->etime, &b->etime, <);
+}
+
+static void heap_set(size_t pos, ttype_t *tmp)
+{
+	theap[pos] = tmp;
+	tmp->pos = pos;
+}
+
+/* move theap[pos] towards the root while it expires earlier than its parent */
+static void heap_up(size_t pos)
+{
+	ttype_t	*tmp = theap[pos];
+
+	while (pos > 0) {
+		size_t	parent = (pos - 1) / 2;
+
+		if (!timer_before(tmp, theap[parent])) {
+			break;
 		}
 
-		last = tmp;
-		tmp = tmp->next;
+		heap_set(pos, theap[parent]);
+		pos = parent;
 	}
 
-	/* this one should never happen */
+	heap_set(pos, tmp);
+}
+
+/* move theap[pos] towards the leaves while a child expires earlier */
+static void heap_down(size_t pos)
+{
+	ttype_t	*tmp = theap[pos];
 
-	upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+	for (;;) {
+		size_t	child = 2 * pos + 1;
+
+		if (child >= tcount) {
+			break;
+		}
+
+		if ((child + 1 < tcount) && timer_before(theap[child + 1], theap[child])) {
+			child++;
+		}
+
+		if (!timer_before(theap[child], tmp)) {
+			break;
+		}
+
+		heap_set(pos, theap[child]);
+		pos = child;
+	}
+
+	heap_set(pos, tmp);
 }
 
-static void checktimers(void)
+static void removetimer(ttype_t *tfind)
 {
-	ttype_t	*tmp, *tmpnext;
-	time_t	now;
-	static	int	emptyctr = 0;
+	ttype_t	**link, *last;
+	size_t	pos = tfind->pos;
+
+	/* unlink from its name bucket */
+	for (link = &tnames[timer_hash(tfind->name)]; *link; link = &(*link)->next) {
+		if (*link == tfind) {
+			*link = tfind->next;
+			break;
+		}
+	}
+
+	if ((pos >= tcount) || (theap[pos] != tfind)) {
+		/* this one should never happen */
+		upslogx(LOG_ERR, "removetimer: failed to locate target at %p", (void *)tfind);
+		return;
+	}
+
+	/* fill the hole with the last timer, and put that one in its place */
+	last = theap[--tcount];
+
+	if (last != tfind) {
+		heap_set(pos, last);
+
+		if ((pos > 0) && timer_before(last, theap[(pos - 1) / 2])) {
+			heap_up(pos);
+		} else {
+			heap_down(pos);
+		}
+	}
+
+	free(tfind->name);
+	free(tfind);
+}
+
+/* fire the timers that are due, then set <tv> to how long select() can
+ * wait before the next one is */
+static void checktimers(struct timeval *tv)
+{
+	ttype_t	*tmp;
+	struct timeval	now;
+	static	time_t	emptysince = 0;
+
+	gettimeofday(&now, NULL);
 
 	/* if the queue is empty we might be ready to exit */
-	if (!thead) {
+	if (tcount == 0) {
 
-		emptyctr++;
+		if (emptysince == 0)
+			emptysince = now.tv_sec;
 
 		/* wait a little while in case someone wants us again */
-		if (emptyctr < EMPTY_WAIT)
+		if (now.tv_sec - emptysince < EMPTY_WAIT) {
+			tv->tv_sec = EMPTY_WAIT - (now.tv_sec - emptysince);
+			tv->tv_usec = 0;
 			return;
+		}
 
 		if (verbose)
 			upslogx(LOG_INFO, "Timer queue empty, exiting");
@@ -153,37 +248,44 @@ static void checktimers(void)
 		exit(EXIT_SUCCESS);
 	}
 
-	emptyctr = 0;
+	emptysince = 0;
 
-	/* flip through LL, look for activity */
-	tmp = thead;
+	/* the earliest timer is always on top */
+	while ((tcount > 0) && !timercmp(&now, &theap[0]->etime, <)) {
+		tmp = theap[0];
 
-	time(&now);
-	while (tmp) {
-		tmpnext = tmp->next;
+		if (verbose)
+			upslogx(LOG_INFO, "Event: %s ", tmp->name);
 
-		if (now >= tmp->etime) {
-			if (verbose)
-				upslogx(LOG_INFO, "Event: %s ", tmp->name);
+		exec_cmd(tmp->name);
 
-			exec_cmd(tmp->name);
+		/* delete from queue */
+		removetimer(tmp);
 
-			/* delete from queue */
-			removetimer(tmp);
-		}
+		/* the command may have taken a while */
+		gettimeofday(&now, NULL);
+	}
 
-		tmp = tmpnext;
+	if (tcount == 0) {
+		/* come back right away to start the exit countdown */
+		tv->tv_sec = 0;
+		tv->tv_usec = 0;
+		return;
+	}
+
+	tv->tv_sec = theap[0]->etime.tv_sec - now.tv_sec;
+	tv->tv_usec = theap[0]->etime.tv_usec - now.tv_usec;
+
+	if (tv->tv_usec < 0) {
+		tv->tv_sec--;
+		tv->tv_usec += 1000000;
 	}
 }
 
 static void start_timer(const char *name, const char *ofsstr)
 {
-	time_t	now;
 	int	ofs;
-	ttype_t	*tmp, *last;
-
-	/* get the time */
-	time(&now);
+	ttype_t	*tmp, **link;
 
 	/* add an event for <now> + <time> */
 	ofs = strtol(ofsstr, (char **) NULL, 10);
@@ -196,30 +298,33 @@ static void start_timer(const char *name, const char *ofsstr)
 	if (verbose)
 		upslogx(LOG_INFO, "New timer: %s (%d seconds)", name, ofs);
 
-	/* now add to the queue */
-	tmp = last = thead;
-
-	while (tmp) {
-		last = tmp;
-		tmp = tmp->next;
-	}
-
 	tmp = xmalloc(sizeof(ttype_t));
 	tmp->name = xstrdup(name);
-	tmp->etime = now + ofs;
+	gettimeofday(&tmp->etime, NULL);
+	tmp->etime.tv_sec += ofs;
 	tmp->next = NULL;
 
-	if (last)
-		last->next = tmp;
-	else
-		thead = tmp;
+	/* now add to the queue */
+	if (tcount == talloc) {
+		talloc = talloc ? talloc * 2 : 16;
+		theap = xrealloc(theap, talloc * sizeof(*theap));
+	}
+
+	heap_set(tcount, tmp);
+	heap_up(tcount++);
+
+	/* behind older timers with the same name, which get cancelled first */
+	for (link = &tnames[timer_hash(name)]; *link; link = &(*link)->next)
+		;
+
+	*link = tmp;
 }
 
 static void cancel_timer(const char *name, const char *cname)
 {
 	ttype_t	*tmp;
 
-	for (tmp = thead; tmp != NULL; tmp = tmp->next) {
+	for (tmp = tnames[timer_hash(name)]; tmp != NULL; tmp = tmp->next) {
 		if (!strcmp(tmp->name, name)) {		/* match */
 			if (verbose)
 				upslogx(LOG_INFO, "Cancelling timer: %s", name);
@@ -544,9 +649,8 @@ static void start_daemon(int lockfd)
 	/* now watch for activity */
 
 	for (;;) {
-		/* wait at most 1s so we can check our timers regularly */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+		/* sleep until the next timer is due, unless a client shows up */
+		checktimers(&tv);
 
 		FD_ZERO(&rfds);
 		FD_SET(pipefd, &rfds);
@@ -582,8 +686,6 @@ static void start_daemon(int lockfd)
 				tmp = tmpnext;
 			}
 		}
-
-		checktimers();
 	}
 }
 
@@ -27,7 +27,8 @@
  * All subsequent calls must have it as the first argument.  There are
  * two entry points for parsing lines.  You can have it read a file
  * (pconf_file_begin and pconf_file_next), take lines directly from 
- * the caller (pconf_line), or go along a character at a time (pconf_char).
+ * the caller (pconf_line), go along a character at a time (pconf_char),
+ * or hand it whole buffers as they come off a socket (pconf_buf).
  * The parsing is identical no matter how you feed it.
  *
  * Since there are no more callbacks, you take the successful return
@@ -96,6 +97,7 @@
 #define STATE_COLLECTLITERAL	6
 #define STATE_ENDOFLINE		7
 #define STATE_PARSEERR		8
+#define STATE_SKIPLINE		9	/* pconf_buf: rest of a line with an error */
 
 static void pconf_fatal(PCONF_CTX_t *ctx, const char *errtxt)
 {
@@ -107,10 +109,10 @@ static void pconf_fatal(PCONF_CTX_t *ctx, const char *errtxt)
 	exit(EXIT_FAILURE);
 }
 
-static void add_arg_word(PCONF_CTX_t *ctx)
+/* store <len> bytes from <word> as the next argument */
+static void store_arg(PCONF_CTX_t *ctx, const char *word, size_t wbuflen)
 {
 	int	argpos;
-	size_t	wbuflen;
 
 	/* this is where the new value goes */
 	argpos = ctx->numargs;
@@ -139,8 +141,6 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = 0;
 	}
 
-	wbuflen = strlen(ctx->wordbuf);
-
 	/* now see if the string itself grew compared to last time */
 	if (wbuflen >= ctx->argsize[argpos]) {
 		size_t	newlen;
@@ -158,11 +158,14 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = newlen;
 	}
 
-	/* strncpy doesn't give us a trailing NULL, so prep the space */
-	memset(ctx->arglist[argpos], '\0', ctx->argsize[argpos]);
-
 	/* finally copy the new value into the provided space */
-	strncpy(ctx->arglist[argpos], ctx->wordbuf, wbuflen);
+	memcpy(ctx->arglist[argpos], word, wbuflen);
+	ctx->arglist[argpos][wbuflen] = '\0';
+}
+
+static void add_arg_word(PCONF_CTX_t *ctx)
+{
+	store_arg(ctx, ctx->wordbuf, strlen(ctx->wordbuf));
 }
 
 static void addchar(PCONF_CTX_t *ctx)
@@ -613,6 +616,161 @@ char *pconf_encode(const char *src, char *dest, size_t destsize)
 	return dest;
 }
 
+/* split a complete line that has nothing but plain words and simple
+ * "quoted words" in it, return 0 if it needs the full state machine */
+static int pconf_fastline(PCONF_CTX_t *ctx, const char *line, size_t len)
+{
+	const char	*end = line + len, *word;
+	size_t	wlen;
+
+	ctx->numargs = 0;
+
+	while (line < end) {
+		unsigned char	ch = *line;
+
+		/* skip whitespace between words */
+		if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\v') || (ch == '\f')) {
+			line++;
+			continue;
+		}
+
+		if (ch == '"') {
+			word = ++line;
+
+			while ((line < end) && (*line != '"')) {
+				ch = *line;
+
+				/* escapes, comments and control characters take the slow path */
+				if ((ch < 0x20) || (ch > 0x7f) || (ch == '\\') || (ch == '#')) {
+					return 0;
+				}
+
+				line++;
+			}
+
+			/* unbalanced quotes continue on the next line */
+			if (line == end) {
+				return 0;
+			}
+
+			wlen = line++ - word;
+		} else {
+			word = line;
+
+			while (line < end) {
+				ch = *line;
+
+				if ((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\v') || (ch == '\f')) {
+					break;
+				}
+
+				if ((ch < 0x20) || (ch > 0x7f) || (ch == '\\') || (ch == '#') ||
+					(ch == '"') || (ch == '=')) {
+					return 0;
+				}
+
+				line++;
+			}
+
+			wlen = line - word;
+		}
+
+		/* same limits as addchar() and endofword() */
+		if ((ctx->wordlen_limit != 0) && (wlen > ctx->wordlen_limit)) {
+			wlen = ctx->wordlen_limit;
+		}
+
+		if ((ctx->arg_limit != 0) && (ctx->numargs >= ctx->arg_limit)) {
+			continue;
+		}
+
+		store_arg(ctx, word, wlen);
+	}
+
+	return 1;
+}
+
+/* Parse up to one line from a buffer of <len> bytes, usually what a
+ * single read() on a socket returned.  <used> is set to the number of
+ * bytes consumed, which is where the next call should start.
+ *
+ * Returns 1 when a line is ready in ctx->arglist, 0 when no line is
+ * ready yet, and -1 on a parse error, in which case the rest of the
+ * offending line is skipped, even if it comes in later calls.
+ *
+ * Lines are located with memchr, and lines without any escapes or
+ * comments are split in one pass without going through parse_char().
+ */
+int pconf_buf(PCONF_CTX_t *ctx, const char *buf, size_t len, size_t *used)
+{
+	const char	*nl;
+	size_t	i;
+
+	/* callers loop over the buffer, so never leave them stuck */
+	*used = len;
+
+	if (!check_magic(ctx))
+		return -1;
+
+	/* an earlier call found an error, but not the end of its line */
+	if (ctx->state == STATE_SKIPLINE) {
+		nl = memchr(buf, 10, len);
+
+		if (nl) {
+			*used = nl - buf + 1;
+			ctx->state = STATE_PARSEERR;
+		}
+
+		return 0;
+	}
+
+	/* if the last call finished a line, clean stuff up for another */
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+		ctx->numargs = 0;
+		ctx->state = STATE_FINDWORDSTART;
+	}
+
+	nl = memchr(buf, 10, len);
+
+	/* a complete line that doesn't continue an earlier one */
+	if ((nl) && (ctx->state == STATE_FINDWORDSTART) && (ctx->numargs == 0)) {
+
+		if (pconf_fastline(ctx, buf, nl - buf)) {
+			*used = nl - buf + 1;
+			ctx->state = STATE_ENDOFLINE;
+			return 1;
+		}
+
+		/* start over with the full state machine */
+		ctx->numargs = 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		ctx->ch = buf[i];
+		parse_char(ctx);
+
+		if (ctx->state == STATE_ENDOFLINE) {
+			*used = i + 1;
+			return 1;
+		}
+
+		if (ctx->state == STATE_PARSEERR) {
+			/* throw away whatever is left of this line */
+			nl = memchr(buf + i, 10, len - i);
+
+			if (nl) {
+				*used = nl - buf + 1;
+			} else {
+				ctx->state = STATE_SKIPLINE;
+			}
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /* parse input a character at a time */
 int pconf_char(PCONF_CTX_t *ctx, char ch)
 {
@@ -620,7 +778,8 @@ int pconf_char(PCONF_CTX_t *ctx, char ch)
 		return -1;
 
 	/* if the last call finished a line, clean stuff up for another */
-	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+	if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR) ||
+		(ctx->state == STATE_SKIPLINE)) {
 		ctx->numargs = 0;
 		ctx->state = STATE_FINDWORDSTART;
 	}
@@ -0,0 +1,140 @@
+/* protocmd.c - Network UPS Tools protocol command lookup
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include <ctype.h>
+
+#include "common.h"
+#include "protocmd.h"
+
+/* combine the length and the (upper case) first letter of a word */
+#define PROTO_KEY(len, c)	(((len) << 8) | (c))
+
+/* confirm a candidate picked by proto_cmd_lookup() */
+static proto_cmd_t proto_match(const char *word, const char *name, proto_cmd_t cmd)
+{
+	if (strcasecmp(word, name)) {
+		return PROTO_UNKNOWN;
+	}
+
+	return cmd;
+}
+
+/* Every line received by upsd or a driver starts with one of these, so
+ * instead of trying all of them in turn, the length and the first letter
+ * (and where that is ambiguous, one more letter) pick the only possible
+ * candidate, which then needs just one comparison.
+ *
+ * When adding a command, put it in the case for its length and first
+ * letter, and look at the other commands already there.
+ */
+proto_cmd_t proto_cmd_lookup(const char *word)
+{
+	size_t	len;
+
+	if ((!word) || (!word[0])) {
+		return PROTO_UNKNOWN;
+	}
+
+	len = strlen(word);
+
+	if (len > 9) {
+		return PROTO_UNKNOWN;
+	}
+
+	switch (PROTO_KEY(len, toupper((unsigned char)word[0])))
+	{
+	case PROTO_KEY(3, 'F'):
+		return proto_match(word, "FSD", PROTO_FSD);
+	case PROTO_KEY(3, 'G'):
+		return proto_match(word, "GET", PROTO_GET);
+	case PROTO_KEY(3, 'S'):
+		return proto_match(word, "SET", PROTO_SET);
+	case PROTO_KEY(3, 'V'):
+		return proto_match(word, "VER", PROTO_VER);
+
+	case PROTO_KEY(4, 'H'):
+		return proto_match(word, "HELP", PROTO_HELP);
+	case PROTO_KEY(4, 'L'):
+		return proto_match(word, "LIST", PROTO_LIST);
+	case PROTO_KEY(4, 'P'):
+		if (toupper((unsigned char)word[1]) == 'I') {
+			return proto_match(word, "PING", PROTO_PING);
+		}
+		return proto_match(word, "PONG", PROTO_PONG);
+
+	case PROTO_KEY(5, 'L'):
+		return proto_match(word, "LOGIN", PROTO_LOGIN);
+	case PROTO_KEY(5, 'W'):
+		return proto_match(word, "WATCH", PROTO_WATCH);
+
+	case PROTO_KEY(6, 'A'):
+		return proto_match(word, "ADDCMD", PROTO_ADDCMD);
+	case PROTO_KEY(6, 'D'):
+		if (toupper((unsigned char)word[1]) == 'A') {
+			return proto_match(word, "DATAOK", PROTO_DATAOK);
+		}
+		return proto_match(word, "DELCMD", PROTO_DELCMD);
+	case PROTO_KEY(6, 'L'):
+		return proto_match(word, "LOGOUT", PROTO_LOGOUT);
+	case PROTO_KEY(6, 'M'):
+		return proto_match(word, "MASTER", PROTO_MASTER);
+	case PROTO_KEY(6, 'N'):
+		return proto_match(word, "NETVER", PROTO_NETVER);
+	case PROTO_KEY(6, 'S'):
+		return proto_match(word, "SETAUX", PROTO_SETAUX);
+
+	case PROTO_KEY(7, 'A'):
+		return proto_match(word, "ADDENUM", PROTO_ADDENUM);
+	case PROTO_KEY(7, 'D'):
+		if (toupper((unsigned char)word[1]) == 'U') {
+			return proto_match(word, "DUMPALL", PROTO_DUMPALL);
+		}
+		if (toupper((unsigned char)word[3]) == 'I') {
+			return proto_match(word, "DELINFO", PROTO_DELINFO);
+		}
+		return proto_match(word, "DELENUM", PROTO_DELENUM);
+	case PROTO_KEY(7, 'I'):
+		return proto_match(word, "INSTCMD", PROTO_INSTCMD);
+	case PROTO_KEY(7, 'S'):
+		return proto_match(word, "SETINFO", PROTO_SETINFO);
+	case PROTO_KEY(7, 'U'):
+		return proto_match(word, "UNWATCH", PROTO_UNWATCH);
+
+	case PROTO_KEY(8, 'A'):
+		return proto_match(word, "ADDRANGE", PROTO_ADDRANGE);
+	case PROTO_KEY(8, 'D'):
+		if (toupper((unsigned char)word[1]) == 'U') {
+			return proto_match(word, "DUMPDONE", PROTO_DUMPDONE);
+		}
+		return proto_match(word, "DELRANGE", PROTO_DELRANGE);
+	case PROTO_KEY(8, 'P'):
+		return proto_match(word, "PASSWORD", PROTO_PASSWORD);
+	case PROTO_KEY(8, 'S'):
+		if (toupper((unsigned char)word[1]) == 'E') {
+			return proto_match(word, "SETFLAGS", PROTO_SETFLAGS);
+		}
+		return proto_match(word, "STARTTLS", PROTO_STARTTLS);
+	case PROTO_KEY(8, 'U'):
+		return proto_match(word, "USERNAME", PROTO_USERNAME);
+
+	case PROTO_KEY(9, 'D'):
+		return proto_match(word, "DATASTALE", PROTO_DATASTALE);
+
+	default:
+		return PROTO_UNKNOWN;
+	}
+}
@@ -96,116 +96,188 @@ static void st_tree_node_free(st_tree_t *node)
 	free(node);
 }
 
-/* add a subtree to another subtree */
-static void st_tree_node_add(st_tree_t **nptr, st_tree_t *sptr)
+static int st_tree_height(const st_tree_t *node)
 {
-	if (!sptr) {
-		return;
-	}
+	return node ? node->height : 0;
+}
+
+static void st_tree_update_height(st_tree_t *node)
+{
+	int	lh = st_tree_height(node->left), rh = st_tree_height(node->right);
 
-	while (*nptr) {
+	node->height = 1 + ((lh > rh) ? lh : rh);
+}
 
-		st_tree_t	*node = *nptr;
+static st_tree_t *st_tree_rotate_right(st_tree_t *node)
+{
+	st_tree_t	*top = node->left;
 
-		if (strcasecmp(node->var, sptr->var) > 0) {
-			nptr = &node->left;
-			continue;
+	node->left = top->right;
+	top->right = node;
+
+	st_tree_update_height(node);
+	st_tree_update_height(top);
+
+	return top;
+}
+
+static st_tree_t *st_tree_rotate_left(st_tree_t *node)
+{
+	st_tree_t	*top = node->right;
+
+	node->right = top->left;
+	top->left = node;
+
+	st_tree_update_height(node);
+	st_tree_update_height(top);
+
+	return top;
+}
+
+/* restore the AVL property for a node whose subtrees differ by up to 2,
+ * and return the new root of this subtree */
+static st_tree_t *st_tree_balance(st_tree_t *node)
+{
+	int	diff = st_tree_height(node->left) - st_tree_height(node->right);
+
+	if (diff > 1) {
+		if (st_tree_height(node->left->left) < st_tree_height(node->left->right)) {
+			node->left = st_tree_rotate_left(node->left);
 		}
 
-		if (strcasecmp(node->var, sptr->var) < 0) {
-			nptr = &node->right;
-			continue;
+		return st_tree_rotate_right(node);
+	}
+
+	if (diff < -1) {
+		if (st_tree_height(node->right->right) < st_tree_height(node->right->left)) {
+			node->right = st_tree_rotate_right(node->right);
 		}
 
-		upsdebugx(1, "%s: duplicate value (shouldn't happen)", __func__);
-		return;
+		return st_tree_rotate_left(node);
+	}
+
+	st_tree_update_height(node);
+
+	return node;
+}
+
+/* detach the leftmost node of a subtree */
+static st_tree_t *st_tree_unlink_min(st_tree_t **nptr)
+{
+	st_tree_t	*node = *nptr, *min;
+
+	if (!node->left) {
+		*nptr = node->right;
+		return node;
 	}
 
-	*nptr = sptr;
+	min = st_tree_unlink_min(&node->left);
+
+	*nptr = st_tree_balance(node);
+
+	return min;
 }
 
 /* remove a variable from a tree */
 int state_delinfo(st_tree_t **nptr, const char *var)
 {
-	while (*nptr) {
+	st_tree_t	*node = *nptr;
+	int	cmp, ret;
 
-		st_tree_t	*node = *nptr;
+	if (!node) {
+		return 0;	/* not found */
+	}
 
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
+	cmp = strcasecmp(node->var, var);
 
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+	if (cmp > 0) {
+		ret = state_delinfo(&node->left, var);
+	} else if (cmp < 0) {
+		ret = state_delinfo(&node->right, var);
+	} else {
 
-		/* whatever is on the left, hang it off current right */
-		st_tree_node_add(&node->right, node->left);
+		if (!node->left) {
+			*nptr = node->right;
+		} else if (!node->right) {
+			*nptr = node->left;
+		} else {
+			/* replace the node with its in-order successor */
+			st_tree_t	*next = st_tree_unlink_min(&node->right);
 
-		/* now point the parent at the old right child */
-		*nptr = node->right;
+			next->left = node->left;
+			next->right = node->right;
+
+			*nptr = st_tree_balance(next);
+		}
 
 		st_tree_node_free(node);
 
 		return 1;
 	}
 
-	return 0;	/* not found */
+	if (ret) {
+		*nptr = st_tree_balance(node);
+	}
+
+	return ret;
 }	
 
 /* interface */
 
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 {
-	while (*nptr) {
+	st_tree_t	*node = *nptr;
+	int	cmp, ret;
 
-		st_tree_t	*node = *nptr;
+	if (!node) {
+		*nptr = xcalloc(1, sizeof(**nptr));
 
-		if (strcasecmp(node->var, var) > 0) {
-			nptr = &node->left;
-			continue;
-		}
+		(*nptr)->var = xstrdup(var);
+		(*nptr)->raw = xstrdup(val);
+		(*nptr)->rawsize = strlen(val) + 1;
+		(*nptr)->height = 1;
 
-		if (strcasecmp(node->var, var) < 0) {
-			nptr = &node->right;
-			continue;
-		}
+		val_escape(*nptr);
 
-		/* updating an existing entry */
-		if (!strcasecmp(node->raw, val)) {
-			return 0;	/* no change */
-		}
+		return 1;	/* added */
+	}
 
-		/* changes should be ignored */
-		if (node->flags & ST_FLAG_IMMUTABLE) {
-			return 0;	/* no change */
-		}
+	cmp = strcasecmp(node->var, var);
 
-		/* expand the buffer if the value grows */
-		if (node->rawsize < (strlen(val) + 1)) {
-			node->rawsize = strlen(val) + 1;
-			node->raw = xrealloc(node->raw, node->rawsize);
-		}
+	if (cmp > 0) {
+		ret = state_setinfo(&node->left, var, val);
+		*nptr = st_tree_balance(node);
+		return ret;
+	}
 
-		/* store the literal value for later comparisons */
-		snprintf(node->raw, node->rawsize, "%s", val);
+	if (cmp < 0) {
+		ret = state_setinfo(&node->right, var, val);
+		*nptr = st_tree_balance(node);
+		return ret;
+	}
 
-		val_escape(node);
+	/* updating an existing entry */
+	if (!strcasecmp(node->raw, val)) {
+		return 0;	/* no change */
+	}
 
-		return 1;	/* changed */
+	/* changes should be ignored */
+	if (node->flags & ST_FLAG_IMMUTABLE) {
+		return 0;	/* no change */
 	}
 
-	*nptr = xcalloc(1, sizeof(**nptr));
+	/* expand the buffer if the value grows */
+	if (node->rawsize < (strlen(val) + 1)) {
+		node->rawsize = strlen(val) + 1;
+		node->raw = xrealloc(node->raw, node->rawsize);
+	}
 
-	(*nptr)->var = xstrdup(var);
-	(*nptr)->raw = xstrdup(val);
-	(*nptr)->rawsize = strlen(val) + 1;
+	/* store the literal value for later comparisons */
+	snprintf(node->raw, node->rawsize, "%s", val);
 
-	val_escape(*nptr);
+	val_escape(node);
 
-	return 1;	/* added */
+	return 1;	/* changed */
 }
 
 static int st_tree_enum_add(enum_t **list, const char *enc)
@@ -589,12 +661,14 @@ st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 {
 	while (node) {
 
-		if (strcasecmp(node->var, var) > 0) {
+		int	cmp = strcasecmp(node->var, var);
+
+		if (cmp > 0) {
 			node = node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			node = node->right;
 			continue;
 		}
@@ -22,23 +22,39 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "common.h"
 #include "dstate.h"
 #include "state.h"
 #include "parseconf.h"
-
-	static int	sockfd = -1, stale = 1, alarm_active = 0, ignorelb = 0;
-	static char	*sockfn = NULL;
-	static char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[ST_MAX_VALUE_LEN];
-	static st_tree_t	*dtree_root = NULL;
-	static conn_t	*connhead = NULL;
-	static cmdlist_t *cmdhead = NULL;
+#include "protocmd.h"
+
+/* everything about one device, see dstate_new() */
+struct dstate_s {
+	int	sockfd, stale, alarm_active, ignorelb;
+	short	revents;	/* of sockfd, at the last poll() */
+	char	*sockfn;
+	char	status_buf[ST_MAX_VALUE_LEN], alarm_buf[ST_MAX_VALUE_LEN];
+	st_tree_t	*dtree_root;
+	conn_t	*connhead;
+	cmdlist_t	*cmdhead;
+	struct dstate_s	*next;
+};
+
+	static dstate_t	dstate_first = { -1, 1, 0, 0, 0 };
+	static dstate_t	*ds = &dstate_first;
+	static void	(*select_cb)(dstate_t *) = NULL;
+
+	/* nesting of dstate_poll_fds() while it serves requests: a driver
+	 * may call it again from a handler, see sock_disconnect() */
+	static int	serving = 0;
 
 	struct ups_handler	upsh;
 
@@ -109,12 +125,12 @@ static int sock_open(const char *fn)
 	}
 
 	/* keep this around for the unlink() when exiting */
-	sockfn = xstrdup(fn);
+	ds->sockfn = xstrdup(fn);
 
 	ssaddr.sun_family = AF_UNIX;
-	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", sockfn);
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", ds->sockfn);
 
-	unlink(sockfn);
+	unlink(ds->sockfn);
 
 	/* group gets access so upsd can be a different user but same group */
 	umask(0007);
@@ -122,13 +138,13 @@ static int sock_open(const char *fn)
 	ret = bind(fd, (struct sockaddr *) &ssaddr, sizeof ssaddr);
 
 	if (ret < 0) {
-		sock_fail(sockfn);
+		sock_fail(ds->sockfn);
 	}
 
-	ret = chmod(sockfn, 0660);
+	ret = chmod(ds->sockfn, 0660);
 
 	if (ret < 0) {
-		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", sockfn);
+		fatal_with_errno(EXIT_FAILURE, "chmod(%s, 0660) failed", ds->sockfn);
 	}
 
 	ret = listen(fd, DS_LISTEN_BACKLOG);
@@ -140,16 +156,29 @@ static int sock_open(const char *fn)
 	return fd;
 }
 
-static void sock_disconnect(conn_t *conn)
+static void sock_drop_output(conn_t *conn)
 {
-	close(conn->fd);
+	conn_buf_t	*buf, *bnext;
+
+	for (buf = conn->outhead; buf; buf = bnext) {
+		bnext = buf->next;
+		free(buf);
+	}
+
+	conn->outhead = conn->outtail = NULL;
+	conn->outlen = 0;
+}
 
+/* unlink <conn> from the connections of <d> and free it */
+static void sock_free(dstate_t *d, conn_t *conn)
+{
 	pconf_finish(&conn->ctx);
+	sock_drop_output(conn);
 
 	if (conn->prev) {
 		conn->prev->next = conn->next;
 	} else {
-		connhead = conn->next;
+		d->connhead = conn->next;
 	}
 
 	if (conn->next) {
@@ -161,6 +190,153 @@ static void sock_disconnect(conn_t *conn)
 	free(conn);
 }
 
+static void sock_disconnect(conn_t *conn)
+{
+	if (conn->fd == -1) {
+		return;	/* already done */
+	}
+
+	close(conn->fd);
+
+	/* while requests are served, the callers up the stack may still use
+	 * <conn> or the next one: only mark it, sock_reap() frees it later */
+	if (serving) {
+		conn->fd = -1;
+		conn->revents = 0;
+		sock_drop_output(conn);
+		return;
+	}
+
+	sock_free(ds, conn);
+}
+
+/* free the connections closed while requests were served */
+static void sock_reap(void)
+{
+	dstate_t	*d;
+	conn_t	*conn, *cnext;
+
+	for (d = &dstate_first; d; d = d->next) {
+		for (conn = d->connhead; conn; conn = cnext) {
+			cnext = conn->next;
+
+			if (conn->fd == -1) {
+				sock_free(d, conn);
+			}
+		}
+	}
+}
+
+/* append <len> bytes to the output queue of a connection */
+static void sock_queue(conn_t *conn, const char *data, size_t len)
+{
+	while (len > 0) {
+		conn_buf_t	*buf = conn->outtail;
+		size_t	n;
+
+		if ((!buf) || (buf->len == sizeof(buf->data))) {
+			buf = xcalloc(1, sizeof(*buf));
+
+			if (conn->outtail) {
+				conn->outtail->next = buf;
+			} else {
+				conn->outhead = buf;
+			}
+
+			conn->outtail = buf;
+		}
+
+		n = sizeof(buf->data) - buf->len;
+
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(buf->data + buf->len, data, n);
+		buf->len += n;
+		conn->outlen += n;
+
+		data += n;
+		len -= n;
+	}
+}
+
+/* write as much of the output queue as the socket takes,
+ * returns 0 if the connection had to be closed */
+static int sock_flush(conn_t *conn)
+{
+	while (conn->outhead) {
+		struct iovec	iov[DS_MAX_IOV];
+		conn_buf_t	*buf;
+		ssize_t	ret;
+		int	n = 0;
+
+		for (buf = conn->outhead; buf && (n < DS_MAX_IOV); buf = buf->next, n++) {
+			iov[n].iov_base = buf->data + buf->off;
+			iov[n].iov_len = buf->len - buf->off;
+		}
+
+		ret = writev(conn->fd, iov, n);
+
+		if (ret < 0) {
+			switch (errno)
+			{
+			case EINTR:
+				continue;
+
+			case EAGAIN:
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+			case EWOULDBLOCK:
+#endif
+				/* socket is full, retry once it becomes writable */
+				upsdebugx(3, "%s: %d bytes pending on socket %d", __func__, (int)conn->outlen, conn->fd);
+				return 1;
+
+			default:
+				upsdebug_with_errno(2, "write %d bytes to socket %d failed", (int)conn->outlen, conn->fd);
+				sock_disconnect(conn);
+				return 0;	/* failed */
+			}
+		}
+
+		conn->outlen -= ret;
+
+		/* release what has been written, keep track of partial blocks */
+		while ((buf = conn->outhead) && (ret > 0)) {
+
+			if ((size_t)ret < buf->len - buf->off) {
+				buf->off += ret;
+				break;
+			}
+
+			ret -= buf->len - buf->off;
+			conn->outhead = buf->next;
+			free(buf);
+		}
+
+		if (!conn->outhead) {
+			conn->outtail = NULL;
+		}
+	}
+
+	return 1;	/* OK */
+}
+
+/* drop connections that have stopped reading what we send them,
+ * returns 0 if the connection was closed */
+static int sock_check_output(conn_t *conn)
+{
+	if (conn->outlen <= DS_MAX_OUTPUT) {
+		return 1;
+	}
+
+	upslogx(LOG_NOTICE, "Dropping connection on socket %d: %d bytes of unread output",
+		conn->fd, (int)conn->outlen);
+	sock_disconnect(conn);
+
+	return 0;
+}
+
 static void send_to_all(const char *fmt, ...)
 {
 	int	ret;
@@ -179,18 +355,22 @@ static void send_to_all(const char *fmt, ...)
 
 	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
 
-	for (conn = connhead; conn; conn = cnext) {
+	for (conn = ds->connhead; conn; conn = cnext) {
 		cnext = conn->next;
 
-		ret = write(conn->fd, buf, strlen(buf));
+		if (conn->fd == -1) {
+			continue;	/* closed, see sock_disconnect() */
+		}
 
-		if (ret != (int)strlen(buf)) {
-			upsdebugx(2, "write %d bytes to socket %d failed", (int)strlen(buf), conn->fd);
-			sock_disconnect(conn);
+		sock_queue(conn, buf, strlen(buf));
+
+		if (sock_flush(conn)) {
+			sock_check_output(conn);
 		}
 	}
 }
 
+/* queue a reply, the caller is responsible for flushing it */
 static int send_to_one(conn_t *conn, const char *fmt, ...)
 {
 	int	ret;
@@ -208,13 +388,7 @@ static int send_to_one(conn_t *conn, const char *fmt, ...)
 
 	upsdebugx(5, "%s: %.*s", __func__, ret-1, buf);
 
-	ret = write(conn->fd, buf, strlen(buf));
-
-	if (ret != (int)strlen(buf)) {
-		upsdebugx(2, "write %d bytes to socket %d failed", (int)strlen(buf), conn->fd);
-		sock_disconnect(conn);
-		return 0;	/* failed */
-	}
+	sock_queue(conn, buf, strlen(buf));
 
 	return 1;	/* OK */
 }
@@ -261,12 +435,12 @@ static void sock_connect(int sock)
 
 	pconf_init(&conn->ctx, NULL);
 
-	if (connhead) {
-		conn->next = connhead;
-		connhead->prev = conn;
+	if (ds->connhead) {
+		conn->next = ds->connhead;
+		ds->connhead->prev = conn;
 	}
 
-	connhead = conn;
+	ds->connhead = conn;
 
 	upsdebugx(3, "new connection on fd %d", fd);
 }
@@ -344,7 +518,7 @@ static int cmd_dump_conn(conn_t *conn)
 {
 	cmdlist_t	*cmd;
 
-	for (cmd = cmdhead; cmd; cmd = cmd->next) {
+	for (cmd = ds->cmdhead; cmd; cmd = cmd->next) {
 		if (!send_to_one(conn, "ADDCMD %s\n", cmd->name)) {
 			return 0;
 		}
@@ -359,14 +533,16 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 		return 0;
 	}
 
-	if (!strcasecmp(arg[0], "DUMPALL")) {
+	switch (proto_cmd_lookup(arg[0]))
+	{
+	case PROTO_DUMPALL:
 
 		/* first thing: the staleness flag */
-		if ((stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
+		if ((ds->stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
 			return 1;
 		}
 
-		if (!st_tree_dump_conn(dtree_root, conn)) {
+		if (!st_tree_dump_conn(ds->dtree_root, conn)) {
 			return 1;
 		}
 
@@ -374,25 +550,23 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 			return 1;
 		}
 
-		if ((stale == 0) && !send_to_one(conn, "DATAOK\n")) {
+		if ((ds->stale == 0) && !send_to_one(conn, "DATAOK\n")) {
 			return 1;
 		}
 
 		send_to_one(conn, "DUMPDONE\n");
 		return 1;
-	}
 
-	if (!strcasecmp(arg[0], "PING")) {
+	case PROTO_PING:
 		send_to_one(conn, "PONG\n");
 		return 1;
-	}
-
-	if (numarg < 2) {
-		return 0;
-	}
 
 	/* INSTCMD <cmdname> [<value>]*/
-	if (!strcasecmp(arg[0], "INSTCMD")) {
+	case PROTO_INSTCMD:
+
+		if (numarg < 2) {
+			return 0;
+		}
 
 		/* try the new handler first if present */
 		if (upsh.instcmd) {
@@ -407,14 +581,13 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 
 		upslogx(LOG_NOTICE, "Got INSTCMD, but driver lacks a handler");
 		return 1;
-	}
-
-	if (numarg < 3) {
-		return 0;
-	}
 
 	/* SET <var> <value> */
-	if (!strcasecmp(arg[0], "SET")) {
+	case PROTO_SET:
+
+		if (numarg < 3) {
+			return 0;
+		}
 
 		/* try the new handler first if present */
 		if (upsh.setvar) {
@@ -424,15 +597,17 @@ static int sock_arg(conn_t *conn, int numarg, char **arg)
 
 		upslogx(LOG_NOTICE, "Got SET, but driver lacks a handler");
 		return 1;
-	}
 
-	/* unknown */
-	return 0;
+	default:
+		/* unknown */
+		return 0;
+	}
 }
 
 static void sock_read(conn_t *conn)
 {
-	int	i, ret;
+	int	ret;
+	size_t	off, used;
 	char	buf[SMALLBUF];
 
 	ret = read(conn->fd, buf, sizeof(buf));
@@ -450,9 +625,13 @@ static void sock_read(conn_t *conn)
 		}
 	}
 
-	for (i = 0; i < ret; i++) {
+	/* a handler may serve requests again (see dstate_poll_fds()), but
+	 * not from this connection, which would overwrite conn->ctx */
+	conn->busy = 1;
 
-		switch(pconf_char(&conn->ctx, buf[i]))
+	for (off = 0; (off < (size_t)ret) && (conn->fd != -1); off += used) {
+
+		switch(pconf_buf(&conn->ctx, buf + off, ret - off, &used))
 		{
 		case 0: /* nothing to parse yet */
 			continue;
@@ -469,34 +648,46 @@ static void sock_read(conn_t *conn)
 			}
 			continue;
 
-		default: /* nothing parsed */
+		default: /* nothing parsed, the rest of the line was skipped */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", conn->ctx.errmsg);
-			return;
+			continue;
 		}
 	}
+
+	conn->busy = 0;
+
+	/* closed while a request was handled */
+	if (conn->fd == -1) {
+		return;
+	}
+
+	/* send the replies (a whole DUMPALL, for instance) in one go */
+	if (sock_flush(conn)) {
+		sock_check_output(conn);
+	}
 }
 
 static void sock_close(void)
 {
 	conn_t	*conn, *cnext;
 
-	if (sockfd != -1) {
-		close(sockfd);
-		sockfd = -1;
+	if (ds->sockfd != -1) {
+		close(ds->sockfd);
+		ds->sockfd = -1;
 
-		if (sockfn) {
-			unlink(sockfn);
-			free(sockfn);
-			sockfn = NULL;
+		if (ds->sockfn) {
+			unlink(ds->sockfn);
+			free(ds->sockfn);
+			ds->sockfn = NULL;
 		}
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
+	for (conn = ds->connhead; conn; conn = cnext) {
 		cnext = conn->next;
 		sock_disconnect(conn);
 	}
 
-	connhead = NULL;
+	ds->connhead = NULL;
 	/* conntail = NULL; */
 }
 
@@ -506,6 +697,11 @@ void dstate_init(const char *prog, const char *devname)
 {
 	char	sockname[SMALLBUF];
 
+	/* already serving this device */
+	if (ds->sockfd != -1) {
+		return;
+	}
+
 	/* do this here for now */
 	signal(SIGPIPE, SIG_IGN);
 
@@ -515,40 +711,150 @@ void dstate_init(const char *prog, const char *devname)
 		snprintf(sockname, sizeof(sockname), "%s/%s", dflt_statepath(), prog);
 	}
 
-	sockfd = sock_open(sockname);
+	ds->sockfd = sock_open(sockname);
 
-	upsdebugx(2, "dstate_init: sock %s open on fd %d", sockname, sockfd);
+	upsdebugx(2, "dstate_init: sock %s open on fd %d", sockname, ds->sockfd);
 }
 
-/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
-int dstate_poll_fds(struct timeval timeout, int extrafd)
+/* descriptors to poll(), for the sockets of every device */
+static struct pollfd	*pollfds = NULL;
+static size_t	pollfds_size = 0;
+
+static void poll_add(int fd, short events, size_t *nfds)
 {
-	int	ret, maxfd, overrun = 0;
-	fd_set	rfds;
-	struct timeval	now;
-	conn_t	*conn, *cnext;
+	if (*nfds == pollfds_size) {
+		pollfds_size = pollfds_size ? 2 * pollfds_size : 16;
+		pollfds = xrealloc(pollfds, pollfds_size * sizeof(*pollfds));
+	}
 
-	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);
+	pollfds[*nfds].fd = fd;
+	pollfds[*nfds].events = events;
+	pollfds[*nfds].revents = 0;
 
-	maxfd = sockfd;
+	(*nfds)++;
+}
 
-	if (extrafd != -1) {
-		FD_SET(extrafd, &rfds);
+/* add the sockets of <d> to pollfds */
+static void poll_add_dstate(const dstate_t *d, size_t *nfds)
+{
+	conn_t	*conn;
 
-		if (extrafd > maxfd) {
-			maxfd = extrafd;
+	if (d->sockfd == -1) {
+		return;
+	}
+
+	poll_add(d->sockfd, POLLIN, nfds);
+
+	for (conn = d->connhead; conn; conn = conn->next) {
+		/* poll() skips negative descriptors: the closed connections,
+		 * and those whose request is being handled, which are read
+		 * again once it is done */
+		if ((conn->fd == -1) || conn->busy) {
+			poll_add(-1, 0, nfds);
+			continue;
 		}
+
+		/* finish sending what didn't fit in the socket before */
+		poll_add(conn->fd, conn->outhead ? POLLIN | POLLOUT : POLLIN, nfds);
 	}
+}
 
-	for (conn = connhead; conn; conn = conn->next) {
-		FD_SET(conn->fd, &rfds);
+/* hand the events in pollfds back to the sockets of <d>, in the order
+ * poll_add_dstate() added them */
+static void poll_events(dstate_t *d, size_t *n)
+{
+	conn_t	*conn;
 
-		if (conn->fd > maxfd) {
-			maxfd = conn->fd;
+	if (d->sockfd == -1) {
+		return;
+	}
+
+	d->revents = pollfds[(*n)++].revents;
+
+	for (conn = d->connhead; conn; conn = conn->next) {
+		conn->revents = pollfds[(*n)++].revents;
+	}
+}
+
+/* returns 1 if poll() woke up for one of the sockets of <d> */
+static int poll_ready(const dstate_t *d)
+{
+	conn_t	*conn;
+
+	if (d->revents) {
+		return 1;
+	}
+
+	for (conn = d->connhead; conn; conn = conn->next) {
+		if (conn->revents) {
+			return 1;
 		}
 	}
 
+	return 0;
+}
+
+/* accept, read and write what poll() found on the current sockets.
+ * Connections made since then have no events */
+static void poll_serve(void)
+{
+	conn_t	*conn, *cnext;
+	short	revents;
+
+	if (ds->revents & POLLIN) {
+		ds->revents = 0;
+		sock_connect(ds->sockfd);
+	}
+
+	for (conn = ds->connhead; conn; conn = cnext) {
+		cnext = conn->next;
+
+		revents = conn->revents;
+		conn->revents = 0;
+
+		if ((conn->fd == -1) || conn->busy) {
+			continue;
+		}
+
+		if ((revents & POLLOUT) && !sock_flush(conn)) {
+			continue;
+		}
+
+		/* errors and hangups show up when reading */
+		if (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) {
+			sock_read(conn);
+		}
+	}
+}
+
+/* let the driver follow when requests for another device are served */
+static void switch_to(dstate_t *d)
+{
+	if (select_cb) {
+		select_cb(d);
+	} else {
+		dstate_select(d);
+	}
+}
+
+/* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
+int dstate_poll_fds(struct timeval timeout, int extrafd)
+{
+	int	ret, msec, overrun = 0, woken;
+	size_t	nfds = 0, n;
+	struct timeval	now;
+	dstate_t	*d, *cur = ds;
+
+	/* poll(), unlike select(), has no limit on the descriptor numbers,
+	 * which go high with many devices */
+	for (d = &dstate_first; d; d = d->next) {
+		poll_add_dstate(d, &nfds);
+	}
+
+	if (extrafd != -1) {
+		poll_add(extrafd, POLLIN, &nfds);
+	}
+
 	gettimeofday(&now, NULL);
 
 	/* number of microseconds should always be positive */
@@ -558,15 +864,15 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 	}
 
 	if (timeout.tv_sec < now.tv_sec) {
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
+		msec = 0;
 		overrun = 1;	/* no time left */
 	} else {
-		timeout.tv_sec -= now.tv_sec;
-		timeout.tv_usec -= now.tv_usec;
+		/* rounded up, not to wake up just before the time */
+		msec = (timeout.tv_sec - now.tv_sec) * 1000 +
+			(timeout.tv_usec - now.tv_usec + 999) / 1000;
 	}
-	
-	ret = select(maxfd + 1, &rfds, NULL, NULL, &timeout);
+
+	ret = poll(pollfds, nfds, msec);
 
 	if (ret == 0) {
 		return 1;	/* timer expired */
@@ -581,32 +887,85 @@ int dstate_poll_fds(struct timeval timeout, int extrafd)
 			break;
 
 		default:
-			upslog_with_errno(LOG_ERR, "select unix sockets failed");
+			upslog_with_errno(LOG_ERR, "poll unix sockets failed");
 		}
 
 		return overrun;
 	}
 
-	if (FD_ISSET(sockfd, &rfds)) {
-		sock_connect(sockfd);
+	/* first see which devices have something to do, as serving one may
+	 * change the connections of another */
+	for (d = &dstate_first, n = 0; d; d = d->next) {
+		poll_events(d, &n);
 	}
 
-	for (conn = connhead; conn; conn = cnext) {
-		cnext = conn->next;
+	/* pollfds is reused if a handler calls dstate_poll_fds() again */
+	woken = (extrafd != -1) && pollfds[nfds - 1].revents;
 
-		if (FD_ISSET(conn->fd, &rfds)) {
-			sock_read(conn);
+	serving++;
+
+	for (d = &dstate_first; d; d = d->next) {
+		if (!poll_ready(d)) {
+			continue;
 		}
+
+		if (d != ds) {
+			switch_to(d);
+		}
+
+		poll_serve();
+	}
+
+	if (--serving == 0) {
+		sock_reap();
+	}
+
+	if (ds != cur) {
+		switch_to(cur);
 	}
 
 	/* tell the caller if that fd woke up */
-	if ((extrafd != -1) && (FD_ISSET(extrafd, &rfds))) {
+	if (woken) {
 		return 1;
 	}
 
 	return overrun;
 }
 
+/* a separate state, for a driver serving several devices */
+dstate_t *dstate_new(void)
+{
+	dstate_t	*d, *last;
+
+	d = xcalloc(1, sizeof(*d));
+	d->sockfd = -1;
+	d->stale = 1;
+
+	for (last = &dstate_first; last->next; last = last->next);
+
+	last->next = d;
+
+	return d;
+}
+
+dstate_t *dstate_current(void)
+{
+	return ds;
+}
+
+/* make the dstate_* functions work on <d> */
+void dstate_select(dstate_t *d)
+{
+	ds = d;
+}
+
+/* called by dstate_poll_fds() instead of dstate_select(), so that the
+ * driver can switch to the device it is about to serve a request for */
+void dstate_set_select(void (*cb)(dstate_t *d))
+{
+	select_cb = cb;
+}
+
 int dstate_setinfo(const char *var, const char *fmt, ...)
 {
 	int	ret;
@@ -617,7 +976,7 @@ int dstate_setinfo(const char *var, const char *fmt, ...)
 	vsnprintf(value, sizeof(value), fmt, ap);
 	va_end(ap);
 
-	ret = state_setinfo(&dtree_root, var, value);
+	ret = state_setinfo(&ds->dtree_root, var, value);
 
 	if (ret == 1) {
 		send_to_all("SETINFO %s \"%s\"\n", var, value);
@@ -636,7 +995,7 @@ int dstate_addenum(const char *var, const char *fmt, ...)
 	vsnprintf(value, sizeof(value), fmt, ap);
 	va_end(ap);
 
-	ret = state_addenum(dtree_root, var, value);
+	ret = state_addenum(ds->dtree_root, var, value);
 
 	if (ret == 1) {
 		send_to_all("ADDENUM %s \"%s\"\n", var, value);
@@ -649,7 +1008,7 @@ int dstate_addrange(const char *var, const int min, const int max)
 {
 	int	ret;
 
-	ret = state_addrange(dtree_root, var, min, max);
+	ret = state_addrange(ds->dtree_root, var, min, max);
 
 	if (ret == 1) {
 		send_to_all("ADDRANGE %s  %i %i\n", var, min, max);
@@ -664,7 +1023,7 @@ void dstate_setflags(const char *var, int flags)
 	char	flist[SMALLBUF];
 
 	/* find the dtree node for var */
-	sttmp = state_tree_find(dtree_root, var);
+	sttmp = state_tree_find(ds->dtree_root, var);
 
 	if (!sttmp) {
 		upslogx(LOG_ERR, "%s: base variable (%s) does not exist", __func__, var);
@@ -702,7 +1061,7 @@ void dstate_setaux(const char *var, int aux)
 	st_tree_t	*sttmp;
 
 	/* find the dtree node for var */
-	sttmp = state_tree_find(dtree_root, var);
+	sttmp = state_tree_find(ds->dtree_root, var);
 
 	if (!sttmp) {
 		upslogx(LOG_ERR, "dstate_setaux: base variable (%s) does not exist", var);
@@ -721,14 +1080,14 @@ void dstate_setaux(const char *var, int aux)
 
 const char *dstate_getinfo(const char *var)
 {
-	return state_getinfo(dtree_root, var);
+	return state_getinfo(ds->dtree_root, var);
 }
 
 void dstate_addcmd(const char *cmdname)
 {
 	int	ret;
 
-	ret = state_addcmd(&cmdhead, cmdname);
+	ret = state_addcmd(&ds->cmdhead, cmdname);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -740,7 +1099,7 @@ int dstate_delinfo(const char *var)
 {
 	int	ret;
 
-	ret = state_delinfo(&dtree_root, var);
+	ret = state_delinfo(&ds->dtree_root, var);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -754,7 +1113,7 @@ int dstate_delenum(const char *var, const char *val)
 {
 	int	ret;
 
-	ret = state_delenum(dtree_root, var, val);
+	ret = state_delenum(ds->dtree_root, var, val);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -768,7 +1127,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 {
 	int	ret;
 
-	ret = state_delrange(dtree_root, var, min, max);
+	ret = state_delrange(ds->dtree_root, var, min, max);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -782,7 +1141,7 @@ int dstate_delcmd(const char *cmd)
 {
 	int	ret;
 
-	ret = state_delcmd(&cmdhead, cmd);
+	ret = state_delcmd(&ds->cmdhead, cmd);
 
 	/* update listeners */
 	if (ret == 1) {
@@ -794,44 +1153,44 @@ int dstate_delcmd(const char *cmd)
 
 void dstate_free(void)
 {
-	state_infofree(dtree_root);
-	dtree_root = NULL;
+	state_infofree(ds->dtree_root);
+	ds->dtree_root = NULL;
 	
-	state_cmdfree(cmdhead);
-	cmdhead = NULL;
+	state_cmdfree(ds->cmdhead);
+	ds->cmdhead = NULL;
 
 	sock_close();
 }
 
 const st_tree_t *dstate_getroot(void)
 {
-	return dtree_root;
+	return ds->dtree_root;
 }
 
 const cmdlist_t *dstate_getcmdlist(void)
 {
-	return cmdhead;
+	return ds->cmdhead;
 }
 
 void dstate_dataok(void)
 {
-	if (stale == 1) {
-		stale = 0;
+	if (ds->stale == 1) {
+		ds->stale = 0;
 		send_to_all("DATAOK\n");
 	}
 }
 
 void dstate_datastale(void)
 {
-	if (stale == 0) {
-		stale = 1;
+	if (ds->stale == 0) {
+		ds->stale = 1;
 		send_to_all("DATASTALE\n");
 	}
 }
 
 int dstate_is_stale(void)
 {
-	return stale;
+	return ds->stale;
 }
 
 /* ups.status management functions - reducing duplication in the drivers */
@@ -840,39 +1199,39 @@ int dstate_is_stale(void)
 void status_init(void)
 {
 	if (dstate_getinfo("driver.flag.ignorelb")) {
-		ignorelb = 1;
+		ds->ignorelb = 1;
 	}
 
-	memset(status_buf, 0, sizeof(status_buf));
+	memset(ds->status_buf, 0, sizeof(ds->status_buf));
 }
 
 /* add a status element */
 void status_set(const char *buf)
 {
-	if (ignorelb && !strcasecmp(buf, "LB")) {
+	if (ds->ignorelb && !strcasecmp(buf, "LB")) {
 		upsdebugx(2, "%s: ignoring LB flag from device", __func__);
 		return;
 	}
 
 	/* separate with a space if multiple elements are present */
-	if (strlen(status_buf) > 0) {
-		snprintfcat(status_buf, sizeof(status_buf), " %s", buf);
+	if (strlen(ds->status_buf) > 0) {
+		snprintfcat(ds->status_buf, sizeof(ds->status_buf), " %s", buf);
 	} else {
-		snprintfcat(status_buf, sizeof(status_buf), "%s", buf);
+		snprintfcat(ds->status_buf, sizeof(ds->status_buf), "%s", buf);
 	}
 }
 
 /* write the status_buf into the externally visible dstate storage */
 void status_commit(void)
 {
-	while (ignorelb) {
+	while (ds->ignorelb) {
 		const char	*val, *low;
 
 		val = dstate_getinfo("battery.charge");
 		low = dstate_getinfo("battery.charge.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			snprintfcat(ds->status_buf, sizeof(ds->status_buf), " LB");
 			upsdebugx(2, "%s: appending LB flag [charge '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -881,7 +1240,7 @@ void status_commit(void)
 		low = dstate_getinfo("battery.runtime.low");
 
 		if (val && low && (strtol(val, NULL, 10) < strtol(low, NULL, 10))) {
-			snprintfcat(status_buf, sizeof(status_buf), " LB");
+			snprintfcat(ds->status_buf, sizeof(ds->status_buf), " LB");
 			upsdebugx(2, "%s: appending LB flag [runtime '%s' below '%s']", __func__, val, low);
 			break;
 		}
@@ -890,10 +1249,10 @@ void status_commit(void)
 		break;
 	}
 
-	if (alarm_active) {
-		dstate_setinfo("ups.status", "ALARM %s", status_buf);
+	if (ds->alarm_active) {
+		dstate_setinfo("ups.status", "ALARM %s", ds->status_buf);
 	} else {
-		dstate_setinfo("ups.status", "%s", status_buf);
+		dstate_setinfo("ups.status", "%s", ds->status_buf);
 	}
 }
 
@@ -901,26 +1260,26 @@ void status_commit(void)
 
 void alarm_init(void)
 {
-	memset(alarm_buf, 0, sizeof(alarm_buf));
+	memset(ds->alarm_buf, 0, sizeof(ds->alarm_buf));
 }
 
 void alarm_set(const char *buf)
 {
-	if (strlen(alarm_buf) > 0) {
-		snprintfcat(alarm_buf, sizeof(alarm_buf), " %s", buf);
+	if (strlen(ds->alarm_buf) > 0) {
+		snprintfcat(ds->alarm_buf, sizeof(ds->alarm_buf), " %s", buf);
 	} else {
-		snprintfcat(alarm_buf, sizeof(alarm_buf), "%s", buf);
+		snprintfcat(ds->alarm_buf, sizeof(ds->alarm_buf), "%s", buf);
 	}
 }
 
 /* write the status_buf into the info array */
 void alarm_commit(void)
 {
-	if (strlen(alarm_buf) > 0) {
-		dstate_setinfo("ups.alarm", "%s", alarm_buf);
-		alarm_active = 1;
+	if (strlen(ds->alarm_buf) > 0) {
+		dstate_setinfo("ups.alarm", "%s", ds->alarm_buf);
+		ds->alarm_active = 1;
 	} else {
 		dstate_delinfo("ups.alarm");
-		alarm_active = 0;
+		ds->alarm_active = 0;
 	}
 }
@@ -30,11 +30,27 @@
 
 #define DS_LISTEN_BACKLOG 16
 #define DS_MAX_READ 256		/* don't read forever from upsd */
+#define DS_OUTBUF_LEN 4096	/* size of one block of queued output */
+#define DS_MAX_IOV 64		/* blocks written by a single writev() */
+#define DS_MAX_OUTPUT 1048576	/* drop connections that stop reading */
+
+/* block of output waiting to be written to a connection */
+typedef struct conn_buf_s {
+	size_t	len;		/* bytes used in data */
+	size_t	off;		/* bytes already written */
+	struct conn_buf_s	*next;
+	char	data[DS_OUTBUF_LEN];
+} conn_buf_t;
 
 /* track client connections */
 typedef struct conn_s {
 	int     fd;
 	PCONF_CTX_t	ctx;
+	conn_buf_t	*outhead;	/* queued output */
+	conn_buf_t	*outtail;
+	size_t	outlen;		/* total bytes queued */
+	short	revents;	/* at the last poll(), not served yet */
+	int	busy;		/* a request from it is being handled */
 	struct conn_s	*prev;
 	struct conn_s	*next;
 } conn_t;
@@ -45,6 +61,9 @@ typedef struct conn_s {
 	 * Defaults to nonblocking, for backward compatibility */
 	extern	int	do_synchronous;
 
+/* the state of one device, see dstate_new() */
+typedef struct dstate_s	dstate_t;
+
 void dstate_init(const char *prog, const char *devname);
 int dstate_poll_fds(struct timeval timeout, int extrafd);
 int dstate_setinfo(const char *var, const char *fmt, ...)
@@ -64,6 +83,13 @@ void dstate_free(void);
 const st_tree_t *dstate_getroot(void);
 const cmdlist_t *dstate_getcmdlist(void);
 
+/* for drivers serving several devices: one state per device, the
+ * dstate_* functions work on the selected one */
+dstate_t *dstate_new(void);
+dstate_t *dstate_current(void);
+void dstate_select(dstate_t *d);
+void dstate_set_select(void (*cb)(dstate_t *d));
+
 void dstate_dataok(void);
 void dstate_datastale(void);
 
@@ -0,0 +1,189 @@
+/* dummy-ups-compile.c - compile dummy-ups sequence files
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Reads a .seq or .dev file the way dummy-ups does, and writes the
+ * variables and TIMERs it contains as a replay file (dummy-ups-replay.h),
+ * which dummy-ups can step through without parsing it again on each pass.
+ */
+
+#include "common.h"
+#include "parseconf.h"
+#include "dummy-ups-replay.h"
+
+#include <arpa/inet.h>
+
+typedef struct {
+	char	*buf;
+	size_t	len, size;
+	uint32_t	steps;
+} replay_buf_t;
+
+static void help(const char *prog)
+{
+	printf("Compile a dummy-ups definition or sequence file.\n\n");
+	printf("usage: %s [-h] <input file> <output file>\n\n", prog);
+	printf("  -h            - display this help\n");
+	printf("  <input file>  - .dev or .seq file, as used by dummy-ups\n");
+	printf("  <output file> - compiled file, to use as the dummy-ups port\n");
+}
+
+static void compile_err(const char *errmsg)
+{
+	upslogx(LOG_ERR, "Fatal error in parseconf: %s", errmsg);
+}
+
+static void add_step(replay_buf_t *rb, uint32_t delay, const char *name, const char *value)
+{
+	du_replay_step_t	step;
+	size_t	namelen = 0, valuelen = 0, len;
+
+	if (name) {
+		namelen = strlen(name) + 1;
+		valuelen = strlen(value) + 1;
+
+		if ((namelen > 0xffff) || (valuelen > 0xffff)) {
+			fatalx(EXIT_FAILURE, "Value of %s too long", name);
+		}
+	}
+
+	len = DU_REPLAY_ALIGN(sizeof(step) + namelen + valuelen);
+
+	if (rb->len + len > rb->size) {
+		rb->size = (rb->size + len) * 2;
+		rb->buf = xrealloc(rb->buf, rb->size);
+	}
+
+	step.delay = htonl(delay);
+	step.namelen = htons(namelen);
+	step.valuelen = htons(valuelen);
+
+	memset(rb->buf + rb->len, 0, len);
+	memcpy(rb->buf + rb->len, &step, sizeof(step));
+
+	if (name) {
+		memcpy(rb->buf + rb->len + sizeof(step), name, namelen);
+		memcpy(rb->buf + rb->len + sizeof(step) + namelen, value, valuelen);
+	}
+
+	rb->len += len;
+	rb->steps++;
+}
+
+int main(int argc, char **argv)
+{
+	PCONF_CTX_t	ctx;
+	replay_buf_t	rb;
+	du_replay_header_t	hdr;
+	char	value[LARGEBUF], *ptr;
+	const char	*prog = xbasename(argv[0]);
+	double	delay;
+	size_t	i;
+	FILE	*out;
+	int	opt;
+
+	while ((opt = getopt(argc, argv, "h")) != -1) {
+		switch (opt)
+		{
+		case 'h':
+		default:
+			help(prog);
+			exit(EXIT_SUCCESS);
+		}
+	}
+
+	if (argc - optind != 2) {
+		help(prog);
+		exit(EXIT_FAILURE);
+	}
+
+	pconf_init(&ctx, compile_err);
+
+	if (!pconf_file_begin(&ctx, argv[optind])) {
+		fatalx(EXIT_FAILURE, "Can't open %s: %s", argv[optind], ctx.errmsg);
+	}
+
+	memset(&rb, 0, sizeof(rb));
+	rb.len = rb.size = sizeof(hdr);
+	rb.buf = xcalloc(1, rb.size);
+
+	while (pconf_file_next(&ctx)) {
+		if (pconf_parse_error(&ctx)) {
+			upslogx(LOG_WARNING, "Parse error: %s:%d: %s",
+				argv[optind], ctx.linenum, ctx.errmsg);
+			continue;
+		}
+
+		if (ctx.numargs < 1) {
+			continue;
+		}
+
+		/* TIMER <seconds>, which may have decimals here */
+		if (!strncmp(ctx.arglist[0], "TIMER", 5)) {
+			delay = (ctx.numargs > 1) ? strtod(ctx.arglist[1], NULL) : 0;
+
+			if ((delay < 0) || (delay > 4294967)) {
+				upslogx(LOG_WARNING, "%s:%d: bad TIMER value, ignored",
+					argv[optind], ctx.linenum);
+				continue;
+			}
+
+			add_step(&rb, (uint32_t)(delay * 1000 + 0.5), NULL, NULL);
+			continue;
+		}
+
+		/* Remove ":" suffix, after the variable name */
+		if ((ptr = strchr(ctx.arglist[0], ':')) != NULL) {
+			*ptr = '\0';
+		}
+
+		/* dummy-ups skips the driver.* collection data */
+		if (!strncmp(ctx.arglist[0], "driver.", 7)) {
+			continue;
+		}
+
+		value[0] = '\0';
+
+		for (i = 1; i < ctx.numargs; i++) {
+			snprintfcat(value, sizeof(value), (i == 1) ? "%s" : " %s", ctx.arglist[i]);
+		}
+
+		add_step(&rb, 0, ctx.arglist[0], value);
+	}
+
+	pconf_finish(&ctx);
+
+	memcpy(hdr.magic, DU_REPLAY_MAGIC, DU_REPLAY_MAGIC_LEN);
+	hdr.steps = htonl(rb.steps);
+	hdr.size = htonl(rb.len);
+	memcpy(rb.buf, &hdr, sizeof(hdr));
+
+	out = fopen(argv[optind + 1], "wb");
+
+	if (!out) {
+		fatal_with_errno(EXIT_FAILURE, "Can't create %s", argv[optind + 1]);
+	}
+
+	if ((fwrite(rb.buf, 1, rb.len, out) != rb.len) || (fclose(out) != 0)) {
+		fatal_with_errno(EXIT_FAILURE, "Can't write %s", argv[optind + 1]);
+	}
+
+	printf("%s: %u steps, %u bytes\n", argv[optind + 1], (unsigned int)rb.steps, (unsigned int)rb.len);
+
+	free(rb.buf);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+/* dummy-ups-replay.h - compiled sequence files for dummy-ups
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef DUMMY_UPS_REPLAY_H
+#define DUMMY_UPS_REPLAY_H
+
+#include <stdint.h>
+
+/* A .seq or .dev file compiled by dummy-ups-compile is a header followed
+ * by steps, each one either setting a variable or pausing.  dummy-ups maps
+ * the file and applies the steps straight from it, without any parsing.
+ *
+ * All the integers are in network byte order.  Every step starts on a
+ * 4 byte boundary.
+ */
+
+#define DU_REPLAY_MAGIC		"NUTRPL1\n"
+#define DU_REPLAY_MAGIC_LEN	8
+
+typedef struct {
+	char		magic[DU_REPLAY_MAGIC_LEN];
+	uint32_t	steps;		/* number of steps */
+	uint32_t	size;		/* of the whole file, to detect truncation */
+} du_replay_header_t;
+
+/* followed by <namelen> bytes of variable name and <valuelen> bytes of
+ * value, both NUL terminated, then padding; a step without a name is a
+ * pause of <delay> milliseconds (TIMER) */
+typedef struct {
+	uint32_t	delay;
+	uint16_t	namelen;	/* including the NUL, 0 for a pause */
+	uint16_t	valuelen;	/* including the NUL */
+} du_replay_step_t;
+
+#define DU_REPLAY_ALIGN(len)	(((len) + 3) & ~3)
+
+#endif	/* DUMMY_UPS_REPLAY_H */
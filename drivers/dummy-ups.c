@@ -31,13 +31,16 @@
 
 #include <netdb.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <string.h>
 
 #include "main.h"
 #include "parseconf.h"
 #include "upsclient.h"
 #include "dummy-ups.h"
+#include "dummy-ups-replay.h"
 
 #define DRIVER_NAME	"Device simulation and repeater driver"
 #define DRIVER_VERSION	"0.13"
@@ -68,17 +71,41 @@ time_t		next_update = -1;
 static int setvar(const char *varname, const char *val);
 static int instcmd(const char *cmdname, const char *extra);
 static int parse_data_file(int upsfd);
+static int replay_open(void);
+static void replay_update(void);
 static dummy_info_t *find_info(const char *varname);
 static int is_valid_data(const char* varname);
 static int is_valid_value(const char* varname, const char *value);
 /* libupsclient update */
 static int upsclient_update_vars(void);
+static int upsclient_watch(void);
+static int upsclient_update(void);
+static void upsclient_update_var(const char *varname, const char *val);
+static void upsclient_delete_vars(st_tree_t *listed);
 
 /* connection information */
 static char		*client_upsname = NULL, *hostname = NULL;
 static UPSCONN_t	*ups = NULL;
 static int	port;
 
+/* Repeater: after the first LIST VAR, upsd is asked to push the changes
+ * with WATCH, so the connection is only read when something changed, plus
+ * a GET VAR every poll_interval to check that the data is not stale.  With
+ * an older upsd, the whole list is fetched every poll_interval instead.
+ * Each LIST VAR also removes the variables upsd no longer has, which WATCH
+ * only reports while upsd stays connected to the driver: the list is
+ * fetched again once the upstream data is back from being stale, or
+ * complete again after upsd reconnected to the driver (ups.status WAIT). */
+static int	watching = 0, watch_failed = 0, upstream_stale = 0;
+static time_t	last_check = 0;
+static PCONF_CTX_t	notify_ctx;
+
+/* compiled definition file (dummy-ups-compile), mapped by replay_open()
+ * and applied straight from the mapping */
+static unsigned char	*replay_map = NULL;
+static size_t	replay_size = 0, replay_pos = 0;
+static struct timeval	replay_next;	/* end of the current pause */
+
 /* Driver functions */
 
 void upsdrv_initinfo(void)
@@ -103,7 +130,9 @@ void upsdrv_initinfo(void)
 			}
 
 			/* Now get user's defined variables */
-			if (parse_data_file(upsfd) < 0)
+			if (replay_open())
+				replay_update();
+			else if (parse_data_file(upsfd) < 0)
 				upslogx(LOG_NOTICE, "Unable to parse the definition file %s", device_path);
 
 			/* Initialize handler */
@@ -128,6 +157,7 @@ void upsdrv_initinfo(void)
 			{
 				upsdebugx(1, "Connected to %s@%s", client_upsname, hostname);
 			}
+			pconf_init(&notify_ctx, NULL);
 			if (upsclient_update_vars() < 0)
 			{
 				/* check for an old upsd */
@@ -137,6 +167,10 @@ void upsdrv_initinfo(void)
 				}
 				fatalx(EXIT_FAILURE, "Error: %s", upscli_strerror(ups));
 			}
+			if (upsclient_watch() < 0)
+			{
+				fatalx(EXIT_FAILURE, "Error: %s", upscli_strerror(ups));
+			}
 			/* FIXME: commands and settable variable! */
 			break;
 		default:
@@ -151,26 +185,43 @@ void upsdrv_initinfo(void)
 
 void upsdrv_updateinfo(void)
 {
-	upsdebugx(1, "upsdrv_updateinfo...");
+	int	ret;
 
-	sleep(1);
+	upsdebugx(1, "upsdrv_updateinfo...");
 
 	switch (mode)
 	{
 		case MODE_DUMMY:
+			if (replay_map)
+			{
+				replay_update();
+				dstate_dataok();
+				break;
+			}
+
+			sleep(1);
+
 			/* Now get user's defined variables */
 			if (parse_data_file(upsfd) >= 0)
 				dstate_dataok();
 			break;
 		case MODE_META:
 		case MODE_REPEATER:
-			if (upsclient_update_vars() > 0)
+			ret = upsclient_update();
+			if (ret > 0)
 			{
 				dstate_dataok();
 			}
+			else if (ret == 0)
+			{
+				dstate_datastale();
+			}
 			else
 			{
 				/* try to reconnect */
+				watching = 0;
+				watch_failed = 0;
+				extrafd = -1;
 				upscli_disconnect(ups);
 				if (upscli_connect(ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
 				{
@@ -179,6 +230,12 @@ void upsdrv_updateinfo(void)
 				else
 				{
 					upsdebugx(1, "Reconnected");
+
+					/* catch up with what changed meanwhile */
+					if ((upsclient_update_vars() > 0) && (upsclient_watch() >= 0))
+					{
+						dstate_dataok();
+					}
 				}
 			}
 			break;
@@ -238,6 +295,11 @@ void upsdrv_initups(void)
 
 void upsdrv_cleanup(void)
 {
+	if (replay_map)
+	{
+		munmap(replay_map, replay_size);
+	}
+
 	if ( (mode == MODE_META) || (mode == MODE_REPEATER) )
 	{
 		if (ups)
@@ -251,6 +313,8 @@ void upsdrv_cleanup(void)
 			free(ctx);
 		}
 
+		pconf_finish(&notify_ctx);
+
 		free(client_upsname);
 		free(hostname);
 		free(ups);
@@ -323,6 +387,8 @@ static int upsclient_update_vars(void)
 	unsigned int	numq, numa;
 	const char	*query[4];
 	char		**answer;
+	st_tree_t	*listed = NULL;
+	int		dumping = 0;
 
 	query[0] = "VAR";
 	query[1] = client_upsname;
@@ -347,13 +413,278 @@ static int upsclient_update_vars(void)
 		upsdebugx(5, "Received: %s %s %s %s",
 				answer[0], answer[1], answer[2], answer[3]);
 
-		/* do not override the driver collection */
-		if (strncmp(answer[2], "driver.", 7))
-			setvar(answer[2], answer[3]);
+		upsclient_update_var(answer[2], answer[3]);
+		state_setinfo(&listed, answer[2], "");
+
+		/* upsd is still getting the variables from the driver */
+		if (!strcmp(answer[2], "ups.status") && !strcmp(answer[3], "WAIT"))
+		{
+			dumping = 1;
+		}
+	}
+
+	/* an incomplete list doesn't tell what is gone: try again later */
+	upstream_stale = dumping;
+
+	if (!dumping)
+	{
+		upsclient_delete_vars(listed);
+	}
+
+	state_infofree(listed);
+
+	return 1;
+}
+
+/* read a line from upsd into <buf>, and apply it if it is a notification:
+ * returns 1 for a notification, 0 for anything else, -1 on error */
+static int upsclient_readline(char *buf, size_t buflen)
+{
+	if (upscli_readline(ups, buf, buflen) < 0)
+	{
+		upsdebugx(1, "Error: %s", upscli_strerror(ups));
+		return -1;
+	}
+
+	if (strncmp(buf, "NOTIFY ", 7))
+	{
+		return 0;
+	}
+
+	/* NOTIFY VAR <upsname> <varname> "<value>"
+	 * NOTIFY DELVAR <upsname> <varname> */
+	if ((pconf_line(&notify_ctx, buf) != 1) || (notify_ctx.numargs < 4))
+	{
+		upsdebugx(1, "Error: invalid notification [%s]", buf);
+		return 1;
+	}
+
+	if (strcmp(notify_ctx.arglist[2], client_upsname))
+	{
+		return 1;
+	}
+
+	if (!strcmp(notify_ctx.arglist[1], "VAR") && (notify_ctx.numargs >= 5))
+	{
+		upsdebugx(5, "Notified: %s %s", notify_ctx.arglist[3], notify_ctx.arglist[4]);
+		upsclient_update_var(notify_ctx.arglist[3], notify_ctx.arglist[4]);
+	}
+	else if (!strcmp(notify_ctx.arglist[1], "DELVAR") && strncmp(notify_ctx.arglist[3], "driver.", 7))
+	{
+		upsdebugx(5, "Notified: %s removed", notify_ctx.arglist[3]);
+		dstate_delinfo(notify_ctx.arglist[3]);
+	}
+
+	return 1;
+}
+
+/* send <cmd> and read its response into <buf>, applying any notification
+ * received before it */
+static int upsclient_command(const char *cmd, char *buf, size_t buflen)
+{
+	int	ret;
+
+	if (upscli_sendline(ups, cmd, strlen(cmd)) < 0)
+	{
+		upsdebugx(1, "Error: %s", upscli_strerror(ups));
+		return -1;
+	}
+
+	while ((ret = upsclient_readline(buf, buflen)) == 1)
+		;
+
+	return ret;
+}
+
+/* subscribe to the changes of all the variables, returns 1 if upsd will
+ * push them, 0 if it can't (and they have to be polled), -1 on error */
+static int upsclient_watch(void)
+{
+	char	cmd[SMALLBUF], buf[LARGEBUF];
+
+	snprintf(cmd, sizeof(cmd), "WATCH %s\n", client_upsname);
+
+	if (upsclient_command(cmd, buf, sizeof(buf)) < 0)
+	{
+		return -1;
+	}
+
+	if (strncmp(buf, "OK", 2))
+	{
+		upsdebugx(1, "WATCH not supported (%s), polling instead", buf);
+		watch_failed = 1;
+		return 0;
 	}
+
+	upsdebugx(1, "Watching %s@%s", client_upsname, hostname);
+
+	watching = 1;
+	extrafd = upscli_fd(ups);
+	time(&last_check);
+
 	return 1;
 }
 
+/* tell if something can be read from upsd without waiting */
+static int upsclient_readable(void)
+{
+	fd_set	rfds;
+	struct timeval	tv;
+	int	fd = upscli_fd(ups);
+
+	if (upscli_pending(ups) > 0)
+	{
+		return 1;
+	}
+
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	return (select(fd + 1, &rfds, NULL, NULL, &tv) > 0);
+}
+
+/* bring the variables up to date: returns 1 if the data is good, 0 if the
+ * upstream data is stale, -1 if the connection must be opened again */
+static int upsclient_update(void)
+{
+	char	cmd[SMALLBUF], buf[LARGEBUF];
+	time_t	now;
+	int	ret;
+
+	if (!watching)
+	{
+		ret = upsclient_update_vars();
+
+		/* after a reconnection that didn't get that far */
+		if ((ret > 0) && !watch_failed && (upsclient_watch() < 0))
+		{
+			return -1;
+		}
+
+		return ret;
+	}
+
+	/* apply the changes pushed by upsd */
+	while (upsclient_readable())
+	{
+		switch (upsclient_readline(buf, sizeof(buf)))
+		{
+			case 1:
+				break;
+			case 0:
+				upsdebugx(1, "Unexpected line from upsd: %s", buf);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	time(&now);
+
+	if (now - last_check < (time_t)poll_interval)
+	{
+		return 1;
+	}
+
+	last_check = now;
+
+	/* changes are pushed, but not the data going stale */
+	snprintf(cmd, sizeof(cmd), "GET VAR %s ups.status\n", client_upsname);
+
+	if (upsclient_command(cmd, buf, sizeof(buf)) < 0)
+	{
+		return -1;
+	}
+
+	if (!strncmp(buf, "VAR ", 4))
+	{
+		/* the driver may have come back without some variables */
+		if (upstream_stale)
+		{
+			return upsclient_update_vars();
+		}
+		return 1;
+	}
+
+	if (!strcmp(buf, "ERR DATA-STALE"))
+	{
+		upstream_stale = 1;
+		return 0;
+	}
+
+	upsdebugx(1, "Error: %s", buf);
+	return -1;
+}
+
+/* apply a value received from upsd, unless it is unchanged */
+static void upsclient_update_var(const char *varname, const char *val)
+{
+	const char	*cur;
+
+	/* do not override the driver collection */
+	if (!strncmp(varname, "driver.", 7))
+	{
+		return;
+	}
+
+	cur = dstate_getinfo(varname);
+
+	if (cur && !strcmp(cur, val))
+	{
+		return;
+	}
+
+	setvar(varname, val);
+}
+
+/* names of the variables of the driver, see upsclient_delete_vars() */
+static void upsclient_list_vars(const st_tree_t *node, char ***names, size_t *count)
+{
+	if (!node)
+	{
+		return;
+	}
+
+	upsclient_list_vars(node->left, names, count);
+
+	*names = xrealloc(*names, (*count + 1) * sizeof(**names));
+	(*names)[(*count)++] = xstrdup(node->var);
+
+	upsclient_list_vars(node->right, names, count);
+}
+
+/* remove the variables that are not in the <listed> tree of upsd's list,
+ * except the driver's own */
+static void upsclient_delete_vars(st_tree_t *listed)
+{
+	char	**names = NULL;
+	size_t	count = 0, i;
+
+	/* collected first, as deleting changes the tree */
+	upsclient_list_vars(dstate_getroot(), &names, &count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (strncmp(names[i], "driver.", 7) && !state_getinfo(listed, names[i]))
+		{
+			upsdebugx(2, "%s is gone upstream", names[i]);
+			dstate_delinfo(names[i]);
+		}
+
+		free(names[i]);
+	}
+
+	free(names);
+}
+
 /* find info element definition in info array */
 static dummy_info_t *find_info(const char *varname)
 {
@@ -415,6 +746,161 @@ static void upsconf_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
 }
 
+/* full path of the definition file */
+static void data_file_path(char *fn, size_t fnlen)
+{
+	if (device_path[0] == '/')
+		snprintf(fn, fnlen, "%s", device_path);
+	else
+		snprintf(fn, fnlen, "%s/%s", confpath(), device_path);
+}
+
+/* for dummy mode
+ * map the definition file if it was compiled, returns 1 if so
+ */
+static int replay_open(void)
+{
+	char	fn[SMALLBUF];
+	struct stat	st;
+	const du_replay_header_t	*hdr;
+	const du_replay_step_t	*step;
+	size_t	pos, len, namelen, valuelen;
+	uint32_t	steps;
+	int	fd;
+
+	data_file_path(fn, sizeof(fn));
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return 0;
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(*hdr)))
+	{
+		close(fd);
+		return 0;
+	}
+
+	replay_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (replay_map == MAP_FAILED)
+	{
+		upslog_with_errno(LOG_ERR, "Can't map %s", fn);
+		replay_map = NULL;
+		return 0;
+	}
+
+	replay_size = st.st_size;
+	hdr = (const du_replay_header_t *)replay_map;
+
+	/* a text definition file */
+	if (memcmp(hdr->magic, DU_REPLAY_MAGIC, DU_REPLAY_MAGIC_LEN))
+	{
+		munmap(replay_map, replay_size);
+		replay_map = NULL;
+		return 0;
+	}
+
+	if (ntohl(hdr->size) != replay_size)
+		fatalx(EXIT_FAILURE, "%s: truncated compiled file", fn);
+
+	/* check all the steps once, so that replay_update() can trust them */
+	for (pos = sizeof(*hdr), steps = 0; pos < replay_size; pos += len, steps++)
+	{
+		if (pos + sizeof(*step) > replay_size)
+			break;
+
+		step = (const du_replay_step_t *)(replay_map + pos);
+		namelen = ntohs(step->namelen);
+		valuelen = ntohs(step->valuelen);
+		len = DU_REPLAY_ALIGN(sizeof(*step) + namelen + valuelen);
+
+		if ((pos + len > replay_size) || ((namelen > 0) && ((valuelen < 1) ||
+			(replay_map[pos + sizeof(*step) + namelen - 1] != '\0') ||
+			(replay_map[pos + sizeof(*step) + namelen + valuelen - 1] != '\0'))))
+			break;
+	}
+
+	if ((pos != replay_size) || (steps != ntohl(hdr->steps)))
+		fatalx(EXIT_FAILURE, "%s: corrupted compiled file", fn);
+
+	upsdebugx(1, "Replaying %u steps from %s", (unsigned int)steps, fn);
+
+	replay_pos = sizeof(*hdr);
+	timerclear(&replay_next);
+
+	return 1;
+}
+
+/* for dummy mode
+ * apply the compiled steps up to the next pause, and ask to be called
+ * again when it ends
+ */
+static void replay_update(void)
+{
+	const du_replay_step_t	*step;
+	const char	*name;
+	struct timeval	now;
+	size_t	namelen;
+	uint32_t	delay;
+	int	wrapped = (replay_pos == sizeof(du_replay_header_t));
+
+	gettimeofday(&now, NULL);
+
+	if (timercmp(&now, &replay_next, <))
+	{
+		next_wakeup = replay_next;
+		return;
+	}
+
+	for (;;)
+	{
+		/* loop back to the beginning of the file, but go through it
+		 * at most once per call if there is no pause in it */
+		if (replay_pos >= replay_size)
+		{
+			replay_pos = sizeof(du_replay_header_t);
+
+			if (wrapped++)
+				return;
+		}
+
+		step = (const du_replay_step_t *)(replay_map + replay_pos);
+		namelen = ntohs(step->namelen);
+
+		replay_pos += DU_REPLAY_ALIGN(sizeof(*step) + namelen + ntohs(step->valuelen));
+
+		if (namelen > 0)
+		{
+			name = (const char *)(step + 1);
+			setvar(name, name + namelen);
+			continue;
+		}
+
+		/* TIMER: count from the end of the previous pause, so that
+		 * the sequence keeps its pace, unless we are already late */
+		delay = ntohl(step->delay);
+
+		if (!timerisset(&replay_next) || (now.tv_sec - replay_next.tv_sec > 1))
+			replay_next = now;
+
+		replay_next.tv_sec += delay / 1000;
+		replay_next.tv_usec += (delay % 1000) * 1000;
+
+		if (replay_next.tv_usec >= 1000000)
+		{
+			replay_next.tv_sec++;
+			replay_next.tv_usec -= 1000000;
+		}
+
+		if (timercmp(&now, &replay_next, <))
+		{
+			upsdebugx(1, "suspending execution for %u ms...", (unsigned int)delay);
+			next_wakeup = replay_next;
+			return;
+		}
+	}
+}
+
 /* for dummy mode
  * parse the definition file and process its content
  */ 
@@ -440,10 +926,7 @@ static int parse_data_file(int upsfd)
 	{
 		ctx = (PCONF_CTX_t *)xmalloc(sizeof(PCONF_CTX_t));
 
-		if (device_path[0] == '/')
-			snprintf(fn, sizeof(fn), "%s", device_path);
-		else
-			snprintf(fn, sizeof(fn), "%s/%s", confpath(), device_path);
+		data_file_path(fn, sizeof(fn));
 
 		pconf_init(ctx, upsconf_err);
 
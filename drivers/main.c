@@ -28,6 +28,10 @@
 	/* may be set by the driver to wake up while in dstate_poll_fds */
 	int	extrafd = -1;
 
+	/* may be set by upsdrv_updateinfo() to be called again before
+	 * poll_interval is over, cleared after each call */
+	struct timeval	next_wakeup = { 0, 0 };
+
 	/* for ser_open */
 	int	do_lock_port = 1;
 
@@ -39,6 +43,33 @@
 
 	static vartab_t	*vartab_h = NULL;
 
+	/* devices served by this process: the -a one, then the ups.conf
+	 * sections which name it as their collector */
+	typedef struct {
+		char		*name;
+		char		*device_path;
+		vartab_t	*vartab;
+		dstate_t	*ds;
+		int		ready;		/* upsdrv_initups() went through */
+		int		delay;		/* before trying again, if not */
+		time_t		retry;
+	} device_t;
+
+	static device_t	*devices = NULL;
+	static int	curdev = 0, reading_collected = 0;
+	int	ndevices = 1;
+
+	/* set while upsdrv_initups() may give up on the current device,
+	 * see device_init_failed() */
+	static int	init_can_fail = 0, init_failed = 0;
+
+/* seconds between attempts to set up a device that failed */
+#define DEVICE_RETRY_MIN	30
+#define DEVICE_RETRY_MAX	600
+
+	/* set by drivers which can serve several devices */
+	void	(*upsdrv_select)(int num) = NULL;
+
 	/* variables possibly set by the global part of ups.conf */
 	unsigned int	poll_interval = 2;
 	static char	*chroot_path = NULL, *user = NULL;
@@ -302,6 +333,10 @@ static int main_arg(char *var, char *val)
 	if (!strcmp(var, "desc"))
 		return 1;	/* handled */
 
+	/* only for the collector, and for upsdrvctl - ignored here */
+	if (!strcmp(var, "collector"))
+		return 1;	/* handled */
+
 	return 0;	/* unhandled, pass it through to the driver */
 }
 
@@ -333,6 +368,58 @@ static void do_global_args(const char *var, const char *val)
 	/* unrecognized */
 }
 
+static void device_add(const char *name)
+{
+	int	i;
+
+	for (i = 1; i < ndevices; i++) {
+		if (!strcmp(devices[i].name, name))
+			return;
+	}
+
+	devices = xrealloc(devices, (ndevices + 1) * sizeof(*devices));
+
+	if (ndevices == 1)
+		memset(&devices[0], 0, sizeof(*devices));
+
+	memset(&devices[ndevices], 0, sizeof(*devices));
+	devices[ndevices].name = xstrdup(name);
+	ndevices++;
+}
+
+/* make main and the driver work on device <num> */
+static void device_select(int num)
+{
+	if (num == curdev)
+		return;
+
+	devices[curdev].device_path = device_path;
+	devices[curdev].vartab = vartab_h;
+
+	curdev = num;
+
+	upsname = devices[num].name;
+	device_path = devices[num].device_path;
+	device_name = device_path ? xbasename(device_path) : NULL;
+	vartab_h = devices[num].vartab;
+
+	dstate_select(devices[num].ds);
+	upsdrv_select(num);
+}
+
+/* for requests on the socket of another device */
+static void device_select_dstate(dstate_t *ds)
+{
+	int	i;
+
+	for (i = 0; i < ndevices; i++) {
+		if (devices[i].ds == ds) {
+			device_select(i);
+			return;
+		}
+	}
+}
+
 void do_upsconf_args(char *confupsname, char *var, char *val)
 {
 	char	tmp[SMALLBUF];
@@ -343,6 +430,13 @@ void do_upsconf_args(char *confupsname, char *var, char *val)
 		return;
 	}
 
+	/* other sections this process has to serve too */
+	if ((!reading_collected) && val && !strcmp(var, "collector") &&
+		!strcmp(val, upsname) && strcmp(confupsname, upsname)) {
+		device_add(confupsname);
+		return;
+	}
+
 	/* no match = not for us */
 	if (strcmp(confupsname, upsname) != 0)
 		return;
@@ -430,11 +524,99 @@ static void listxarg(void)
 	}
 }
 
-static void vartab_free(void)
+/* a fresh copy of the driver variables, for another device */
+static vartab_t *vartab_dup(const vartab_t *tmp)
 {
-	vartab_t	*tmp, *next;
+	vartab_t	*head = NULL, *last = NULL, *dup;
 
-	tmp = vartab_h;
+	for (; tmp; tmp = tmp->next) {
+		dup = xcalloc(1, sizeof(*dup));
+		dup->vartype = tmp->vartype;
+		dup->var = xstrdup(tmp->var);
+		dup->desc = xstrdup(tmp->desc);
+
+		if (last)
+			last->next = dup;
+		else
+			head = dup;
+
+		last = dup;
+	}
+
+	return head;
+}
+
+/* read the ups.conf sections of the other devices */
+static void devices_setup(void)
+{
+	unsigned int	interval = poll_interval;
+	int	i;
+
+	if (!upsdrv_select)
+		fatalx(EXIT_FAILURE, "Error: %s can't serve several devices, "
+			"but %s is the collector of %s in ups.conf", progname, upsname, devices[1].name);
+
+	devices[0].name = xstrdup(upsname);
+	devices[0].ds = dstate_current();
+
+	reading_collected = 1;
+
+	for (i = 1; i < ndevices; i++) {
+		devices[i].vartab = vartab_dup(vartab_h);
+		devices[i].ds = dstate_new();
+
+		device_select(i);
+		read_upsconf();
+
+		if (!device_path)
+			fatalx(EXIT_FAILURE, "Error: you must specify a port name in ups.conf for %s.",
+				upsname);
+	}
+
+	device_select(0);
+
+	/* the poll interval is the one of the collector */
+	poll_interval = interval;
+
+	dstate_set_select(device_select_dstate);
+
+	upslogx(LOG_INFO, "Serving %d devices", ndevices);
+}
+
+static void devices_cleanup(void)
+{
+	int	i;
+
+	for (i = 0; i < ndevices; i++) {
+		if ((i > 0) && !devices[i].ready)
+			continue;
+
+		device_select(i);
+		upsdrv_cleanup();
+	}
+}
+
+/* the current device can't be set up: when it isn't the first one, only
+ * log why and return, main then marks it stale and tries again later */
+void device_init_failed(const char *fmt, ...)
+{
+	va_list	va;
+	char	msg[LARGEBUF];
+
+	va_start(va, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, va);
+	va_end(va);
+
+	if (!init_can_fail)
+		fatalx(EXIT_FAILURE, "%s", msg);
+
+	upslogx(LOG_ERR, "%s: %s", upsname, msg);
+	init_failed = 1;
+}
+
+static void vartab_free(vartab_t *tmp)
+{
+	vartab_t	*next;
 
 	while (tmp) {
 		next = tmp->next;
@@ -450,6 +632,8 @@ static void vartab_free(void)
 
 static void exit_cleanup(void)
 {
+	int	i;
+
 	free(chroot_path);
 	free(device_path);
 	free(user);
@@ -460,7 +644,24 @@ static void exit_cleanup(void)
 	}
 
 	dstate_free();
-	vartab_free();
+	vartab_free(vartab_h);
+
+	for (i = 0; devices && (i < ndevices); i++) {
+		free(devices[i].name);
+
+		if (i == curdev)
+			continue;	/* done above */
+
+		free(devices[i].device_path);
+		vartab_free(devices[i].vartab);
+
+		if (devices[i].ds) {
+			dstate_select(devices[i].ds);
+			dstate_free();
+		}
+	}
+
+	free(devices);
 }
 
 static void set_exit_flag(int sig)
@@ -485,6 +686,101 @@ static void setup_signals(void)
 	sigaction(SIGPIPE, &sa, NULL);
 }
 
+/* get the base data of the current device, then open its socket */
+static void start_device(void)
+{
+	/* note: device.type is set early to be overriden by the driver
+	 * when its a pdu! */
+	dstate_setinfo("device.type", "ups");
+
+	/* publish the top-level data: version numbers, driver name */
+	dstate_setinfo("driver.version", "%s", UPS_VERSION);
+	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
+	dstate_setinfo("driver.name", "%s", progname);
+
+	/* get the base data established before allowing connections */
+	upsdrv_initinfo();
+	upsdrv_updateinfo();
+
+	if (dstate_getinfo("driver.flag.ignorelb")) {
+		int	have_lb_method = 0;
+
+		if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
+			upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
+			have_lb_method++;
+		}
+
+		if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
+			upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
+			have_lb_method++;
+		}
+
+		if (!have_lb_method) {
+			fatalx(EXIT_FAILURE,
+				"The 'ignorelb' flag is set, but there is no way to determine the\n"
+				"battery state of charge.\n\n"
+				"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
+				"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
+		}
+	}
+
+	/* now we can start servicing requests */
+	dstate_init(progname, upsname);
+
+	/* The poll_interval may have been changed from the default */
+	dstate_setinfo("driver.parameter.pollinterval", "%d", poll_interval);
+
+	/* The synchronous option may have been changed from the default */
+	dstate_setinfo("driver.parameter.synchronous", "%s",
+		(do_synchronous==1)?"yes":"no");
+
+	/* remap the device.* info from ups.* for the transition period */
+	if (dstate_getinfo("ups.mfr") != NULL)
+		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
+	if (dstate_getinfo("ups.model") != NULL)
+		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
+	if (dstate_getinfo("ups.serial") != NULL)
+		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+}
+
+/* set up device <num>, other than the first one, or have it tried again
+ * later if it can't be reached yet */
+static void device_init(int num)
+{
+	device_t	*dev = &devices[num];
+
+	device_select(num);
+
+	init_can_fail = 1;
+	init_failed = 0;
+
+	upsdrv_initups();
+
+	init_can_fail = 0;
+
+	if (!init_failed) {
+		dev->ready = 1;
+		dev->delay = 0;
+		start_device();
+		return;
+	}
+
+	/* upsd sees the device, but not its data */
+	dstate_init(progname, upsname);
+	dstate_datastale();
+
+	if (dev->delay == 0)
+		dev->delay = DEVICE_RETRY_MIN;
+	else if (dev->delay < DEVICE_RETRY_MAX / 2)
+		dev->delay *= 2;
+	else
+		dev->delay = DEVICE_RETRY_MAX;
+
+	dev->retry = time(NULL) + dev->delay;
+
+	upslogx(LOG_WARNING, "%s: trying again in %d seconds", upsname, dev->delay);
+}
+
 int main(int argc, char **argv)
 {
 	struct	passwd	*new_uid = NULL;
@@ -576,6 +872,9 @@ int main(int argc, char **argv)
 			"Error: you must specify a port name in ups.conf. Try -h for help.");
 	}
 
+	if ((ndevices > 1) && !do_forceshutdown)
+		devices_setup();
+
 	upsdebugx(1, "debug level is '%d'", nut_debug_level);
 
 	new_uid = get_user_pwent(user);
@@ -630,7 +929,7 @@ int main(int argc, char **argv)
 	upsdrv_initups();
 
 	/* UPS is detected now, cleanup upon exit */
-	atexit(upsdrv_cleanup);
+	atexit(devices_cleanup);
 
 	/* now see if things are very wrong out there */
 	if (upsdrv_info.status == DRV_BROKEN) {
@@ -640,58 +939,15 @@ int main(int argc, char **argv)
 	if (do_forceshutdown)
 		forceshutdown();
 
-	/* note: device.type is set early to be overriden by the driver
-	 * when its a pdu! */
-	dstate_setinfo("device.type", "ups");
-
-	/* publish the top-level data: version numbers, driver name */
-	dstate_setinfo("driver.version", "%s", UPS_VERSION);
-	dstate_setinfo("driver.version.internal", "%s", upsdrv_info.version);
-	dstate_setinfo("driver.name", "%s", progname);
-
-	/* get the base data established before allowing connections */
-	upsdrv_initinfo();
-	upsdrv_updateinfo();
-
-	if (dstate_getinfo("driver.flag.ignorelb")) {
-		int	have_lb_method = 0;
-
-		if (dstate_getinfo("battery.charge") && dstate_getinfo("battery.charge.low")) {
-			upslogx(LOG_INFO, "using 'battery.charge' to set battery low state");
-			have_lb_method++;
-		}
-
-		if (dstate_getinfo("battery.runtime") && dstate_getinfo("battery.runtime.low")) {
-			upslogx(LOG_INFO, "using 'battery.runtime' to set battery low state");
-			have_lb_method++;
-		}
+	start_device();
 
-		if (!have_lb_method) {
-			fatalx(EXIT_FAILURE,
-				"The 'ignorelb' flag is set, but there is no way to determine the\n"
-				"battery state of charge.\n\n"
-				"Only set this flag if both 'battery.charge' and 'battery.charge.low'\n"
-				"and/or 'battery.runtime' and 'battery.runtime.low' are available.\n");
-		}
+	/* then the devices this one is the collector of, which must not
+	 * take the others down if they can't be reached */
+	for (i = 1; i < ndevices; i++) {
+		device_init(i);
 	}
 
-	/* now we can start servicing requests */
-	dstate_init(progname, upsname);
-
-	/* The poll_interval may have been changed from the default */
-	dstate_setinfo("driver.parameter.pollinterval", "%d", poll_interval);
-
-	/* The synchronous option may have been changed from the default */
-	dstate_setinfo("driver.parameter.synchronous", "%s",
-		(do_synchronous==1)?"yes":"no");
-
-	/* remap the device.* info from ups.* for the transition period */
-	if (dstate_getinfo("ups.mfr") != NULL)
-		dstate_setinfo("device.mfr", "%s", dstate_getinfo("ups.mfr"));
-	if (dstate_getinfo("ups.model") != NULL)
-		dstate_setinfo("device.model", "%s", dstate_getinfo("ups.model"));
-	if (dstate_getinfo("ups.serial") != NULL)
-		dstate_setinfo("device.serial", "%s", dstate_getinfo("ups.serial"));
+	device_select(0);
 
 	if (nut_debug_level == 0) {
 		background();
@@ -705,7 +961,23 @@ int main(int argc, char **argv)
 		gettimeofday(&timeout, NULL);
 		timeout.tv_sec += poll_interval;
 
-		upsdrv_updateinfo();
+		for (i = 0; (i < ndevices) && !exit_flag; i++) {
+			if ((i > 0) && !devices[i].ready) {
+				if (time(NULL) >= devices[i].retry)
+					device_init(i);
+
+				continue;
+			}
+
+			device_select(i);
+			upsdrv_updateinfo();
+
+			if (timerisset(&next_wakeup) && timercmp(&next_wakeup, &timeout, <)) {
+				timeout = next_wakeup;
+			}
+
+			timerclear(&next_wakeup);
+		}
 
 		while (!dstate_poll_fds(timeout, extrafd) && !exit_flag) {
 			/* repeat until time is up or extrafd has data */
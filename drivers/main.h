@@ -11,6 +11,7 @@ extern const char	*progname, *upsname, *device_name;
 extern char		*device_path;
 extern int		upsfd, extrafd, broken_driver, experimental_driver, do_lock_port, exit_flag;
 extern unsigned int	poll_interval;
+extern struct timeval	next_wakeup;
 
 /* functions & variables required in each driver */
 void upsdrv_initups(void);	/* open connection to UPS, fail if not found */
@@ -21,6 +22,22 @@ void upsdrv_help(void);		/* tack on anything useful for the -h text */
 void upsdrv_banner(void);	/* print your version information */
 void upsdrv_cleanup(void);	/* free any resources before shutdown */
 
+/* drivers which can serve several devices from one process (see the
+ * collector setting in ups.conf) set upsdrv_select in upsdrv_makevartable;
+ * main then calls it to switch the driver to device <num> (0 being the
+ * -a one, up to ndevices - 1) before calling the upsdrv_* functions and
+ * the handlers for that device */
+extern int	ndevices;
+extern void	(*upsdrv_select)(int num);
+
+/* for those drivers: call this instead of fatalx() when upsdrv_initups()
+ * can't reach or recognize the device, and return.  For a device other
+ * than the first one, main only logs the message, marks the device stale
+ * and calls upsdrv_initups() again later.  For the first one, this exits
+ * like fatalx(). */
+void device_init_failed(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+
 /* --- details for the variable/value sharing --- */
 
 /* main calls this driver function - it needs to call addvar */
@@ -130,16 +130,20 @@ static time_t	lastpoll;	/* Timestamp the last polling */
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
+/* Distinct commands used by the items of qx2nut to poll the UPS, so that each one is sent at most once per walk, however the items are ordered */
 static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
-	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
+	const char	*command;	/* Command sent to the UPS to get answer */
+	bool_t		sent;		/* Whether the command has already been sent in the ongoing walk */
+	char		answer[SMALLBUF];	/* Answer from the UPS in the ongoing walk, empty if none (or unusable) */
+} *queries = NULL;
+static int	*item_query = NULL;	/* Index in queries of the command of each item of qx2nut, -1 if it doesn't poll the UPS */
 
 
 /* == Support functions == */
 static int	subdriver_matcher(void);
 static int	qx_command(const char *cmd, char *buf, size_t buflen);
 static int	qx_process_answer(item_t *item, const int len);
+static void	qx_group_queries(void);
 static bool_t	qx_ups_walk(walkmode_t mode);
 static void	ups_status_set(void);
 static void	ups_alarm_set(void);
@@ -1671,6 +1675,9 @@ void	upsdrv_initinfo(void)
 
 	dstate_setinfo("driver.version.data", "%s", subdriver->name);
 
+	/* Find out which items share the same query */
+	qx_group_queries();
+
 	/* Initialise data */
 	if (qx_ups_walk(QX_WALKMODE_INIT) == FALSE) {
 		fatalx(EXIT_FAILURE, "Can't initialise data from the UPS");
@@ -2011,6 +2018,9 @@ void	upsdrv_cleanup(void)
 
 #endif	/* TESTING */
 
+	free(queries);
+	free(item_query);
+
 }
 
 
@@ -2346,11 +2356,46 @@ static void	qx_set_var(item_t *item)
 	}
 }
 
+/* Group the items of the qx2nut array that poll the UPS by command, so that qx_ups_walk() can send each distinct command only once per walk and hand its answer to all the items that need it. */
+static void	qx_group_queries(void)
+{
+	item_t	*item;
+	int	i, j, nitems, nqueries = 0;
+
+	for (nitems = 0; subdriver->qx2nut[nitems].info_type != NULL; nitems++);
+
+	queries = xcalloc(nitems + 1, sizeof(*queries));
+	item_query = xcalloc(nitems + 1, sizeof(*item_query));
+
+	for (i = 0; i < nitems; i++) {
+
+		item = &subdriver->qx2nut[i];
+		item_query[i] = -1;
+
+		/* These don't poll the UPS */
+		if (!item->command || (item->qxflags & (QX_FLAG_ABSENT | QX_FLAG_CMD | QX_FLAG_SETVAR)))
+			continue;
+
+		for (j = 0; j < nqueries; j++) {
+			if (!strcasecmp(queries[j].command, item->command))
+				break;
+		}
+
+		if (j == nqueries)
+			queries[nqueries++].command = item->command;
+
+		item_query[i] = j;
+
+	}
+
+	upsdebugx(2, "%s: %d items, %d distinct queries", __func__, nitems, nqueries);
+}
+
 /* Walk UPS variables and set elements of the qx2nut array. */
 static bool_t	qx_ups_walk(walkmode_t mode)
 {
 	item_t	*item;
-	int	retcode;
+	int	retcode, query;
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -2358,9 +2403,11 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		batt.chrg.act = -1;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* Forget the answers of the previous walk */
+	for (query = 0; queries[query].command != NULL; query++) {
+		queries[query].sent = FALSE;
+		memset(queries[query].answer, 0, sizeof(queries[query].answer));
+	}
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE and QX_WALKMODE_FULL_UPDATE */
 
@@ -2448,24 +2495,34 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0 && strlen(previous_item.answer) > 0 && !strcasecmp(previous_item.command, item->command)) {
+		query = item_query[item - subdriver->qx2nut];
 
-			snprintf(item->answer, sizeof(item->answer), "%s", previous_item.answer);
+		/* Check whether an item already sent the same command in this walk and then use its answer, if available.. */
+		if (query >= 0 && strlen(queries[query].answer) > 0) {
+
+			snprintf(item->answer, sizeof(item->answer), "%s", queries[query].answer);
 
 			/* Process the answer */
 			retcode = qx_process_answer(item, strlen(item->answer));
 
+		/* ..or, if there was no (usable) answer, don't wait for it again until the next walk (but try again while initialising).. */
+		} else if (query >= 0 && queries[query].sent && mode != QX_WALKMODE_INIT) {
+
+			upsdebugx(2, "%s: no answer to %s in this walk (%s)", __func__, queries[query].command, item->info_type);
+			retcode = -1;
+
 		/* ..otherwise: execute command to get answer from the UPS */
 		} else {
 
 			retcode = qx_process(item, NULL);
 
-		}
+			/* Keep the answer for the other items using this command */
+			if (query >= 0) {
+				queries[query].sent = TRUE;
+				snprintf(queries[query].answer, sizeof(queries[query].answer), "%s", item->answer);
+			}
 
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s", item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s", item->answer);
+		}
 
 		if (retcode) {
 
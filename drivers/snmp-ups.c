@@ -31,12 +31,16 @@
  */
 
 #include <limits.h>
+#include <poll.h>
 
 /* NUT SNMP common functions */
 #include "main.h"
 #include "snmp-ups.h"
 #include "parseconf.h"
 
+#include <net-snmp/library/large_fd_set.h>
+#include <net-snmp/library/snmp_transport.h>
+
 /* include all known mib2nut lookup tables */
 #include "apc-mib.h"
 #include "mge-mib.h"
@@ -125,12 +129,133 @@ time_t lastpoll = 0;
  * automatically guessed at the first pass */
 int outlet_index_base = -1;
 
+/* walk and errors counters */
+static unsigned long iterations = 0;
+static unsigned int numerr = 0;
+
+/* how many variables to ask for in one GET, see su_prefetch() */
+static int maxvarbinds = DEFAULT_MAXVARBINDS;
+
+/* how many rows to ask for in one GETBULK, see nut_snmp_walk() */
+static int maxrepetitions = DEFAULT_MAXREPETITIONS;
+
+/* how many requests may wait for their answer, see su_send() */
+static int maxinflight = DEFAULT_MAXINFLIGHT;
+
+/* a request sent by su_send() */
+typedef struct {
+	void	*sessp;		/* its session */
+	int	done;
+	int	status;		/* STAT_*, once done */
+	struct snmp_pdu	*response;
+} su_request_t;
+
+/* requests of all the devices still waiting for their answer */
+static int su_inflight = 0;
+
+/* nesting of su_wait(), which serves upsd while waiting */
+static int su_waiting = 0;
+
+/* values fetched ahead of a walk, in the order the walk needs them */
+typedef struct {
+	char	*OID;
+	int	skip;			/* rejected by the agent */
+	struct snmp_pdu	*pdu;	/* the answer, with this variable only */
+} su_cache_t;
+
+static su_cache_t	*su_cache = NULL;
+static int	su_cache_count = 0, su_cache_next = 0;
+
+/* when serving several devices (see upsdrv_select), the state above of
+ * those not being worked on is kept here */
+typedef struct {
+	struct snmp_session	sess, *sess_p;
+	const char	*OID_pwr_status;
+	int	pwr_battery, pollfreq;
+	int	input_phases, output_phases, bypass_phases;
+	int	maxvarbinds, maxrepetitions, maxinflight;
+	mib2nut_info_t	*mib2nut_info;
+	snmp_info_t	*snmp_info;
+	alarms_info_t	*alarms_info;
+	const char	*mibname, *mibvers;
+	time_t	lastpoll;
+	int	outlet_index_base;
+	unsigned long	iterations;
+	unsigned int	numerr;
+} su_device_t;
+
+static su_device_t	*su_devices = NULL;
+static int	su_current = 0;
+
 /* sysOID location */
 #define SYSOID_OID	".1.3.6.1.2.1.1.2.0"
 
 /* ---------------------------------------------
  * driver functions implementations
  * --------------------------------------------- */
+static void su_select(int num)
+{
+	su_device_t	*dev;
+	int	i;
+
+	if (!su_devices) {
+		su_devices = xcalloc(ndevices, sizeof(*su_devices));
+
+		for (i = 0; i < ndevices; i++) {
+			su_devices[i].outlet_index_base = -1;
+		}
+	}
+
+	/* put away the current device */
+	dev = &su_devices[su_current];
+
+	dev->sess = g_snmp_sess;
+	dev->sess_p = g_snmp_sess_p;
+	dev->OID_pwr_status = OID_pwr_status;
+	dev->pwr_battery = g_pwr_battery;
+	dev->pollfreq = pollfreq;
+	dev->input_phases = input_phases;
+	dev->output_phases = output_phases;
+	dev->bypass_phases = bypass_phases;
+	dev->maxvarbinds = maxvarbinds;
+	dev->maxrepetitions = maxrepetitions;
+	dev->maxinflight = maxinflight;
+	dev->mib2nut_info = mib2nut_info;
+	dev->snmp_info = snmp_info;
+	dev->alarms_info = alarms_info;
+	dev->mibname = mibname;
+	dev->mibvers = mibvers;
+	dev->lastpoll = lastpoll;
+	dev->outlet_index_base = outlet_index_base;
+	dev->iterations = iterations;
+	dev->numerr = numerr;
+
+	/* and bring back the requested one */
+	dev = &su_devices[num];
+	su_current = num;
+
+	g_snmp_sess = dev->sess;
+	g_snmp_sess_p = dev->sess_p;
+	OID_pwr_status = dev->OID_pwr_status;
+	g_pwr_battery = dev->pwr_battery;
+	pollfreq = dev->pollfreq;
+	input_phases = dev->input_phases;
+	output_phases = dev->output_phases;
+	bypass_phases = dev->bypass_phases;
+	maxvarbinds = dev->maxvarbinds;
+	maxrepetitions = dev->maxrepetitions;
+	maxinflight = dev->maxinflight;
+	mib2nut_info = dev->mib2nut_info;
+	snmp_info = dev->snmp_info;
+	alarms_info = dev->alarms_info;
+	mibname = dev->mibname;
+	mibvers = dev->mibvers;
+	lastpoll = dev->lastpoll;
+	outlet_index_base = dev->outlet_index_base;
+	iterations = dev->iterations;
+	numerr = dev->numerr;
+}
+
 void upsdrv_initinfo(void)
 {
 	snmp_info_t *su_info_p;
@@ -235,6 +360,9 @@ void upsdrv_makevartable(void)
 {
 	upsdebugx(1, "entering upsdrv_makevartable()");
 
+	/* several devices can be served by one snmp-ups */
+	upsdrv_select = su_select;
+
 	addvar(VAR_VALUE, SU_VAR_MIBS,
 		"Set MIB compliance (default=ietf, allowed: mge,apcc,netvision,pw,cpqpower,...)");
 	addvar(VAR_VALUE | VAR_SENSITIVE, SU_VAR_COMMUNITY,
@@ -247,6 +375,12 @@ void upsdrv_makevartable(void)
 		"Specifies the number of Net-SNMP retries to be used in the requests (default=5)");
 	addvar(VAR_VALUE, SU_VAR_TIMEOUT,
 		"Specifies the Net-SNMP timeout in seconds between retries (default=1)");
+	addvar(VAR_VALUE, SU_VAR_MAXVARBINDS,
+		"Set the maximum number of variables per SNMP GET request (default=20)");
+	addvar(VAR_VALUE, SU_VAR_MAXREPETITIONS,
+		"Set the maximum number of rows per SNMP GETBULK request (default=20)");
+	addvar(VAR_VALUE, SU_VAR_MAXINFLIGHT,
+		"Set the maximum number of SNMP requests waiting for an answer (default=4)");
 	addvar(VAR_FLAG, "notransferoids",
 		"Disable transfer OIDs (use on APCC Symmetras)");
 	addvar(VAR_VALUE, SU_VAR_SECLEVEL,
@@ -276,12 +410,16 @@ void upsdrv_initups(void)
 	mibs = testvar(SU_VAR_MIBS) ? getval(SU_VAR_MIBS) : "auto";
 
 	/* init SNMP library, etc... */
-	nut_snmp_init(progname, device_path);
+	if (!nut_snmp_init(progname, device_path))
+		return;
 
 	/* FIXME: first test if the device is reachable to avoid timeouts! */
 
 	/* Load the SNMP to NUT translation data */
-	load_mib2nut(mibs);
+	if (!load_mib2nut(mibs)) {
+		nut_snmp_cleanup();
+		return;
+	}
 
 	/* init polling frequency */
 	if (getval(SU_VAR_POLLFREQ))
@@ -289,6 +427,24 @@ void upsdrv_initups(void)
 	else
 		pollfreq = DEFAULT_POLLFREQ;
 
+	/* init the number of variables asked for at once */
+	if (getval(SU_VAR_MAXVARBINDS))
+		maxvarbinds = atoi(getval(SU_VAR_MAXVARBINDS));
+	else
+		maxvarbinds = DEFAULT_MAXVARBINDS;
+
+	/* init the number of rows asked for at once, when walking tables */
+	if (getval(SU_VAR_MAXREPETITIONS))
+		maxrepetitions = atoi(getval(SU_VAR_MAXREPETITIONS));
+	else
+		maxrepetitions = DEFAULT_MAXREPETITIONS;
+
+	/* init the number of requests sent without waiting for the answer */
+	if (getval(SU_VAR_MAXINFLIGHT))
+		maxinflight = atoi(getval(SU_VAR_MAXINFLIGHT));
+	else
+		maxinflight = DEFAULT_MAXINFLIGHT;
+
 	/* Get UPS Model node to see if there's a MIB */
 	su_info_p = su_find_info("ups.model");
 	status = nut_snmp_get_str(su_info_p->OID, model, sizeof(model), NULL);
@@ -296,9 +452,12 @@ void upsdrv_initups(void)
 	if (status == TRUE)
 		upslogx(0, "Detected %s on host %s (mib: %s %s)",
 			 model, device_path, mibname, mibvers);
-	else
-		fatalx(EXIT_FAILURE, "%s MIB wasn't found on %s", mibs, g_snmp_sess.peername);
+	else {
 		/* FIXME: "No supported device detected" */
+		device_init_failed("%s MIB wasn't found on %s", mibs, g_snmp_sess.peername);
+		nut_snmp_cleanup();
+		return;
+	}
 
 	if (su_find_info("load.off.delay")) {
 		/* Adds default with a delay value of '0' (= immediate) */
@@ -320,13 +479,20 @@ void upsdrv_initups(void)
 void upsdrv_cleanup(void)
 {
 	nut_snmp_cleanup();
+
+	/* see load_mib2nut() */
+	if (ndevices > 1) {
+		free(snmp_info);
+		snmp_info = NULL;
+	}
 }
 
 /* -----------------------------------------------------------
  * SNMP functions.
  * ----------------------------------------------------------- */
 
-void nut_snmp_init(const char *type, const char *hostname)
+/* returns FALSE if the session can't be opened */
+bool_t nut_snmp_init(const char *type, const char *hostname)
 {
 	char *ns_options = NULL;
 	const char *community, *version;
@@ -485,8 +651,11 @@ void nut_snmp_init(const char *type, const char *hostname)
 	g_snmp_sess_p = snmp_open(&g_snmp_sess);	/* establish the session */
 	if (g_snmp_sess_p == NULL) {
 		nut_snmp_perror(&g_snmp_sess, 0, NULL, "nut_snmp_init: snmp_open");
-		fatalx(EXIT_FAILURE, "Unable to establish communication");
+		device_init_failed("Unable to establish communication");
+		return FALSE;
 	}
+
+	return TRUE;
 }
 
 void nut_snmp_cleanup(void)
@@ -496,6 +665,15 @@ void nut_snmp_cleanup(void)
 		snmp_close(g_snmp_sess_p);
 		g_snmp_sess_p = NULL;
 	}
+
+	/* and what nut_snmp_init() allocated, before it is called again */
+	free(g_snmp_sess.peername);
+	g_snmp_sess.peername = NULL;
+	free(g_snmp_sess.community);
+	g_snmp_sess.community = NULL;
+	free(g_snmp_sess.securityName);
+	g_snmp_sess.securityName = NULL;
+
 	SOCK_CLEANUP; /* wrapper not needed on Unix! */
 }
 
@@ -514,19 +692,160 @@ void nut_snmp_free(struct snmp_pdu ** array_to_free)
 	free( array_to_free );
 }
 
-/* Return a NULL terminated array of snmp_pdu * */
+static int su_async_cb(int op, struct snmp_session *session, int reqid,
+	struct snmp_pdu *pdu, void *magic)
+{
+	su_request_t	*req = (su_request_t *)magic;
+
+	if (op == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+		req->status = STAT_SUCCESS;
+		req->response = snmp_clone_pdu(pdu);
+	} else if (op == NETSNMP_CALLBACK_OP_TIMED_OUT) {
+		req->status = STAT_TIMEOUT;
+	} else {
+		req->status = STAT_ERROR;
+	}
+
+	req->done = 1;
+	su_inflight--;
+
+	return 1;
+}
+
+/* send <pdu> without waiting for the answer, see su_wait().  Returns 0,
+ * leaving <pdu> to the caller, if it can't be sent that way now */
+static int su_send(struct snmp_pdu *pdu, su_request_t *req)
+{
+	memset(req, 0, sizeof(*req));
+
+	if (su_inflight >= maxinflight)
+		return 0;
+
+	req->sessp = snmp_sess_pointer(g_snmp_sess_p);
+
+	if (!snmp_sess_async_send(req->sessp, pdu, su_async_cb, req))
+		return 0;
+
+	su_inflight++;
+	return 1;
+}
+
+/* serve upsd (PING, SET, INSTCMD...) until <req> is answered or times out.
+ * The connection whose request got us here is read again afterwards */
+static void su_wait(su_request_t *req)
+{
+	netsnmp_large_fd_set	fds;
+	netsnmp_transport	*transport;
+	struct pollfd	pfd;
+	struct timeval	tv, deadline;
+	int	numfds, block;
+
+	su_waiting++;
+
+	/* the socket of the session, which goes beyond FD_SETSIZE when
+	 * serving many devices */
+	transport = snmp_sess_transport(req->sessp);
+	pfd.fd = transport ? transport->sock : -1;
+	pfd.events = POLLIN;
+
+	netsnmp_large_fd_set_init(&fds, FD_SETSIZE);
+
+	while (!req->done) {
+		numfds = 0;
+		block = 1;
+		NETSNMP_LARGE_FD_ZERO(&fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		/* when to retry */
+		snmp_sess_select_info2(req->sessp, &numfds, &fds, &tv, &block);
+
+		gettimeofday(&deadline, NULL);
+
+		if (block == 1) {
+			deadline.tv_sec += 1;
+		} else {
+			deadline.tv_sec += tv.tv_sec;
+			deadline.tv_usec += tv.tv_usec;
+
+			if (deadline.tv_usec >= 1000000) {
+				deadline.tv_sec++;
+				deadline.tv_usec -= 1000000;
+			}
+		}
+
+		dstate_poll_fds(deadline, pfd.fd);
+
+		if ((pfd.fd >= 0) && (poll(&pfd, 1, 0) > 0)) {
+			NETSNMP_LARGE_FD_ZERO(&fds);
+			NETSNMP_LARGE_FD_SET(pfd.fd, &fds);
+			snmp_sess_read2(req->sessp, &fds);
+		}
+
+		snmp_sess_timeout(req->sessp);
+	}
+
+	netsnmp_large_fd_set_cleanup(&fds);
+
+	su_waiting--;
+}
+
+/* same as snmp_synch_response(), but keeps serving upsd meanwhile */
+static int su_synch_response(struct snmp_pdu *pdu, struct snmp_pdu **response)
+{
+	su_request_t	req;
+
+	if (!su_send(pdu, &req))
+		return snmp_synch_response(g_snmp_sess_p, pdu, response);
+
+	su_wait(&req);
+
+	*response = req.response;
+	return req.status;
+}
+
+/* a response holding only <vp>, as if it had been asked for alone */
+static struct snmp_pdu *su_pdu_single(struct variable_list *vp)
+{
+	struct snmp_pdu *pdu;
+
+	pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	snmp_pdu_add_variable(pdu, vp->name, vp->name_length, vp->type,
+		vp->val.string, vp->val_len);
+
+	return pdu;
+}
+
+/* SNMPv2c exceptions, for a single variable */
+static bool_t su_is_exception(struct variable_list *vp)
+{
+	return ((vp->type == SNMP_NOSUCHOBJECT) || (vp->type == SNMP_NOSUCHINSTANCE) ||
+		(vp->type == SNMP_ENDOFMIBVIEW));
+}
+
+/* Return a NULL terminated array of snmp_pdu *
+ * The first element is <OID> itself, then come the ones after it, one
+ * per element, until <max_iteration> or an OID shorter than <OID>.  SNMPv1
+ * gets them with one GETNEXT each, later versions with GETBULK requests
+ * of up to snmp_maxrepetitions rows */
 struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 {
 	int status;
 	struct snmp_pdu *pdu, *response = NULL;
+	struct variable_list *vp;
 	oid name[MAX_OID_LEN];
 	size_t name_len = MAX_OID_LEN;
-	oid * current_name;
+	oid current_name[MAX_OID_LEN];
 	size_t current_name_len;
-	static unsigned int numerr = 0;
-	int nb_iteration = 0;
+	int nb_iteration = 0, nb_alloc = 0;
 	struct snmp_pdu ** ret_array = NULL;
 	int type = SNMP_MSG_GET;
+	bool_t done = FALSE;
 
 	upsdebugx(3, "nut_snmp_walk(%s)", OID);
 
@@ -537,10 +856,10 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 		return NULL;
 	}
 
-	current_name = name;
+	memcpy(current_name, name, name_len * sizeof(oid));
 	current_name_len = name_len;
 
-	while( nb_iteration < max_iteration ) {
+	while( !done && (nb_iteration < max_iteration) ) {
 		/* Going to a shorter OID means we are outside our sub-tree */
 		if( current_name_len < name_len ) {
 			break;
@@ -552,9 +871,15 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			fatalx(EXIT_FAILURE, "Not enough memory");
 		}
 
+		if (type == SNMP_MSG_GETBULK) {
+			pdu->non_repeaters = 0;
+			pdu->max_repetitions = (max_iteration - nb_iteration < maxrepetitions) ?
+				max_iteration - nb_iteration : maxrepetitions;
+		}
+
 		snmp_add_null_var(pdu, current_name, current_name_len);
 
-		status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+		status = su_synch_response(pdu, &response);
 
 		if (!response) {
 			break;
@@ -564,6 +889,8 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			if (mibname == NULL) {
 				/* We are probing for proper mib - ignore errors */
 				snmp_free_pdu(response);
+				if (ret_array)
+					nut_snmp_free(ret_array);
 				return NULL;
 			}
 
@@ -576,7 +903,7 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			}
 
 			if ((numerr < SU_ERR_LIMIT) || ((numerr % SU_ERR_RATE) == 0)) {
-				if (type == SNMP_MSG_GETNEXT) {
+				if (type != SNMP_MSG_GET) {
 					upsdebugx(2, "=> No more OID, walk complete");
 				}
 				else {
@@ -591,21 +918,327 @@ struct snmp_pdu **nut_snmp_walk(const char *OID, int max_iteration)
 			numerr = 0;
 		}
 
-		nb_iteration++;
-		/* +1 is for the terminating NULL */
-		ret_array = realloc(ret_array,sizeof(struct snmp_pdu*)*(nb_iteration+1));
-		ret_array[nb_iteration-1] = response;
-		ret_array[nb_iteration]=NULL;
+		for (vp = response->variables; vp; vp = vp->next_variable) {
+			if ((nb_iteration >= max_iteration) || (vp->name_length < name_len) ||
+				((type != SNMP_MSG_GET) && su_is_exception(vp))) {
+				done = TRUE;
+				break;
+			}
+
+			/* +1 is for the terminating NULL */
+			if (nb_iteration + 1 >= nb_alloc) {
+				nb_alloc = (nb_alloc == 0) ? 16 : nb_alloc * 2;
+				ret_array = xrealloc(ret_array, sizeof(struct snmp_pdu*) * nb_alloc);
+			}
+
+			/* keep one variable per element, as callers expect */
+			ret_array[nb_iteration++] = (response->variables->next_variable == NULL) ?
+				response : su_pdu_single(vp);
+			ret_array[nb_iteration] = NULL;
+
+			memcpy(current_name, vp->name, vp->name_length * sizeof(oid));
+			current_name_len = vp->name_length;
+		}
 
-		current_name = response->variables->name;
-		current_name_len = response->variables->name_length;
+		/* all of it was copied, or it was stored as is */
+		if ((nb_iteration == 0) || (ret_array[nb_iteration - 1] != response)) {
+			snmp_free_pdu(response);
+		}
 
-		type = SNMP_MSG_GETNEXT;
+		type = ((g_snmp_sess_p->version == SNMP_VERSION_1) || (maxrepetitions < 2)) ?
+			SNMP_MSG_GETNEXT : SNMP_MSG_GETBULK;
 	}
 
 	return ret_array;
 }
 
+/* a request for the values of the cache entries from <first> on, <count>
+ * at most; <map> gets the cache entry of each variable, and <n> their
+ * number.  NULL if there is nothing (left) to ask for */
+static struct snmp_pdu *su_cache_request(int first, int count, int *map, int *n)
+{
+	struct snmp_pdu *pdu;
+	oid name[MAX_OID_LEN];
+	size_t name_len;
+	int i;
+
+	pdu = snmp_pdu_create(SNMP_MSG_GET);
+
+	if (pdu == NULL) {
+		fatalx(EXIT_FAILURE, "Not enough memory");
+	}
+
+	for (i = first, *n = 0; i < first + count; i++) {
+		if (su_cache[i].skip || su_cache[i].pdu)
+			continue;
+
+		name_len = MAX_OID_LEN;
+
+		if (!snmp_parse_oid(su_cache[i].OID, name, &name_len)) {
+			su_cache[i].skip = 1;
+			continue;
+		}
+
+		snmp_add_null_var(pdu, name, name_len);
+		map[(*n)++] = i;
+	}
+
+	if (*n == 0) {
+		snmp_free_pdu(pdu);
+		return NULL;
+	}
+
+	upsdebugx(3, "su_cache_request: %d variables from %s", *n, su_cache[map[0]].OID);
+
+	return pdu;
+}
+
+/* store the values of a successful su_cache_request() */
+static void su_cache_answer(struct snmp_pdu *response, const int *map, int n)
+{
+	struct variable_list *vp;
+	int i;
+
+	for (vp = response->variables, i = 0; vp && (i < n); vp = vp->next_variable, i++) {
+
+		if (su_is_exception(vp)) {
+			continue;
+		}
+
+		su_cache[map[i]].pdu = su_pdu_single(vp);
+	}
+}
+
+/* fetch the values of the cache entries from <first> on, <count> at most
+ * in a single request.  Anything that fails is left for nut_snmp_get() to
+ * ask for again, and to report */
+static void su_cache_fetch(int first, int count)
+{
+	struct snmp_pdu *pdu, *response = NULL;
+	int *map, i, n, status;
+
+	/* map[n]: the cache entry of the n-th variable of the request */
+	map = xcalloc(count, sizeof(*map));
+
+	while (1) {
+		pdu = su_cache_request(first, count, map, &n);
+
+		if (pdu == NULL) {
+			free(map);
+			return;
+		}
+
+		status = su_synch_response(pdu, &response);
+
+		if ((status != STAT_SUCCESS) || !response) {
+			if (response)
+				snmp_free_pdu(response);
+			free(map);
+			return;
+		}
+
+		if (response->errstat == SNMP_ERR_NOERROR)
+			break;
+
+		/* the agent can't answer that many at once: split */
+		if ((response->errstat == SNMP_ERR_TOOBIG) && (n > 1)) {
+			snmp_free_pdu(response);
+			i = map[n / 2];
+			free(map);
+			su_cache_fetch(first, i - first);
+			su_cache_fetch(i, first + count - i);
+			return;
+		}
+
+		/* SNMPv1 rejects the whole request for one bad variable:
+		 * leave that one out, and try again with the others */
+		if ((response->errindex < 1) || (response->errindex > n)) {
+			snmp_free_pdu(response);
+			free(map);
+			return;
+		}
+
+		upsdebugx(3, "su_cache_fetch: %s rejected", su_cache[map[response->errindex - 1]].OID);
+		su_cache[map[response->errindex - 1]].skip = 1;
+		snmp_free_pdu(response);
+	}
+
+	su_cache_answer(response, map, n);
+
+	snmp_free_pdu(response);
+	free(map);
+}
+
+static void su_cache_add(const char *OID)
+{
+	if ((su_cache_count % 64) == 0) {
+		su_cache = xrealloc(su_cache, (su_cache_count + 64) * sizeof(*su_cache));
+	}
+
+	su_cache[su_cache_count].OID = xstrdup(OID);
+	su_cache[su_cache_count].skip = 0;
+	su_cache[su_cache_count].pdu = NULL;
+	su_cache_count++;
+}
+
+static void su_cache_free(void)
+{
+	int	i;
+
+	/* still in use by the walk waiting below, see su_prefetch() */
+	if (su_waiting > 0)
+		return;
+
+	for (i = 0; i < su_cache_count; i++) {
+		free(su_cache[i].OID);
+
+		if (su_cache[i].pdu)
+			snmp_free_pdu(su_cache[i].pdu);
+	}
+
+	free(su_cache);
+	su_cache = NULL;
+	su_cache_count = 0;
+	su_cache_next = 0;
+}
+
+/* a copy of the prefetched answer for <OID>, if any */
+static struct snmp_pdu *su_cache_get(const char *OID)
+{
+	int	i, n;
+
+	/* the walk asks in the same order as su_prefetch(): start after
+	 * the previous hit */
+	for (n = 0; n < su_cache_count; n++) {
+		i = (su_cache_next + n) % su_cache_count;
+
+		if (strcmp(su_cache[i].OID, OID))
+			continue;
+
+		su_cache_next = i + 1;
+
+		if (!su_cache[i].pdu)
+			return NULL;
+
+		return snmp_clone_pdu(su_cache[i].pdu);
+	}
+
+	return NULL;
+}
+
+/* will snmp_ups_walk() read this element? (only the simple cases,
+ * what is missed here is simply fetched on its own) */
+static bool_t su_prefetchable(int mode, snmp_info_t *su_info_p)
+{
+	if ((SU_TYPE(su_info_p) == SU_TYPE_CMD) || (su_info_p->OID == NULL))
+		return FALSE;
+
+	if (!(su_info_p->flags & SU_FLAG_OK) || (su_info_p->flags & SU_FLAG_ABSENT))
+		return FALSE;
+
+	if ((mode == SU_WALKMODE_UPDATE) && (su_info_p->flags & SU_FLAG_STATIC))
+		return FALSE;
+
+	if ((su_info_p->flags & SU_FLAG_STALE) && ((iterations % SU_STALE_RETRY) != 0))
+		return FALSE;
+
+	/* depends on the number of phases, which may not be known yet */
+	if (su_info_p->flags & SU_PHASES)
+		return FALSE;
+
+	return TRUE;
+}
+
+/* get the values a walk is about to read, several at a time, instead of
+ * doing a round trip for each of them */
+static void su_prefetch(int mode)
+{
+	snmp_info_t *su_info_p;
+	char OID[SU_INFOSIZE];
+	const char *count;
+	struct snmp_pdu *pdu;
+	su_request_t *reqs;
+	int *map, n[64], sent[64];
+	int i, k, base, first, window;
+
+	/* useless one variable at a time.  Not while a walk waits for its
+	 * answers either: the requests served meanwhile (maybe for another
+	 * device) neither use nor change that walk's cache */
+	if ((maxvarbinds < 2) || (su_waiting > 0))
+		return;
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
+
+		if (!su_prefetchable(mode, su_info_p))
+			continue;
+
+		if (!(su_info_p->flags & SU_OUTLET)) {
+			su_cache_add(su_info_p->OID);
+			continue;
+		}
+
+		/* outlets, once the first walk has found how they are numbered */
+		count = dstate_getinfo("outlet.count");
+
+		if ((outlet_index_base == -1) || (count == NULL))
+			continue;
+
+		base = outlet_index_base;
+
+		for (i = base; i < base + atoi(count); i++) {
+			snprintf(OID, sizeof(OID), su_info_p->OID, i);
+			su_cache_add(OID);
+		}
+	}
+
+	/* send up to snmp_maxinflight requests before waiting for the answers */
+	window = (maxinflight > 64) ? 64 : (maxinflight > 1) ? maxinflight : 1;
+	reqs = xcalloc(window, sizeof(*reqs));
+	map = xcalloc(window * maxvarbinds, sizeof(*map));
+
+	for (i = 0; i < su_cache_count; i += window * maxvarbinds) {
+
+		for (k = 0; k < window; k++) {
+			first = i + k * maxvarbinds;
+			pdu = (first < su_cache_count) ?
+				su_cache_request(first, maxvarbinds, &map[k * maxvarbinds], &n[k]) : NULL;
+			sent[k] = (pdu != NULL) && su_send(pdu, &reqs[k]);
+
+			if ((pdu != NULL) && !sent[k])
+				snmp_free_pdu(pdu);
+		}
+
+		for (k = 0; k < window; k++) {
+			first = i + k * maxvarbinds;
+
+			if (first >= su_cache_count)
+				break;
+
+			if (sent[k])
+				su_wait(&reqs[k]);
+
+			if (sent[k] && (reqs[k].status == STAT_SUCCESS) && reqs[k].response &&
+				(reqs[k].response->errstat == SNMP_ERR_NOERROR)) {
+				su_cache_answer(reqs[k].response, &map[k * maxvarbinds], n[k]);
+			} else {
+				/* one at a time, dealing with the errors */
+				su_cache_fetch(first, (su_cache_count - first < maxvarbinds) ?
+					su_cache_count - first : maxvarbinds);
+			}
+
+			if (reqs[k].response) {
+				snmp_free_pdu(reqs[k].response);
+				reqs[k].response = NULL;
+			}
+		}
+	}
+
+	free(reqs);
+	free(map);
+
+	upsdebugx(2, "su_prefetch: %d variables", su_cache_count);
+}
+
 struct snmp_pdu *nut_snmp_get(const char *OID)
 {
 	struct snmp_pdu ** pdu_array;
@@ -616,6 +1249,14 @@ struct snmp_pdu *nut_snmp_get(const char *OID)
 
 	upsdebugx(3, "nut_snmp_get(%s)", OID);
 
+	/* not for SET and INSTCMD handled in the middle of a walk, see su_wait() */
+	if ((su_cache_count > 0) && (su_waiting == 0)) {
+		ret_pdu = su_cache_get(OID);
+
+		if (ret_pdu != NULL)
+			return ret_pdu;
+	}
+
 	pdu_array = nut_snmp_walk(OID,1);
 
 	if(pdu_array == NULL) {
@@ -767,7 +1408,7 @@ bool_t nut_snmp_set(const char *OID, char type, const char *value)
 		return FALSE;
 	}
 
-	status = snmp_synch_response(g_snmp_sess_p, pdu, &response);
+	status = su_synch_response(pdu, &response);
 
 	if ((status == STAT_SUCCESS) && (response->errstat == SNMP_ERR_NOERROR))
 		ret = TRUE;
@@ -1027,7 +1668,18 @@ bool_t load_mib2nut(const char *mib)
 	/* Store the result, if any */
 	if (m2n != NULL)
 	{
+		mib2nut_info = m2n;
 		snmp_info = m2n->snmp_info;
+
+		/* when serving several devices, only the table is shared: each
+		 * device gets its own copy of the entries, as their flags change */
+		if (ndevices > 1) {
+			for (i = 0; snmp_info[i].info_type != NULL; i++);
+
+			snmp_info = xmalloc((i + 1) * sizeof(*snmp_info));
+			memcpy(snmp_info, m2n->snmp_info, (i + 1) * sizeof(*snmp_info));
+		}
+
 		OID_pwr_status = m2n->oid_pwr_status;
 		mibname = m2n->mib_name;
 		mibvers = m2n->mib_version;
@@ -1038,10 +1690,12 @@ bool_t load_mib2nut(const char *mib)
 
 	/* Did we find something or is it really an unknown mib */
 	if (strcmp(mib, "auto") != 0) {
-		fatalx(EXIT_FAILURE, "Unknown mibs value: %s", mib);
+		device_init_failed("Unknown mibs value: %s", mib);
 	} else {
-		fatalx(EXIT_FAILURE, "No supported device detected");
+		device_init_failed("No supported device detected");
 	}
+
+	return FALSE;
 }
 
 /* find the OID value matching that INFO_* value */
@@ -1175,19 +1829,58 @@ static int guestimate_outlet_count(const char *OID_template)
 {
 	int base_index = 0;
 	char test_OID[SU_INFOSIZE];
-	int base_count;
+	int base_count = 0;
+	struct snmp_pdu ** pdu_array;
+	struct variable_list *vp;
+	oid name[MAX_OID_LEN];
+	size_t name_len;
+	int i, chunk;
+	size_t len = strlen(OID_template);
 
 	upsdebugx(1, "guestimate_outlet_count(%s)", OID_template);
 
+	/* without GETBULK, a walk would go on past the last outlet.  And
+	 * when the index isn't the last sub-identifier (e.g. "...%i.1.0"),
+	 * the next outlet doesn't follow the current one in the walk */
+	if ((g_snmp_sess_p->version == SNMP_VERSION_1) || (maxrepetitions < 2) ||
+		(len < 2) || strcmp(OID_template + len - 2, "%i"))
+		chunk = 1;
+	else
+		chunk = maxrepetitions + 1;
+
 	/* Determine if OID index starts from 0 or 1? */
 	sprintf(test_OID, OID_template, base_index);
-	if (nut_snmp_get(test_OID) == NULL)
+	pdu_array = nut_snmp_walk(test_OID, 1);
+	if (pdu_array == NULL)
 		base_index++;
+	else
+		nut_snmp_free(pdu_array);
 
-	/* Now, actually iterate */
-	for (base_count = 0 ;  ; base_count++) {
+	/* Now, actually iterate: each walk gets the next outlet, and the ones
+	 * after it as long as they follow each other.  Agents may return fewer
+	 * rows than asked for, so only stop once the next outlet is missing */
+	while (1) {
 		sprintf(test_OID, OID_template, base_index + base_count);
-		if (nut_snmp_get(test_OID) == NULL)
+		pdu_array = nut_snmp_walk(test_OID, chunk);
+		if (pdu_array == NULL)
+			break;
+
+		for (i = 0; pdu_array[i] != NULL; i++) {
+			vp = pdu_array[i]->variables;
+			sprintf(test_OID, OID_template, base_index + base_count);
+			name_len = MAX_OID_LEN;
+
+			if (!snmp_parse_oid(test_OID, name, &name_len) ||
+				snmp_oid_compare(vp->name, vp->name_length, name, name_len) ||
+				su_is_exception(vp))
+				break;
+
+			base_count++;
+		}
+
+		nut_snmp_free(pdu_array);
+
+		if (i == 0)
 			break;
 	}
 
@@ -1237,15 +1930,18 @@ bool_t get_and_process_data(int mode, snmp_info_t *su_info_p)
 /* walk ups variables and set elements of the info array. */
 bool_t snmp_ups_walk(int mode)
 {
-	static unsigned long iterations = 0;
 	snmp_info_t *su_info_p;
 	bool_t status = FALSE;
 
+	su_prefetch(mode);
+
 	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL ; su_info_p++) {
 
 		/* Check if we are asked to stop (reactivity++) */
-		if (exit_flag != 0)
+		if (exit_flag != 0) {
+			su_cache_free();
 			return TRUE;
+		}
 
 		/* skip instcmd, not linked to outlets */
 		if ((SU_TYPE(su_info_p) == SU_TYPE_CMD)
@@ -1446,6 +2142,8 @@ bool_t snmp_ups_walk(int mode)
 		}
 	}	/* for (su_info_p... */
 
+	su_cache_free();
+
 	iterations++;
 
 	return status;
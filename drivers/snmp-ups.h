@@ -80,6 +80,9 @@ for each OID request we made), instead of sending many small packets
 
 /* Parameters default values */
 #define DEFAULT_POLLFREQ	30		/* in seconds */
+#define DEFAULT_MAXVARBINDS	20		/* variables per GET request */
+#define DEFAULT_MAXREPETITIONS	20		/* rows per GETBULK request */
+#define DEFAULT_MAXINFLIGHT	4		/* requests waiting for an answer */
 
 /* use explicit booleans */
 #ifndef FALSE
@@ -178,6 +181,9 @@ typedef struct {
 #define SU_VAR_TIMEOUT		"snmp_timeout"
 #define SU_VAR_MIBS			"mibs"
 #define SU_VAR_POLLFREQ		"pollfreq"
+#define SU_VAR_MAXVARBINDS	"snmp_maxvarbinds"
+#define SU_VAR_MAXREPETITIONS	"snmp_maxrepetitions"
+#define SU_VAR_MAXINFLIGHT	"snmp_maxinflight"
 /* SNMP v3 related parameters */
 #define SU_VAR_SECLEVEL		"secLevel"
 #define SU_VAR_SECNAME		"secName"
@@ -219,7 +225,7 @@ typedef struct {
 } mib2nut_info_t;
 
 /* Common SNMP functions */
-void nut_snmp_init(const char *type, const char *hostname);
+bool_t nut_snmp_init(const char *type, const char *hostname);
 void nut_snmp_cleanup(void);
 struct snmp_pdu *nut_snmp_get(const char *OID);
 bool_t nut_snmp_get_str(const char *OID, char *buf, size_t buf_len,
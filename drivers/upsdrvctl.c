@@ -33,6 +33,7 @@ typedef struct {
 	char	*upsname;
 	char	*driver;
 	char	*port;
+	char	*collector;	/* section whose driver serves this one */
 	int	sdorder;
 	int	maxstartdelay;
 	void	*next;
@@ -51,6 +52,9 @@ static int	maxretry = 1;
 	/* timer - delay between each restart attempt of the driver(s) */
 static int	retrydelay = 5;
 
+	/* counter - how many drivers "start" may launch at the same time */
+static int	maxparallel = 1;
+
 	/* Directory where driver executables live */
 static char	*driverpath = NULL;
 
@@ -77,6 +81,9 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 		if (!strcmp(var, "retrydelay"))
 			retrydelay = atoi(val);
 
+		if (!strcmp(var, "maxparallel"))
+			maxparallel = atoi(val);
+
 		/* ignore anything else - it's probably for main */
 
 		return;
@@ -97,6 +104,9 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 			if (!strcmp(var, "maxstartdelay"))
 				tmp->maxstartdelay = atoi(val);
 
+			if (!strcmp(var, "collector"))
+				tmp->collector = xstrdup(val);
+
 			if (!strcmp(var, "sdorder")) {
 				tmp->sdorder = atoi(val);
 
@@ -114,6 +124,7 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 	tmp->upsname = xstrdup(upsname);
 	tmp->driver = NULL;
 	tmp->port = NULL;
+	tmp->collector = NULL;
 	tmp->next = NULL;
 	tmp->sdorder = 0;
 	tmp->maxstartdelay = -1;	/* use global value by default */
@@ -124,6 +135,9 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 	if (!strcmp(var, "port"))
 		tmp->port = xstrdup(val);
 
+	if (!strcmp(var, "collector"))
+		tmp->collector = xstrdup(val);
+
 	if (last)
 		last->next = tmp;
 	else
@@ -189,9 +203,43 @@ static void debugcmdline(int level, const char *msg, char *const argv[])
 	upsdebugx(level, "%s", cmdline);
 }
 
-static void forkexec(char *const argv[], const ups_t *ups)
+/* check how a driver (or its startup part) ended, 0 if it went well */
+static int check_wstat(int wstat)
+{
+	if (WIFEXITED(wstat) == 0) {
+		upslogx(LOG_WARNING, "Driver exited abnormally");
+		return -1;
+	}
+
+	if (WEXITSTATUS(wstat) != 0) {
+		upslogx(LOG_WARNING, "Driver failed to start"
+		" (exit status=%d)", WEXITSTATUS(wstat));
+		return -1;
+	}
+
+	/* the rest only work when WIFEXITED is nonzero */
+
+	if (WIFSIGNALED(wstat)) {
+		upslog_with_errno(LOG_WARNING, "Driver died after signal %d",
+			WTERMSIG(wstat));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void set_alarm_handler(void)
+{
+	struct sigaction	sa;
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = waitpid_timeout;
+	sigaction(SIGALRM, &sa, NULL);
+}
+
+static pid_t forkexec_nowait(char *const argv[])
 {
-	int	ret;
 	pid_t	pid;
 
 	pid = fork();
@@ -199,73 +247,56 @@ static void forkexec(char *const argv[], const ups_t *ups)
 	if (pid < 0)
 		fatal_with_errno(EXIT_FAILURE, "fork");
 
-	if (pid != 0) {			/* parent */
-		int	wstat;
-		struct sigaction	sa;
+	if (pid != 0)			/* parent */
+		return pid;
 
-		sigemptyset(&sa.sa_mask);
-		sa.sa_flags = 0;
-		sa.sa_handler = waitpid_timeout;
-		sigaction(SIGALRM, &sa, NULL);
+	/* child */
 
-		if (ups->maxstartdelay != -1)
-			alarm(ups->maxstartdelay);
-		else
-			alarm(maxstartdelay);
+	execv(argv[0], argv);
 
-		ret = waitpid(pid, &wstat, 0);
+	/* shouldn't get here */
+	fatal_with_errno(EXIT_FAILURE, "execv");
+}
 
-		alarm(0);
+static int startdelay(const ups_t *ups)
+{
+	if (ups->maxstartdelay != -1)
+		return ups->maxstartdelay;
 
-		if (ret == -1) {
-			upslogx(LOG_WARNING, "Startup timer elapsed, continuing...");
-			exec_error++;
-			return;
-		}
+	return maxstartdelay;
+}
 
-		if (WIFEXITED(wstat) == 0) {
-			upslogx(LOG_WARNING, "Driver exited abnormally");
-			exec_error++;
-			return;
-		}
+static void forkexec(char *const argv[], const ups_t *ups)
+{
+	int	ret, wstat;
+	pid_t	pid;
 
-		if (WEXITSTATUS(wstat) != 0) {
-			upslogx(LOG_WARNING, "Driver failed to start"
-			" (exit status=%d)", WEXITSTATUS(wstat));
-			exec_error++;
-			return;
-		}
+	pid = forkexec_nowait(argv);
 
-		/* the rest only work when WIFEXITED is nonzero */
+	set_alarm_handler();
+	alarm(startdelay(ups));
 
-		if (WIFSIGNALED(wstat)) {
-			upslog_with_errno(LOG_WARNING, "Driver died after signal %d",
-				WTERMSIG(wstat));
-			exec_error++;
-		}
+	ret = waitpid(pid, &wstat, 0);
 
+	alarm(0);
+
+	if (ret == -1) {
+		upslogx(LOG_WARNING, "Startup timer elapsed, continuing...");
+		exec_error++;
 		return;
 	}
 
-	/* child */
-
-	ret = execv(argv[0], argv);
-
-	/* shouldn't get here */
-	fatal_with_errno(EXIT_FAILURE, "execv");
+	if (check_wstat(wstat) != 0)
+		exec_error++;
 }
 
-static void start_driver(const ups_t *ups)
+/* fill in argv (at least 8 entries) to start the driver for <ups> */
+static void start_argv(const ups_t *ups, char *argv[], char *dfn, size_t dfnlen)
 {
-	char	*argv[8];
-	char	dfn[SMALLBUF];
 	int	ret, arg = 0;
-	int	initial_exec_error = exec_error, drv_maxretry = maxretry;
 	struct stat	fs;
 
-	upsdebugx(1, "Starting UPS: %s", ups->upsname);
-
-	snprintf(dfn, sizeof(dfn), "%s/%s", driverpath, ups->driver);
+	snprintf(dfn, dfnlen, "%s/%s", driverpath, ups->driver);
 	ret = stat(dfn, &fs);
 
 	if (ret < 0)
@@ -288,7 +319,17 @@ static void start_driver(const ups_t *ups)
 
 	/* tie it off */
 	argv[arg++] = NULL;
+}
 
+static void start_driver(const ups_t *ups)
+{
+	char	*argv[8];
+	char	dfn[SMALLBUF];
+	int	initial_exec_error = exec_error, drv_maxretry = maxretry;
+
+	upsdebugx(1, "Starting UPS: %s", ups->upsname);
+
+	start_argv(ups, argv, dfn, sizeof(dfn));
 
 	while (drv_maxretry > 0) {
 		int cur_exec_error = exec_error;
@@ -314,6 +355,192 @@ static void start_driver(const ups_t *ups)
 	}
 }
 
+typedef struct {
+	const ups_t	*ups;
+	pid_t	pid;		/* 0 when not running */
+	int	tries;		/* attempts left */
+	time_t	when;		/* next attempt, or startup deadline while running */
+	int	done;
+}	startjob_t;
+
+/* an attempt failed, schedule the next one if any is left */
+static void start_failed(startjob_t *job, time_t now, int *left)
+{
+	job->pid = 0;
+
+	if (job->tries > 0) {
+		upslogx(LOG_WARNING, "Starting %s failed, retrying in %d seconds",
+			job->ups->upsname, retrydelay);
+		job->when = now + retrydelay;
+		return;
+	}
+
+	upslogx(LOG_WARNING, "Starting %s failed, giving up", job->ups->upsname);
+	job->done = 1;
+	(*left)--;
+	exec_error++;
+}
+
+/* a driver missed its startup deadline: stop it before it is tried again,
+ * so that two of them never fight over the same device. Returns 0 if it
+ * got started after all, just before it was stopped. */
+static int start_late(startjob_t *job)
+{
+	int	ret, wstat;
+
+	kill(job->pid, SIGTERM);
+
+	/* a driver only acts on SIGTERM once it is in its main loop */
+	alarm(5);
+	ret = waitpid(job->pid, &wstat, 0);
+	alarm(0);
+
+	if (ret != job->pid) {
+		upsdebugx(2, "%s ignored SIGTERM, killing it", job->ups->upsname);
+		kill(job->pid, SIGKILL);
+		ret = waitpid(job->pid, &wstat, 0);
+	}
+
+	if ((ret == job->pid) && WIFEXITED(wstat) && (WEXITSTATUS(wstat) == 0))
+		return 0;
+
+	return -1;
+}
+
+/* start all the drivers, up to maxparallel at a time; a driver that fails
+ * is retried on its own, without holding up the others */
+static void start_all_parallel(void)
+{
+	startjob_t	*jobs;
+	const ups_t	*ups;
+	char	*argv[8];
+	char	dfn[SMALLBUF];
+	int	count = 0, running = 0, left, i, ret, wstat;
+	time_t	now, next;
+
+	for (ups = upstable; ups; ups = ups->next)
+		count++;
+
+	jobs = xcalloc(count, sizeof(*jobs));
+
+	for (i = 0, ups = upstable; ups; ups = ups->next, i++) {
+		jobs[i].ups = ups;
+		jobs[i].tries = maxretry;
+
+		/* started along with its collector */
+		if (ups->collector) {
+			jobs[i].done = 1;
+		}
+	}
+
+	set_alarm_handler();
+
+	for (i = 0, left = 0; i < count; i++) {
+		if (!jobs[i].done)
+			left++;
+	}
+
+	while (left > 0) {
+		now = time(NULL);
+
+		/* fill the free slots, in ups.conf order */
+		for (i = 0; (i < count) && (running < maxparallel); i++) {
+			if (jobs[i].done || jobs[i].pid || (jobs[i].when > now))
+				continue;
+
+			upsdebugx(1, "Starting UPS: %s", jobs[i].ups->upsname);
+			upsdebugx(2, "%i remaining attempts", jobs[i].tries);
+
+			start_argv(jobs[i].ups, argv, dfn, sizeof(dfn));
+			debugcmdline(2, "exec: ", argv);
+			jobs[i].tries--;
+
+			if (testmode) {
+				jobs[i].done = 1;
+				left--;
+				continue;
+			}
+
+			jobs[i].pid = forkexec_nowait(argv);
+			jobs[i].when = now + startdelay(jobs[i].ups);
+			running++;
+		}
+
+		if (left == 0)
+			break;
+
+		/* sleep until a driver is done, or the next deadline or retry */
+		next = 0;
+
+		for (i = 0; i < count; i++) {
+			if (jobs[i].done)
+				continue;
+
+			/* nothing can start until a slot is free */
+			if (!jobs[i].pid && (running >= maxparallel))
+				continue;
+
+			if (!next || (jobs[i].when < next))
+				next = jobs[i].when;
+		}
+
+		if (running == 0) {
+			if (next > now)
+				sleep(next - now);
+			continue;
+		}
+
+		alarm((next > now) ? next - now : 1);
+
+		ret = waitpid(-1, &wstat, 0);
+
+		alarm(0);
+
+		now = time(NULL);
+
+		for (i = 0; (ret > 0) && (i < count); i++) {
+			if (jobs[i].pid != ret)
+				continue;
+
+			running--;
+
+			if (check_wstat(wstat) != 0) {
+				start_failed(&jobs[i], now, &left);
+				break;
+			}
+
+			upsdebugx(1, "Started UPS: %s", jobs[i].ups->upsname);
+			jobs[i].pid = 0;
+			jobs[i].done = 1;
+			left--;
+			break;
+		}
+
+		/* unlike the serial startup, the late ones are stopped first:
+		 * they would be retried while still starting */
+		for (i = 0; i < count; i++) {
+			if (!jobs[i].pid || (jobs[i].when > now))
+				continue;
+
+			upslogx(LOG_WARNING, "Startup timer elapsed for %s, stopping it...",
+				jobs[i].ups->upsname);
+			running--;
+
+			if (start_late(&jobs[i]) != 0) {
+				start_failed(&jobs[i], time(NULL), &left);
+				continue;
+			}
+
+			upsdebugx(1, "Started UPS: %s", jobs[i].ups->upsname);
+			jobs[i].pid = 0;
+			jobs[i].done = 1;
+			left--;
+		}
+	}
+
+	free(jobs);
+}
+
 static void help(const char *progname)
 {
 	printf("Starts and stops UPS drivers via ups.conf.\n\n");
@@ -372,12 +599,27 @@ static void shutdown_driver(const ups_t *ups)
 static void send_one_driver(void (*command)(const ups_t *), const char *upsname)
 {
 	ups_t	*ups = upstable;
+	const char	*member = NULL;
 
 	if (!ups)
 		fatalx(EXIT_FAILURE, "Error: no UPS definitions found in ups.conf!\n");
 
 	while (ups) {
 		if (!strcmp(ups->upsname, upsname)) {
+			/* the driver of its collector takes care of this one */
+			if (ups->collector && (command != &shutdown_driver)) {
+				if (member)
+					fatalx(EXIT_FAILURE, "UPS %s is the collector of %s, "
+						"so it can't have a collector itself", ups->upsname, member);
+
+				upslogx(LOG_NOTICE, "UPS %s is served by the driver of %s",
+					ups->upsname, ups->collector);
+				member = ups->upsname;
+				upsname = ups->collector;
+				ups = upstable;
+				continue;
+			}
+
 			command(ups);
 			return;
 		}
@@ -397,11 +639,18 @@ static void send_all_drivers(void (*command)(const ups_t *))
 	if (!upstable)
 		fatalx(EXIT_FAILURE, "Error: no UPS definitions found in ups.conf");
 
+	if ((command == &start_driver) && (maxparallel > 1)) {
+		start_all_parallel();
+		return;
+	}
+
 	if (command != &shutdown_driver) {
 		ups = upstable;
 
 		while (ups) {
-			command(ups);
+			/* started and stopped along with its collector */
+			if (!ups->collector)
+				command(ups);
 
 			ups = ups->next;
 		}
@@ -432,6 +681,7 @@ static void exit_cleanup(void)
 
 		free(tmp->driver);
 		free(tmp->port);
+		free(tmp->collector);
 		free(tmp->upsname);
 		free(tmp);
 
@@ -0,0 +1,82 @@
+/* protocmd.h - Network UPS Tools protocol command lookup
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef PROTOCMD_H_SEEN
+#define PROTOCMD_H_SEEN
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* first word of a line in the network protocol (clients to upsd) or
+ * in the socket protocol (upsd to drivers and back) */
+typedef enum {
+	PROTO_UNKNOWN = 0,
+
+	/* driver socket protocol */
+	PROTO_ADDCMD,
+	PROTO_ADDENUM,
+	PROTO_ADDRANGE,
+	PROTO_DATAOK,
+	PROTO_DATASTALE,
+	PROTO_DELCMD,
+	PROTO_DELENUM,
+	PROTO_DELINFO,
+	PROTO_DELRANGE,
+	PROTO_DUMPALL,
+	PROTO_DUMPDONE,
+	PROTO_PING,
+	PROTO_PONG,
+	PROTO_SETAUX,
+	PROTO_SETFLAGS,
+	PROTO_SETINFO,
+
+	/* shared by both protocols */
+	PROTO_INSTCMD,
+	PROTO_SET,
+
+	/* network protocol */
+	PROTO_FSD,
+	PROTO_GET,
+	PROTO_HELP,
+	PROTO_LIST,
+	PROTO_LOGIN,
+	PROTO_LOGOUT,
+	PROTO_MASTER,
+	PROTO_NETVER,
+	PROTO_PASSWORD,
+	PROTO_STARTTLS,
+	PROTO_UNWATCH,
+	PROTO_USERNAME,
+	PROTO_VER,
+	PROTO_WATCH,
+
+	PROTO_NUMCMDS	/* number of values above, not a command */
+} proto_cmd_t;
+
+/* map <word> (case insensitive) to its command, PROTO_UNKNOWN if none */
+proto_cmd_t proto_cmd_lookup(const char *word);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* PROTOCMD_H_SEEN */
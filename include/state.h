@@ -48,6 +48,9 @@ typedef struct st_tree_s {
 	struct enum_s		*enum_list;
 	struct range_s		*range_list;
 
+	/* AVL tree: height of the subtree rooted here */
+	int	height;
+
 	struct st_tree_s	*left;
 	struct st_tree_s	*right;
 } st_tree_t;
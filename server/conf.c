@@ -23,6 +23,7 @@
 #include "sstate.h"
 #include "user.h"
 #include "netssl.h"
+#include "netwatch.h"
 
 	ups_t	*upstable = NULL;
 	int	num_ups = 0;
@@ -90,6 +91,7 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		sstate_cmdfree(temp);
 		pconf_finish(&temp->sock_ctx);
 
+		poll_del(temp->sock_fd);
 		close(temp->sock_fd);
 		temp->sock_fd = -1;
 		temp->dumpdone = 0;
@@ -131,6 +133,12 @@ static int parse_upsd_conf_args(int numargs, char **arg)
 		return 1;
 	}
 
+	/* MAXQUEUE <bytes> */
+	if (!strcmp(arg[0], "MAXQUEUE")) {
+		maxqueue = atoi(arg[1]);
+		return 1;
+	}
+
 	/* STATEPATH <dir> */
 	if (!strcmp(arg[0], "STATEPATH")) {
 		free(statepath);
@@ -152,6 +160,13 @@ static int parse_upsd_conf_args(int numargs, char **arg)
 		certfile = xstrdup(arg[1]);
 		return 1;
 	}
+
+	/* TICKETKEYFILE <file> */
+	if (!strcmp(arg[0], "TICKETKEYFILE")) {
+		free(ticketkeyfile);
+		ticketkeyfile = xstrdup(arg[1]);
+		return 1;
+	}
 #elif (defined WITH_NSS) /* WITH_OPENSSL */
 	/* CERTPATH <dir> */
 	if (!strcmp(arg[0], "CERTPATH")) {
@@ -382,12 +397,15 @@ static void delete_ups(upstype_t *target)
 			else
 				last->next = ptr->next;
 
-			if (ptr->sock_fd != -1)
+			if (ptr->sock_fd != -1) {
+				poll_del(ptr->sock_fd);
 				close(ptr->sock_fd);
+			}
 
 			/* release memory */
 			sstate_infofree(ptr);
 			sstate_cmdfree(ptr);
+			watch_ups_free(ptr);
 			pconf_finish(&ptr->sock_ctx);
 
 			free(ptr->fn);
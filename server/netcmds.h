@@ -18,6 +18,7 @@
 */
 
 #include "nut_ctype.h"
+#include "protocmd.h"
 
 #include "netssl.h"
 #include "netget.h"
@@ -26,6 +27,7 @@
 #include "netmisc.h"
 #include "netuser.h"
 #include "netinstcmd.h"
+#include "netwatch.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
 
@@ -36,31 +38,34 @@ extern "C" {
 #endif
 
 struct {
+	proto_cmd_t	cmd;
 	const	char	*name;
 	void	(*func)(nut_ctype_t *client, int numargs, const char **arg);
 	int	flags;
 } netcmds[] = {
-	{ "VER",	net_ver,	0		},
-	{ "NETVER",	net_netver,	0		},
-	{ "HELP",	net_help,	0		},
-	{ "STARTTLS",	net_starttls,	0		},
+	{ PROTO_VER,	"VER",	net_ver,	0		},
+	{ PROTO_NETVER,	"NETVER",	net_netver,	0		},
+	{ PROTO_HELP,	"HELP",	net_help,	0		},
+	{ PROTO_STARTTLS,	"STARTTLS",	net_starttls,	0		},
 
-	{ "GET",	net_get,	0		},
-	{ "LIST",	net_list,	0		},
+	{ PROTO_GET,	"GET",	net_get,	0		},
+	{ PROTO_LIST,	"LIST",	net_list,	0		},
+	{ PROTO_WATCH,	"WATCH",	net_watch,	0		},
+	{ PROTO_UNWATCH,	"UNWATCH",	net_unwatch,	0		},
 
-	{ "USERNAME",	net_username,	0		},
-	{ "PASSWORD",	net_password,	0		},
+	{ PROTO_USERNAME,	"USERNAME",	net_username,	0		},
+	{ PROTO_PASSWORD,	"PASSWORD",	net_password,	0		},
 
-	{ "LOGIN",	net_login,	FLAG_USER	},
-	{ "LOGOUT", 	net_logout,	0		},
-	{ "MASTER",	net_master,	FLAG_USER	},
+	{ PROTO_LOGIN,	"LOGIN",	net_login,	FLAG_USER	},
+	{ PROTO_LOGOUT,	"LOGOUT", 	net_logout,	0		},
+	{ PROTO_MASTER,	"MASTER",	net_master,	FLAG_USER	},
 
-	{ "FSD",	net_fsd,	FLAG_USER	},
+	{ PROTO_FSD,	"FSD",	net_fsd,	FLAG_USER	},
 
-	{ "SET",	net_set,	FLAG_USER	},
-	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
+	{ PROTO_SET,	"SET",	net_set,	FLAG_USER	},
+	{ PROTO_INSTCMD,	"INSTCMD",	net_instcmd,	FLAG_USER	},
 
-	{ NULL,		(void(*)())(NULL), 0		}
+	{ PROTO_UNKNOWN,	NULL,	(void(*)())(NULL), 0		}
 };
 
 #ifdef __cplusplus
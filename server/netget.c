@@ -215,6 +215,52 @@ static void get_var(nut_ctype_t *client, const char *upsname, const char *var)
 		sendback(client, "VAR %s %s \"%s\"\n", upsname, var, val);
 }
 
+/* answer a batch of GET VAR requests for the same UPS in one go */
+static void get_vars(nut_ctype_t *client, const char *upsname, int numvar, const char **var)
+{
+	const	upstype_t	*ups;
+	const	char	*val;
+	int	i;
+
+	if (numvar > NET_GETVARS_MAX) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(upsname);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (!ups_available(ups, client))
+		return;
+
+	if (!sendback(client, "BEGIN GET VARS %s\n", upsname))
+		return;
+
+	for (i = 0; i < numvar; i++) {
+
+		val = sstate_getinfo(ups, var[i]);
+
+		/* leave out what this UPS doesn't have */
+		if (!val)
+			continue;
+
+		/* handle special case for status */
+		if ((!strcasecmp(var[i], "ups.status")) && (ups->fsd)) {
+			if (!sendback(client, "VAR %s %s \"FSD %s\"\n", upsname, var[i], val))
+				return;
+		} else {
+			if (!sendback(client, "VAR %s %s \"%s\"\n", upsname, var[i], val))
+				return;
+		}
+	}
+
+	sendback(client, "END GET VARS %s\n", upsname);
+}
+
 void net_get(nut_ctype_t *client, int numarg, const char **arg)
 {
 	if (numarg < 2) {
@@ -245,6 +291,12 @@ void net_get(nut_ctype_t *client, int numarg, const char **arg)
 		return;
 	}
 
+	/* GET VARS UPS VARNAME [VARNAME...] */
+	if (!strcasecmp(arg[0], "VARS")) {
+		get_vars(client, arg[1], numarg - 2, &arg[2]);
+		return;
+	}
+
 	/* GET TYPE UPS VARNAME */
 	if (!strcasecmp(arg[0], "TYPE")) {
 		get_type(client, arg[1], arg[2]);
@@ -4,6 +4,9 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* most variables a single GET VARS may ask for */
+#define NET_GETVARS_MAX	32
+
 void net_get(nut_ctype_t *client, int numarg, const char **arg);
 
 #ifdef __cplusplus
@@ -24,8 +24,11 @@
 */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include "upsd.h"
 #include "neterr.h"
@@ -44,6 +47,7 @@
 char	*certfile = NULL;
 char	*certname = NULL;
 char	*certpasswd = NULL;
+char	*ticketkeyfile = NULL;
 
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 int certrequest = 0;
@@ -72,6 +76,12 @@ int ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 	return -1;
 }
 
+int ssl_accept(nut_ctype_t *client, int *want_write)
+{
+	upslogx(LOG_ERR, "ssl_accept called but SSL wasn't compiled in");
+	return -1;
+}
+
 void ssl_init(void)
 {
 	ssl_initialized = 0;	/* keep gcc quiet */
@@ -137,6 +147,83 @@ static int ssl_error(SSL *ssl, int ret)
 	return -1;
 }
 
+/* use the session ticket keys saved in ticketkeyfile, or save the ones
+ * OpenSSL made up if there is no such file yet, so that the tickets
+ * handed out to clients remain valid after a restart */
+static void ssl_ticket_keys(void)
+{
+	unsigned char	keys[SMALLBUF];
+	long	len;
+	ssize_t	ret;
+	int	fd;
+
+	if (!ticketkeyfile) {
+		return;
+	}
+
+	/* the size depends on the OpenSSL version */
+	len = SSL_CTX_get_tlsext_ticket_keys(ssl_ctx, NULL, 0);
+
+	if ((len <= 0) || (len >= (long)sizeof(keys))) {
+		upslogx(LOG_WARNING, "TLS session tickets not supported, ignoring TICKETKEYFILE");
+		return;
+	}
+
+	fd = open(ticketkeyfile, O_RDONLY);
+
+	if (fd >= 0) {
+		check_perms(ticketkeyfile);
+
+		/* one byte more, to catch a file that is too long */
+		ret = read(fd, keys, len + 1);
+		close(fd);
+
+		if (ret != len) {
+			upslogx(LOG_ERR, "%s doesn't hold %ld bytes of session ticket keys, ignored",
+				ticketkeyfile, len);
+		} else if (SSL_CTX_set_tlsext_ticket_keys(ssl_ctx, keys, len) != 1) {
+			ssl_debug();
+			upslogx(LOG_ERR, "Can't use the session ticket keys from %s", ticketkeyfile);
+		} else {
+			upsdebugx(2, "%s: loaded from %s", __func__, ticketkeyfile);
+		}
+
+		memset(keys, 0, sizeof(keys));
+		return;
+	}
+
+	if (errno != ENOENT) {
+		upslog_with_errno(LOG_ERR, "Can't open %s", ticketkeyfile);
+		return;
+	}
+
+	if (SSL_CTX_get_tlsext_ticket_keys(ssl_ctx, keys, len) != 1) {
+		ssl_debug();
+		upslogx(LOG_ERR, "Can't get the session ticket keys");
+		return;
+	}
+
+	/* readable by upsd only: whoever has these can decrypt the tickets */
+	fd = open(ticketkeyfile, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+	if (fd < 0) {
+		upslog_with_errno(LOG_ERR, "Can't create %s", ticketkeyfile);
+		memset(keys, 0, sizeof(keys));
+		return;
+	}
+
+	ret = write(fd, keys, len);
+	memset(keys, 0, sizeof(keys));
+
+	if ((close(fd) != 0) || (ret != len)) {
+		upslog_with_errno(LOG_ERR, "Can't write %s", ticketkeyfile);
+		unlink(ticketkeyfile);
+		return;
+	}
+
+	upslogx(LOG_INFO, "Saved new TLS session ticket keys to %s", ticketkeyfile);
+}
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 static CERTCertificate *cert;
@@ -218,97 +305,54 @@ static void HandshakeCallback(PRFileDesc *fd, nut_ctype_t *client_data)
 
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
+/* set up SSL on a client connection, the handshake is done by ssl_accept(),
+ * returns 0 on failure */
+static int ssl_start(nut_ctype_t *client)
 {
-#ifdef WITH_OPENSSL
-	int ret;
-#elif defined(WITH_NSS) /* WITH_OPENSSL */
+#ifdef WITH_NSS
 	SECStatus	status;
 	PRFileDesc	*socket;
-#endif /* WITH_OPENSSL | WITH_NSS */
-	
-	if (client->ssl) {
-		send_err(client, NUT_ERR_ALREADY_SSL_MODE);
-		return;
-	}
-
-	client->ssl_connected = 0;
-
-	if ((!certfile) || (!ssl_initialized)) {
-		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
-		return;
-	}
-	
-#ifdef WITH_OPENSSL	
-	if (!ssl_ctx) {
-#elif defined(WITH_NSS) /* WITH_OPENSSL */
-	if (!NSS_IsInitialized()) {
-#endif /* WITH_OPENSSL | WITH_NSS */
-		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
-		ssl_initialized = 0;
-		return;
-	}
-	
-	if (!sendback(client, "OK STARTTLS\n")) {
-		return;
-	}
+	PRSocketOptionData	opt;
+#endif /* WITH_NSS */
 
-#ifdef WITH_OPENSSL	
+#ifdef WITH_OPENSSL
 
 	client->ssl = SSL_new(ssl_ctx);
 
 	if (!client->ssl) {
 		upslog_with_errno(LOG_ERR, "SSL_new failed\n");
 		ssl_debug();
-		return;
+		return 0;
 	}
 
 	if (SSL_set_fd(client->ssl, client->sock_fd) != 1) {
 		upslog_with_errno(LOG_ERR, "SSL_set_fd failed\n");
 		ssl_debug();
-		return;
-	}
-	
-	ret = SSL_accept(client->ssl);
-	switch (ret)
-	{
-	case 1:
-		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected");
-		break;
-		
-	case 0:
-		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
-		ssl_error(client->ssl, ret);
-		break;
-	case -1:
-		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
-		ssl_error(client->ssl, ret);
-		break;
+		return 0;
 	}
-	
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
 	socket = PR_ImportTCPSocket(client->sock_fd);
 	if (socket == NULL){
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / PR_ImportTCPSocket");
-		return;
+		return 0;
 	}
 
 	client->ssl = SSL_ImportFD(NULL, socket);
 	if (client->ssl == NULL){
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_ImportFD");
-		return;
+		return 0;
 	}
-	
+
 	if (SSL_SetPKCS11PinArg(client->ssl, client) == -1){
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_SetPKCS11PinArg");
-		return;
+		return 0;
 	}
-	
+
 	/* Note cast to SSLAuthCertificate to prevent warning due to
 	 * bad function prototype in NSS.
 	 */
@@ -316,56 +360,166 @@ void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_AuthCertificateHook");
-		return;
+		return 0;
 	}
-	
+
 	status = SSL_BadCertHook(client->ssl, (SSLBadCertHandler)BadCertHandler, client);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_BadCertHook");
-		return;
+		return 0;
 	}
-	
+
 	status = SSL_HandshakeCallback(client->ssl, (SSLHandshakeCallback)HandshakeCallback, client);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_HandshakeCallback");
-		return;
+		return 0;
 	}
-	
+
 	status = SSL_ConfigSecureServer(client->ssl, cert, privKey, NSS_FindCertKEAType(cert));
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_ConfigSecureServer");
-		return;
+		return 0;
 	}
 
 	status = SSL_ResetHandshake(client->ssl, PR_TRUE);
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not inialize SSL connection");
 		nss_error("net_starttls / SSL_ResetHandshake");
-		return;
+		return 0;
+	}
+
+	/* the handshake, reads and writes must not block */
+	opt.option = PR_SockOpt_Nonblocking;
+	opt.value.non_blocking = PR_TRUE;
+
+	if (PR_SetSocketOption(client->ssl, &opt) != PR_SUCCESS) {
+		nss_error("net_starttls / PR_SetSocketOption");
+		return 0;
+	}
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	return 1;
+}
+
+/* go on with the handshake of a client that sent STARTTLS, without blocking.
+ * Returns 1 once done, 0 if it must be called again when the socket is
+ * readable (or writable, if <want_write> is set), -1 on failure */
+int ssl_accept(nut_ctype_t *client, int *want_write)
+{
+#ifdef WITH_OPENSSL
+	int	ret;
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRErrorCode	code;
+	struct pollfd	pfd;
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	*want_write = 0;
+
+#ifdef WITH_OPENSSL
+
+	ret = SSL_accept(client->ssl);
+
+	if (ret == 1) {
+		client->ssl_connected = 1;
+		upsdebugx(3, "SSL connected");
+		return 1;
+	}
+
+	switch (SSL_get_error(client->ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		return 0;
+
+	case SSL_ERROR_WANT_WRITE:
+		*want_write = 1;
+		return 0;
 	}
 
+	upslogx(LOG_ERR, "SSL_accept failed for %s", client->addr);
+	ssl_error(client->ssl, ret);
+
+	return -1;
+
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+
 	/* Note: this call can generate memory leaks not resolvable
 	 * by any release function.
 	 * Probably SSL session key object allocation. */
-	status = SSL_ForceHandshake(client->ssl);
-	if (status != SECSuccess) {
-		PRErrorCode code = PR_GetError();
+	if (SSL_ForceHandshake(client->ssl) != SECSuccess) {
+		code = PR_GetError();
+
+		if (code == PR_WOULD_BLOCK_ERROR) {
+			/* NSS doesn't say which way it is stuck: if the
+			 * socket has room, it waits for the client */
+			pfd.fd = client->sock_fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+
+			*want_write = (poll(&pfd, 1, 0) == 0);
+			return 0;
+		}
+
 		if (code==SSL_ERROR_NO_CERTIFICATE) {
 			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
 				client->addr);
 		} else {
-			nss_error("net_starttls / SSL_ForceHandshake");
-			/* TODO : Close the connection. */
-			return;
+			upslogx(LOG_ERR, "SSL handshake failed for %s", client->addr);
+			ssl_error(client->ssl, -1);
+			return -1;
 		}
 	}
+
 	client->ssl_connected = 1;
+
+	return 1;
+
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+void net_starttls(nut_ctype_t *client, int numarg, const char **arg)
+{
+	if (client->ssl) {
+		send_err(client, NUT_ERR_ALREADY_SSL_MODE);
+		return;
+	}
+
+	client->ssl_connected = 0;
+
+	if ((!certfile) || (!ssl_initialized)) {
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		return;
+	}
+
+#ifdef WITH_OPENSSL
+	if (!ssl_ctx) {
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if (!NSS_IsInitialized()) {
+#endif /* WITH_OPENSSL | WITH_NSS */
+		send_err(client, NUT_ERR_FEATURE_NOT_CONFIGURED);
+		ssl_initialized = 0;
+		return;
+	}
+
+	/* this must go out in clear text, before the handshake */
+	if (!sendback(client, "OK STARTTLS\n")) {
+		return;
+	}
+
+	if (!ssl_start(client)) {
+		/* the client was told to go ahead: drop it */
+		client->last_heard = 0;
+		return;
+	}
+
+	/* the main loop sends the answer, then does the handshake as the
+	 * socket becomes ready, see client_flush() in upsd.c */
+	client->ssl_handshake = 1;
+	client->plainlen = client->outlen;
+}
+
 void ssl_init(void)
 {
 #ifdef WITH_NSS
@@ -389,16 +543,26 @@ void ssl_init(void)
 	SSL_load_error_strings();
 	SSL_library_init();
 
-	if ((ssl_method = TLSv1_server_method()) == NULL) {
+	/* any TLS version the library supports, not just TLSv1.0 */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if ((ssl_method = TLS_server_method()) == NULL) {
+		ssl_debug();
+		fatalx(EXIT_FAILURE, "TLS_server_method failed");
+	}
+#else
+	if ((ssl_method = SSLv23_server_method()) == NULL) {
 		ssl_debug();
-		fatalx(EXIT_FAILURE, "TLSv1_server_method failed");
+		fatalx(EXIT_FAILURE, "SSLv23_server_method failed");
 	}
+#endif
 
 	if ((ssl_ctx = SSL_CTX_new(ssl_method)) == NULL) {
 		ssl_debug();
 		fatalx(EXIT_FAILURE, "SSL_CTX_new failed");
 	}
 
+	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
 	if (SSL_CTX_use_certificate_chain_file(ssl_ctx, certfile) != 1) {
 		ssl_debug();
 		fatalx(EXIT_FAILURE, "SSL_CTX_use_certificate_chain_file(%s) failed", certfile);
@@ -421,6 +585,12 @@ void ssl_init(void)
 
 	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+	/* client sockets are non-blocking: a write may be retried later
+	 * with more data appended to the same output block */
+	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	ssl_ticket_keys();
+
 	ssl_initialized = 1;
 		
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
@@ -523,11 +693,33 @@ void ssl_init(void)
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
+/* tell the caller to try again later, like a non-blocking read() or write() */
+static int ssl_would_block(nut_ctype_t *client, int ret)
+{
+#ifdef WITH_OPENSSL
+	switch (SSL_get_error(client->ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		return 1;
+	}
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	if (PR_GetError() == PR_WOULD_BLOCK_ERROR) {
+		errno = EAGAIN;
+		return 1;
+	}
+#endif /* WITH_OPENSSL | WITH_NSS */
+
+	return 0;
+}
+
 int ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 {
 	int	ret;
 
 	if (!client->ssl_connected) {
+		errno = ENOTCONN;
 		return -1;
 	}
 
@@ -537,8 +729,13 @@ int ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 	ret = PR_Read(client->ssl, buf, buflen);
 #endif /* WITH_OPENSSL | WITH_NSS */
 
+	if ((ret < 0) && (ssl_would_block(client, ret))) {
+		return -1;
+	}
+
 	if (ret < 1) {
 		ssl_error(client->ssl, ret);
+		errno = EIO;	/* don't let a stale errno look like EAGAIN */
 		return -1;
 	}
 
@@ -550,6 +747,7 @@ int ssl_write(nut_ctype_t *client, const char *buf, size_t buflen)
 	int	ret;
 
 	if (!client->ssl_connected) {
+		errno = ENOTCONN;
 		return -1;
 	}
 
@@ -561,6 +759,16 @@ int ssl_write(nut_ctype_t *client, const char *buf, size_t buflen)
 
 	upsdebugx(5, "ssl_write ret=%d", ret);
 
+	if ((ret < 0) && (ssl_would_block(client, ret))) {
+		return -1;
+	}
+
+	if (ret < 1) {
+		ssl_error(client->ssl, ret);
+		errno = EIO;	/* don't let a stale errno look like EAGAIN */
+		return -1;
+	}
+
 	return ret;
 }
 
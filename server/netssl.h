@@ -31,6 +31,7 @@ extern "C" {
 extern char	*certfile;
 extern char	*certname;
 extern char	*certpasswd;
+extern char	*ticketkeyfile;
 #ifdef WITH_CLIENT_CERTIFICATE_VALIDATION
 extern int certrequest;
 #endif /* WITH_CLIENT_CERTIFICATE_VALIDATION */
@@ -50,6 +51,7 @@ void ssl_cleanup(void);
 
 int ssl_read(nut_ctype_t *client, char *buf, size_t buflen);
 int ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
+int ssl_accept(nut_ctype_t *client, int *want_write);
 
 void net_starttls(nut_ctype_t *client, int numarg, const char **arg);
 
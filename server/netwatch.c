@@ -0,0 +1,197 @@
+/* netwatch.c - WATCH handlers for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#include "upsd.h"
+#include "sstate.h"
+#include "state.h"
+#include "neterr.h"
+
+#include "netwatch.h"
+
+extern	upstype_t	*firstups;	/* for watch_client_free */
+
+static void watch_free(watch_t *watch)
+{
+	free(watch->prefix);
+	free(watch);
+}
+
+/* remove the subscriptions of <client> (or everyone if NULL) on <ups> */
+static void watch_remove(upstype_t *ups, nut_ctype_t *client)
+{
+	watch_t	**wptr = &ups->watchlist;
+
+	while (*wptr) {
+
+		watch_t	*watch = *wptr;
+
+		if ((client) && (watch->client != client)) {
+			wptr = &watch->next;
+			continue;
+		}
+
+		*wptr = watch->next;
+
+		watch->client->numwatches--;
+		watch_free(watch);
+	}
+}
+
+/* WATCH <upsname> [<varprefix>] */
+void net_watch(nut_ctype_t *client, int numarg, const char **arg)
+{
+	upstype_t	*ups;
+	watch_t		*watch;
+	const char	*prefix = NULL;
+
+	if ((numarg < 1) || (numarg > 2)) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	if (numarg > 1) {
+		prefix = arg[1];
+	}
+
+	/* don't add the same subscription twice */
+	for (watch = ups->watchlist; watch; watch = watch->next) {
+
+		if (watch->client != client) {
+			continue;
+		}
+
+		if ((!prefix) && (!watch->prefix)) {
+			break;
+		}
+
+		if ((prefix) && (watch->prefix) && (!strcasecmp(prefix, watch->prefix))) {
+			break;
+		}
+	}
+
+	if (!watch) {
+		watch = xcalloc(1, sizeof(*watch));
+		watch->client = client;
+
+		if (prefix) {
+			watch->prefix = xstrdup(prefix);
+			watch->prefixlen = strlen(prefix);
+		}
+
+		watch->next = ups->watchlist;
+		ups->watchlist = watch;
+
+		client->numwatches++;
+
+		upsdebugx(2, "Client %s watches UPS [%s] (%s)", client->addr,
+			ups->name, prefix ? prefix : "all variables");
+	}
+
+	sendback(client, "OK\n");
+}
+
+/* UNWATCH <upsname> */
+void net_unwatch(nut_ctype_t *client, int numarg, const char **arg)
+{
+	upstype_t	*ups;
+
+	if (numarg != 1) {
+		send_err(client, NUT_ERR_INVALID_ARGUMENT);
+		return;
+	}
+
+	ups = get_ups_ptr(arg[0]);
+
+	if (!ups) {
+		send_err(client, NUT_ERR_UNKNOWN_UPS);
+		return;
+	}
+
+	watch_remove(ups, client);
+
+	sendback(client, "OK\n");
+}
+
+/* push the current value of <var> to everyone watching it */
+void watch_notify(const upstype_t *ups, const char *var)
+{
+	watch_t		*watch;
+	const char	*val = NULL;
+
+	for (watch = ups->watchlist; watch; watch = watch->next) {
+
+		if ((watch->prefix) && (strncasecmp(var, watch->prefix, watch->prefixlen))) {
+			continue;
+		}
+
+		/* only look it up once somebody is interested */
+		if (!val) {
+			val = sstate_getinfo(ups, var);
+
+			if (!val) {
+				return;
+			}
+		}
+
+		/* handle special case for status, like GET VAR */
+		if ((!strcasecmp(var, "ups.status")) && (ups->fsd)) {
+			sendback(watch->client, "NOTIFY VAR %s %s \"FSD %s\"\n", ups->name, var, val);
+		} else {
+			sendback(watch->client, "NOTIFY VAR %s %s \"%s\"\n", ups->name, var, val);
+		}
+	}
+}
+
+/* tell everyone watching <var> that the driver removed it */
+void watch_notify_del(const upstype_t *ups, const char *var)
+{
+	watch_t		*watch;
+
+	for (watch = ups->watchlist; watch; watch = watch->next) {
+
+		if ((watch->prefix) && (strncasecmp(var, watch->prefix, watch->prefixlen))) {
+			continue;
+		}
+
+		sendback(watch->client, "NOTIFY DELVAR %s %s\n", ups->name, var);
+	}
+}
+
+/* drop all subscriptions of a client that is going away */
+void watch_client_free(nut_ctype_t *client)
+{
+	upstype_t	*ups;
+
+	for (ups = firstups; ups && (client->numwatches > 0); ups = ups->next) {
+		watch_remove(ups, client);
+	}
+}
+
+/* drop all subscriptions on a UPS that is going away */
+void watch_ups_free(upstype_t *ups)
+{
+	watch_remove(ups, NULL);
+}
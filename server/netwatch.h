@@ -0,0 +1,52 @@
+/* netwatch.h - WATCH handlers for upsd
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NETWATCH_H_SEEN
+#define NETWATCH_H_SEEN 1
+
+#include "nut_ctype.h"
+#include "upstype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* one subscription, kept in the list of the UPS being watched */
+typedef struct watch_s {
+	nut_ctype_t	*client;
+	char		*prefix;	/* NULL: all variables */
+	size_t		prefixlen;
+	struct watch_s	*next;
+} watch_t;
+
+void net_watch(nut_ctype_t *client, int numarg, const char **arg);
+void net_unwatch(nut_ctype_t *client, int numarg, const char **arg);
+
+void watch_notify(const upstype_t *ups, const char *var);
+void watch_notify_del(const upstype_t *ups, const char *var);
+void watch_client_free(nut_ctype_t *client);
+void watch_ups_free(upstype_t *ups);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NETWATCH_H_SEEN */
@@ -37,6 +37,16 @@
 
 #include "parseconf.h"
 
+#define NUT_OUTBUF_LEN	4096	/* size of one block of queued output */
+
+/* block of output waiting to be sent to a client */
+typedef struct nut_outbuf_s {
+	size_t	len;		/* bytes used in data */
+	size_t	off;		/* bytes already sent */
+	struct nut_outbuf_s	*next;
+	char	data[NUT_OUTBUF_LEN];
+} nut_outbuf_t;
+
 /* client structure */
 typedef struct nut_ctype_s {
 	char	*addr;
@@ -45,6 +55,7 @@ typedef struct nut_ctype_s {
 	char	*loginups;
 	char	*password;
 	char	*username;
+	int	numwatches;	/* subscriptions made with WATCH */
 
 #ifdef	WITH_OPENSSL
 	SSL	*ssl;
@@ -54,9 +65,19 @@ typedef struct nut_ctype_s {
 	void *ssl;
 #endif
 	int	ssl_connected;
+	int	ssl_handshake;	/* STARTTLS answered, handshake not done yet */
+	size_t	plainlen;	/* queued bytes still sent in clear text */
 
 	PCONF_CTX_t	ctx;
 
+	/* responses are queued here, and sent once a request is complete
+	 * or, if the socket was full, once it becomes writable again */
+	nut_outbuf_t	*outhead;
+	nut_outbuf_t	*outtail;
+	size_t	outlen;
+	int	corked;		/* hold output until client_flush() */
+	int	pollout;	/* POLLOUT/EPOLLOUT asked for, see client_pollout() */
+
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
 	struct nut_ctype_s	*next;
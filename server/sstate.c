@@ -26,6 +26,9 @@
 
 #include "sstate.h"
 #include "upstype.h"
+#include "upsd.h"
+#include "netwatch.h"
+#include "protocmd.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -40,95 +43,103 @@ static int parse_args(upstype_t *ups, int numargs, char **arg)
 	if (numargs < 1)
 		return 0;
 
-	if (!strcasecmp(arg[0], "PONG")) {
+	/* FIXME: all these should return their state_...() value! */
+	switch (proto_cmd_lookup(arg[0]))
+	{
+	case PROTO_PONG:
 		upsdebugx(3, "Got PONG from UPS [%s]", ups->name);
 		return 1;
-	}
 
-	if (!strcasecmp(arg[0], "DUMPDONE")) {
+	case PROTO_DUMPDONE:
 		upsdebugx(3, "UPS [%s]: dump is done", ups->name);
 		ups->dumpdone = 1;
 		return 1;
-	}
 
-	if (!strcasecmp(arg[0], "DATASTALE")) {
+	case PROTO_DATASTALE:
 		ups->data_ok = 0;
 		return 1;
-	}
 
-	if (!strcasecmp(arg[0], "DATAOK")) {
+	case PROTO_DATAOK:
 		ups->data_ok = 1;
 		return 1;
-	}
 
-	if (numargs < 2)
-		return 0;
-
-	/* FIXME: all these should return their state_...() value! */
 	/* ADDCMD <cmdname> */
-	if (!strcasecmp(arg[0], "ADDCMD")) {
+	case PROTO_ADDCMD:
+		if (numargs < 2)
+			return 0;
 		state_addcmd(&ups->cmdlist, arg[1]);
 		return 1;
-	}
 
 	/* DELCMD <cmdname> */
-	if (!strcasecmp(arg[0], "DELCMD")) {
+	case PROTO_DELCMD:
+		if (numargs < 2)
+			return 0;
 		state_delcmd(&ups->cmdlist, arg[1]);
 		return 1;
-	}
 
 	/* DELINFO <var> */
-	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+	case PROTO_DELINFO:
+		if (numargs < 2)
+			return 0;
+		if (state_delinfo(&ups->inforoot, arg[1])) {
+			watch_notify_del(ups, arg[1]);
+		}
 		return 1;
-	}
-
-	if (numargs < 3)
-		return 0;
 
 	/* SETFLAGS <varname> <flags>... */
-	if (!strcasecmp(arg[0], "SETFLAGS")) {
+	case PROTO_SETFLAGS:
+		if (numargs < 3)
+			return 0;
 		state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
 		return 1;
-	}
 
 	/* SETINFO <varname> <value> */
-	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+	case PROTO_SETINFO:
+		if (numargs < 3)
+			return 0;
+		if (state_setinfo(&ups->inforoot, arg[1], arg[2])) {
+			watch_notify(ups, arg[1]);
+		}
 		return 1;
-	}
 
 	/* ADDENUM <varname> <enumval> */
-	if (!strcasecmp(arg[0], "ADDENUM")) {
+	case PROTO_ADDENUM:
+		if (numargs < 3)
+			return 0;
 		state_addenum(ups->inforoot, arg[1], arg[2]);
 		return 1;
-	}
 
 	/* ADDRANGE <varname> <minvalue> <maxvalue> */
-	if (!strcasecmp(arg[0], "ADDRANGE")) {
+	case PROTO_ADDRANGE:
+		if (numargs < 4)
+			return 0;
 		state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
 		return 1;
-	}
 
 	/* DELENUM <varname> <enumval> */
-	if (!strcasecmp(arg[0], "DELENUM")) {
+	case PROTO_DELENUM:
+		if (numargs < 3)
+			return 0;
 		state_delenum(ups->inforoot, arg[1], arg[2]);
 		return 1;
-	}
 
 	/* DELRANGE <varname> <minvalue> <maxvalue> */
-	if (!strcasecmp(arg[0], "DELRANGE")) {
+	case PROTO_DELRANGE:
+		if (numargs < 4)
+			return 0;
 		state_delrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
 		return 1;
-	}
 
 	/* SETAUX <varname> <auxval> */
-	if (!strcasecmp(arg[0], "SETAUX")) {
+	case PROTO_SETAUX:
+		if (numargs < 3)
+			return 0;
 		state_setaux(ups->inforoot, arg[1], arg[2]);
 		return 1;
-	}
 
-	return 0;
+	default:
+		return 0;
+	}
 }
 
 /* nothing fancy - just make the driver say something back to us */
@@ -230,6 +241,8 @@ int sstate_connect(upstype_t *ups)
 
 	upslogx(LOG_INFO, "Connected to UPS [%s]: %s", ups->name, ups->fn);
 
+	poll_add(fd, DRIVER, ups);
+
 	return fd;
 }
 
@@ -244,53 +257,66 @@ void sstate_disconnect(upstype_t *ups)
 
 	pconf_finish(&ups->sock_ctx);
 
+	poll_del(ups->sock_fd);
 	close(ups->sock_fd);
 	ups->sock_fd = -1;
 }
 
 void sstate_readline(upstype_t *ups)
 {
-	int	i, ret;
-	char	buf[SMALLBUF];
+	int	ret;
+	size_t	off, used;
+	char	buf[LARGEBUF];
 
 	if ((!ups) || (ups->sock_fd < 0)) {
 		return;
 	}
 
-	ret = read(ups->sock_fd, buf, sizeof(buf));
+	/* the socket is non-blocking and may be edge-triggered,
+	 * so keep reading until there is nothing left */
+	for (;;) {
 
-	if (ret < 0) {
-		switch(errno)
-		{
-		case EINTR:
-		case EAGAIN:
-			return;
+		ret = read(ups->sock_fd, buf, sizeof(buf));
+
+		if (ret < 0) {
+			switch(errno)
+			{
+			case EINTR:
+			case EAGAIN:
+				return;
+
+			default:
+				upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+				sstate_disconnect(ups);
+				return;
+			}
+		}
 
-		default:
-			upslog_with_errno(LOG_WARNING, "Read from UPS [%s] failed", ups->name);
+		if (ret == 0) {
+			upslogx(LOG_NOTICE, "Driver for UPS [%s] closed the connection", ups->name);
 			sstate_disconnect(ups);
 			return;
 		}
-	}
 
-	for (i = 0; i < ret; i++) {
+		for (off = 0; off < (size_t)ret; off += used) {
 
-		switch (pconf_char(&ups->sock_ctx, buf[i]))
-		{
-		case 1:
-			/* set the 'last heard' time to now for later staleness checks */
-			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
-			        time(&ups->last_heard);
-			}
-			continue;
+			switch (pconf_buf(&ups->sock_ctx, buf + off, ret - off, &used))
+			{
+			case 1:
+				/* set the 'last heard' time to now for later staleness checks */
+				if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
+				        time(&ups->last_heard);
+				}
+				continue;
 
-		case 0:
-			continue;	/* haven't gotten a line yet */
+			case 0:
+				continue;	/* haven't gotten a line yet */
 
-		default:
-			/* parse error */
-			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
-			return;
+			default:
+				/* parse error, the rest of the line was skipped */
+				upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
+				continue;
+			}
 		}
 	}
 }
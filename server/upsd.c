@@ -29,9 +29,16 @@
 
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <poll.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include "user.h"
 #include "nut_ctype.h"
 #include "stype.h"
@@ -39,6 +46,7 @@
 #include "sstate.h"
 #include "desc.h"
 #include "neterr.h"
+#include "netwatch.h"
 
 #ifdef HAVE_WRAP
 #include <tcpd.h>
@@ -56,6 +64,10 @@ int	deny_severity = LOG_WARNING;
 	/* preloaded to {OPEN_MAX} in main, can be overridden via upsd.conf */
 	int	maxconn = 0;
 
+	/* output that may pile up for a client before it is disconnected,
+	   can be overridden via upsd.conf */
+	int	maxqueue = 1048576;
+
 	/* preloaded to STATEPATH in main, can be overridden via upsd.conf */
 	char	*statepath = NULL;
 
@@ -73,21 +85,28 @@ static stype_t	*firstaddr = NULL;
 
 static int 	opt_af = AF_UNSPEC;
 
-typedef enum {
-	DRIVER = 1,
-	CLIENT,
-	SERVER
-} handler_type_t;
-
-typedef struct {
-	handler_type_t	type;
-	void		*data;
-} handler_t;
-
 	/* pollfd  */
 static struct pollfd	*fds = NULL;
 static handler_t	*handler = NULL;
 
+	/* registered connections, indexed by file descriptor */
+static handler_t	*fdtable = NULL;
+static int	fdtable_size = 0;
+static int	numconn = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	/* epoll instance, -1 means we use the poll() fallback */
+static int	epoll_fd = -1;
+
+#define UPSD_MAXEVENTS	64
+#endif
+
+	/* netcmds[] entry of each command, -1 if it isn't a network one */
+static int	netcmd_index[PROTO_NUMCMDS];
+
+	/* output blocks written by a single writev() */
+#define UPSD_MAXIOV	64
+
 	/* pid file */
 static char	pidfn[SMALLBUF];
 
@@ -153,6 +172,142 @@ static void ups_data_ok(upstype_t *ups)
 	upslogx(LOG_NOTICE, "UPS [%s] data is no longer stale", ups->name);
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/* add a file descriptor to the epoll set */
+static void epoll_register(int fd, handler_type_t type)
+{
+	struct epoll_event	ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+
+	/* only the driver sockets, which sstate_readline() reads until
+	 * EAGAIN, are edge-triggered.  client_readline() reads a single
+	 * buffer per event and counts on being told again about the rest,
+	 * and a listener must be reported again when accept() ran out of
+	 * fds with connections still pending.  EPOLLOUT is added to a
+	 * client's events later, see client_pollout() */
+	if (type == DRIVER) {
+		ev.events = EPOLLIN | EPOLLET;
+	} else {
+		ev.events = EPOLLIN;
+	}
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		upslog_with_errno(LOG_ERR, "%s: can't add fd %d", __func__, fd);
+	}
+}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+/* register a connection with the event loop */
+void poll_add(int fd, handler_type_t type, void *data)
+{
+	if (fd < 0) {
+		return;
+	}
+
+	if (fd >= fdtable_size) {
+		int	i, newsize = fd + 64;
+
+		fdtable = xrealloc(fdtable, newsize * sizeof(*fdtable));
+
+		for (i = fdtable_size; i < newsize; i++) {
+			fdtable[i].type = 0;
+			fdtable[i].data = NULL;
+		}
+
+		fdtable_size = newsize;
+	}
+
+	if (!fdtable[fd].type) {
+		numconn++;
+	}
+
+	fdtable[fd].type = type;
+	fdtable[fd].data = data;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0) {
+		epoll_register(fd, type);
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+}
+
+/* unregister a connection, must be called before closing <fd> */
+void poll_del(int fd)
+{
+	if ((fd < 0) || (fd >= fdtable_size) || (!fdtable[fd].type)) {
+		return;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0) {
+		struct epoll_event	ev;
+
+		/* kernels before 2.6.9 require a non-NULL event pointer */
+		memset(&ev, 0, sizeof(ev));
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	fdtable[fd].type = 0;
+	fdtable[fd].data = NULL;
+
+	numconn--;
+}
+
+/* ask to be told when a client socket has room for more output, or not.
+ * Client sockets are level-triggered, so EPOLLOUT must be dropped as soon
+ * as nothing waits for room, or every epoll_wait() would return at once;
+ * client_flush() keeps it set only while output is queued, and
+ * client_handshake() while the TLS handshake wants to write */
+static void client_pollout(nut_ctype_t *client, int on)
+{
+	if (client->pollout == on) {
+		return;
+	}
+
+	client->pollout = on;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0) {
+		struct epoll_event	ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.data.fd = client->sock_fd;
+		ev.events = on ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->sock_fd, &ev) < 0) {
+			upslog_with_errno(LOG_ERR, "%s: can't modify fd %d", __func__, client->sock_fd);
+		}
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+}
+
+/* set up the epoll set if possible, otherwise stay with poll() */
+static void poll_init(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	int	fd;
+
+	epoll_fd = epoll_create(maxconn > 0 ? maxconn : 1);
+
+	if (epoll_fd < 0) {
+		upslog_with_errno(LOG_WARNING, "epoll_create failed, falling back to poll()");
+		return;
+	}
+
+	/* pick up everything registered before the event loop started */
+	for (fd = 0; fd < fdtable_size; fd++) {
+		if (fdtable[fd].type) {
+			epoll_register(fd, fdtable[fd].type);
+		}
+	}
+
+	upsdebugx(1, "%s: using epoll", __func__);
+#endif	/* HAVE_SYS_EPOLL_H */
+}
+
 /* add another listening address */
 void listen_add(const char *addr, const char *port)
 {
@@ -265,6 +420,20 @@ static void declogins(const char *upsname)
 	}
 }
 
+/* throw away whatever is left in the output queue */
+static void client_outfree(nut_ctype_t *client)
+{
+	nut_outbuf_t	*buf, *bnext;
+
+	for (buf = client->outhead; buf; buf = bnext) {
+		bnext = buf->next;
+		free(buf);
+	}
+
+	client->outhead = client->outtail = NULL;
+	client->outlen = 0;
+}
+
 /* disconnect a client connection and free all related memory */
 static void client_disconnect(nut_ctype_t *client)
 {
@@ -274,6 +443,8 @@ static void client_disconnect(nut_ctype_t *client)
 
 	upsdebugx(2, "Disconnect from %s", client->addr);
 
+	poll_del(client->sock_fd);
+
 	shutdown(client->sock_fd, 2);
 	close(client->sock_fd);
 
@@ -281,10 +452,14 @@ static void client_disconnect(nut_ctype_t *client)
 		declogins(client->loginups);
 	}
 
+	watch_client_free(client);
+
 	ssl_finish(client);
 
 	pconf_finish(&client->ctx);
 
+	client_outfree(client);
+
 	if (client->prev) {
 		client->prev->next = client->next;
 	} else {
@@ -308,10 +483,195 @@ static void client_disconnect(nut_ctype_t *client)
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest> */
+/* append <len> bytes to the output queue of a client */
+static void client_queue(nut_ctype_t *client, const char *data, size_t len)
+{
+	while (len > 0) {
+		nut_outbuf_t	*buf = client->outtail;
+		size_t	n;
+
+		if ((!buf) || (buf->len == sizeof(buf->data))) {
+			buf = xcalloc(1, sizeof(*buf));
+
+			if (client->outtail) {
+				client->outtail->next = buf;
+			} else {
+				client->outhead = buf;
+			}
+
+			client->outtail = buf;
+		}
+
+		n = sizeof(buf->data) - buf->len;
+
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(buf->data + buf->len, data, n);
+		buf->len += n;
+		client->outlen += n;
+
+		data += n;
+		len -= n;
+	}
+}
+
+/* release the first <len> bytes of the output queue */
+static void client_consume(nut_ctype_t *client, size_t len)
+{
+	nut_outbuf_t	*buf;
+
+	client->outlen -= len;
+
+	while ((buf = client->outhead) && (len > 0)) {
+
+		if (len < buf->len - buf->off) {
+			buf->off += len;
+			break;
+		}
+
+		len -= buf->len - buf->off;
+		client->outhead = buf->next;
+		free(buf);
+	}
+
+	if (!client->outhead) {
+		client->outtail = NULL;
+	}
+}
+
+static int client_handshake(nut_ctype_t *client);
+
+/* send the queued output to the client, returns 0 on failure */
+int client_flush(nut_ctype_t *client)
+{
+	while (client->outhead) {
+		ssize_t	res;
+
+		/* during a handshake, only the STARTTLS answer may go out */
+		if ((client->ssl_handshake) && (client->plainlen == 0)) {
+			break;
+		}
+
+#ifdef WITH_SSL
+		if (client->ssl_connected) {
+			nut_outbuf_t	*buf = client->outhead;
+
+			res = ssl_write(client, buf->data + buf->off, buf->len - buf->off);
+		} else
+#endif /* WITH_SSL */
+		{
+			struct iovec	iov[UPSD_MAXIOV];
+			nut_outbuf_t	*buf;
+			size_t	left = client->plainlen;
+			int	n = 0;
+
+			for (buf = client->outhead; buf && (n < UPSD_MAXIOV); buf = buf->next, n++) {
+				iov[n].iov_base = buf->data + buf->off;
+				iov[n].iov_len = buf->len - buf->off;
+
+				if (!client->ssl_handshake) {
+					continue;
+				}
+
+				if (iov[n].iov_len >= left) {
+					iov[n++].iov_len = left;
+					break;
+				}
+
+				left -= iov[n].iov_len;
+			}
+
+			res = writev(client->sock_fd, iov, n);
+		}
+
+		if ((res < 0) && (errno == EINTR)) {
+			continue;
+		}
+
+		if ((res < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+			/* socket is full, the rest goes out when it is writable */
+			upsdebugx(3, "%s: [destfd=%d] %d bytes left queued", __func__,
+				client->sock_fd, (int)client->outlen);
+			break;
+		}
+
+		if (res <= 0) {
+			upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+			client_outfree(client);
+			client_pollout(client, 0);
+			client->last_heard = 0;
+			return 0;	/* failed */
+		}
+
+		upsdebugx(3, "%s: [destfd=%d] [len=%d] of [%d]", __func__,
+			client->sock_fd, (int)res, (int)client->outlen);
+
+		client_consume(client, res);
+
+		if (client->ssl_handshake) {
+			client->plainlen -= res;
+		}
+	}
+
+	if ((client->ssl_handshake) && (client->plainlen == 0)) {
+		return client_handshake(client);
+	}
+
+	client_pollout(client, client->outhead != NULL);
+
+	return 1;	/* OK */
+}
+
+/* go on with the TLS handshake of a client, once the STARTTLS answer is
+ * out, as its socket becomes ready; returns 0 on failure */
+static int client_handshake(nut_ctype_t *client)
+{
+	int	want_write;
+
+	switch (ssl_accept(client, &want_write))
+	{
+	case 1:
+		upsdebugx(2, "TLS handshake done with %s", client->addr);
+		client->ssl_handshake = 0;
+		return client_flush(client);	/* what was queued meanwhile */
+
+	case 0:
+		client_pollout(client, want_write);
+		return 1;
+
+	default:
+		upslogx(LOG_NOTICE, "TLS handshake failed with %s", client->addr);
+		client_outfree(client);
+		client_pollout(client, 0);
+		client->last_heard = 0;
+		return 0;	/* failed */
+	}
+}
+
+/* drop a client that lets its output queue grow beyond maxqueue bytes,
+ * the actual disconnect is done by check_clients() */
+static int client_check_queue(nut_ctype_t *client)
+{
+	if ((maxqueue <= 0) || (client->outlen <= (size_t)maxqueue)) {
+		return 1;	/* OK */
+	}
+
+	upslogx(LOG_NOTICE, "Client %s is not reading its responses (%d bytes queued), disconnecting",
+		client->addr, (int)client->outlen);
+
+	client_outfree(client);
+	client_pollout(client, 0);
+	client->last_heard = 0;
+
+	return 0;
+}
+
+/* queue a line for <client>, and send it unless a request is being handled */
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 {
-	int	res, len;
+	int	len;
 	char ans[NUT_NET_ANSWER_MAX+1];
 	va_list ap;
 
@@ -319,30 +679,30 @@ int sendback(nut_ctype_t *client, const char *fmt, ...)
 		return 0;
 	}
 
+	/* don't bother with a client that is going away */
+	if (client->last_heard == 0) {
+		return 0;
+	}
+
 	va_start(ap, fmt);
 	vsnprintf(ans, sizeof(ans), fmt, ap);
 	va_end(ap);
 
 	len = strlen(ans);
 
-#ifdef WITH_SSL
-	if (client->ssl) {
-		res = ssl_write(client, ans, len);
-	} else 
-#endif /* WITH_SSL */
-	{
-		res = write(client->sock_fd, ans, len);
-	}
+	client_queue(client, ans, len);
 
 	upsdebugx(2, "write: [destfd=%d] [len=%d] [%s]", client->sock_fd, len, rtrim(ans, '\n'));
 
-	if (len != res) {
-		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
-		client->last_heard = 0;
-		return 0;	/* failed */
+	if ((client->corked) && ((maxqueue <= 0) || (client->outlen <= (size_t)maxqueue))) {
+		return 1;	/* OK, sent later by client_readline */
 	}
 
-	return 1;	/* OK */
+	if (!client_flush(client)) {
+		return 0;
+	}
+
+	return client_check_queue(client);
 }
 
 /* just a simple wrapper for now */
@@ -430,6 +790,20 @@ static void check_command(int cmdnum, nut_ctype_t *client, int numarg,
 	netcmds[cmdnum].func(client, numarg - 1, &arg[1]);
 }
 
+/* fill netcmd_index from netcmds[] */
+static void netcmd_init(void)
+{
+	int	i;
+
+	for (i = 0; i < PROTO_NUMCMDS; i++) {
+		netcmd_index[i] = -1;
+	}
+
+	for (i = 0; netcmds[i].name; i++) {
+		netcmd_index[netcmds[i].cmd] = i;
+	}
+}
+
 /* parse requests from the network */
 static void parse_net(nut_ctype_t *client)
 {
@@ -441,16 +815,15 @@ static void parse_net(nut_ctype_t *client)
 		return;
 	}
 
-	for (i = 0; netcmds[i].name; i++) {
-		if (!strcasecmp(netcmds[i].name, client->ctx.arglist[0])) {
-			check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
-			return;
-		}
-	}
+	i = netcmd_index[proto_cmd_lookup(client->ctx.arglist[0])];
 
-	/* fallthrough = not matched by any entry in netcmds */
+	/* not matched by any entry in netcmds */
+	if (i < 0) {
+		send_err(client, NUT_ERR_UNKNOWN_COMMAND);
+		return;
+	}
 
-	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
+	check_command(i, client, client->ctx.numargs, (const char **) client->ctx.arglist);
 }
 
 /* answer incoming tcp connections */
@@ -462,49 +835,89 @@ static void client_connect(stype_t *server)
 #else
 	socklen_t	clen;
 #endif
-	int		fd;
+	int		fd, one = 1;
 	nut_ctype_t		*client;
 
-	clen = sizeof(csock);
-	fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
+	/* the listening socket is non-blocking, so drain the backlog */
+	for (;;) {
 
-	if (fd < 0) {
-		return;
-	}
+		clen = sizeof(csock);
+		fd = accept(server->sock_fd, (struct sockaddr *) &csock, &clen);
 
-	client = xcalloc(1, sizeof(*client));
+		if (fd < 0) {
+			/* out of fds or buffers: the listener stays readable,
+			 * and the pending connections are retried later */
+			if ((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) || (errno == ENOMEM)) {
+				upsdebug_with_errno(2, "%s: accept", __func__);
+			}
+			return;
+		}
 
-	client->sock_fd = fd;
+		if (numconn >= maxconn) {
+			upslogx(LOG_WARNING, "Maximum number of connections (%d) reached, refusing connection from %s",
+				maxconn, inet_ntopW(&csock));
+			close(fd);
+			continue;
+		}
+
+		client = xcalloc(1, sizeof(*client));
 
-	time(&client->last_heard);
+		client->sock_fd = fd;
 
-	client->addr = xstrdup(inet_ntopW(&csock));
+		/* never let a client that doesn't read its responses block us */
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NDELAY) == -1) {
+			upslog_with_errno(LOG_ERR, "%s: fcntl set O_NDELAY on fd %d failed", __func__, fd);
+		}
 
-	pconf_init(&client->ctx, NULL);
+		/* responses are already gathered per read, don't let Nagle hold
+		 * back the ones to a client that pipelines its requests */
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof(one)) != 0) {
+			upsdebug_with_errno(3, "%s: setsockopt TCP_NODELAY on fd %d", __func__, fd);
+		}
 
-	if (firstclient) {
-		firstclient->prev = client;
-		client->next = firstclient;
-	}
+		time(&client->last_heard);
+
+		client->addr = xstrdup(inet_ntopW(&csock));
+
+		pconf_init(&client->ctx, NULL);
+
+		/* leave room for GET VARS <ups> and one word more, so that
+		 * a request that was cut short can be told apart */
+		client->ctx.arg_limit = NET_GETVARS_MAX + 4;
+
+		if (firstclient) {
+			firstclient->prev = client;
+			client->next = firstclient;
+		}
 
-	firstclient = client;
+		firstclient = client;
 
 /*
-	if (lastclient) {
-		client->prev = lastclient;
-		lastclient->next = client;
-	}
+		if (lastclient) {
+			client->prev = lastclient;
+			lastclient->next = client;
+		}
 
-	lastclient = client;
+		lastclient = client;
  */
-	upsdebugx(2, "Connect from %s", client->addr);
+		poll_add(fd, CLIENT, client);
+
+		upsdebugx(2, "Connect from %s", client->addr);
+	}
 }
 
 /* read tcp messages and handle them */
 static void client_readline(nut_ctype_t *client)
 {
 	char	buf[SMALLBUF];
-	int	i, ret;
+	int	ret;
+	size_t	off, used;
+
+	/* the socket belongs to the TLS handshake for now */
+	if (client->ssl_handshake) {
+		client_flush(client);
+		return;
+	}
 
 #ifdef WITH_SSL
 	if (client->ssl) {
@@ -515,6 +928,10 @@ static void client_readline(nut_ctype_t *client)
 		ret = read(client->sock_fd, buf, sizeof(buf));
 	}
 
+	if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+		return;	/* nothing to read after all */
+	}
+
 	if (ret < 0) {
 		upsdebug_with_errno(2, "Disconnect %s (read failure)", client->addr);
 		client_disconnect(client);
@@ -527,28 +944,45 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
+	/* hold the responses until all requests in buf are answered */
+	client->corked = 1;
+
 	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
+	for (off = 0; off < (size_t)ret; off += used) {
 
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
+		switch (pconf_buf(&client->ctx, buf + off, ret - off, &used))
 		{
 		case 1:
+			/* ignore requests from a client that is going away */
+			if (client->last_heard == 0) {
+				continue;
+			}
+
 			time(&client->last_heard);	/* command received */
 			parse_net(client);
+
+			/* what follows STARTTLS is for the handshake */
+			if (client->ssl_handshake) {
+				off = ret;
+				used = 0;
+			}
 			continue;
 
 		case 0:
 			continue;	/* haven't gotten a line yet */
 
 		default:
-			/* parse error */
+			/* parse error, the rest of the line was skipped */
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
-			return;
+			continue;
 		}
 	}
 
-	return;
+	client->corked = 0;
+
+	if (client_flush(client)) {
+		client_check_queue(client);
+	}
 }
 
 void server_load(void)
@@ -568,6 +1002,10 @@ void server_load(void)
 
 	for (server = firstaddr; server; server = server->next) {
 		setuptcp(server);
+
+		if (server->sock_fd >= 0) {
+			poll_add(server->sock_fd, SERVER, server);
+		}
 	}
 	
 	/* check if we have at least 1 valid LISTEN interface */
@@ -585,6 +1023,7 @@ void server_free(void)
 		snext = server->next;
 
 		if (server->sock_fd != -1) {
+			poll_del(server->sock_fd);
 			close(server->sock_fd);
 		}
 
@@ -615,11 +1054,13 @@ void driver_free(void)
 		unext = ups->next;
 
 		if (ups->sock_fd != -1) {
+			poll_del(ups->sock_fd);
 			close(ups->sock_fd);
 		}
 
 		sstate_infofree(ups);
 		sstate_cmdfree(ups);
+		watch_ups_free(ups);
 
 		pconf_finish(&ups->sock_ctx);
 
@@ -650,9 +1091,17 @@ static void upsd_cleanup(void)
 	free(certfile);
 	free(certname);
 	free(certpasswd);
+	free(ticketkeyfile);
 
 	free(fds);
 	free(handler);
+	free(fdtable);
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
 }
 
 void poll_reload(void)
@@ -672,13 +1121,150 @@ void poll_reload(void)
 	handler = xrealloc(handler, maxconn * sizeof(*handler));
 }
 
+/* reconnect to drivers and check for stale data */
+static void check_drivers(void)
+{
+	upstype_t	*ups;
+
+	for (ups = firstups; ups; ups = ups->next) {
+
+		/* see if we need to (re)connect to the socket */
+		if (ups->sock_fd < 0) {
+			ups->sock_fd = sstate_connect(ups);
+			continue;
+		}
+
+		/* throw some warnings if it's not feeding us data any more */
+		if (sstate_dead(ups, maxage)) {
+			ups_data_stale(ups);
+		} else {
+			ups_data_ok(ups);
+		}
+	}
+}
+
+/* shed clients after 1 minute of inactivity */
+static void check_clients(time_t now)
+{
+	nut_ctype_t	*client, *cnext;
+
+	for (client = firstclient; client; client = cnext) {
+
+		cnext = client->next;
+
+		/* watching clients may stay silent, unless a write failed
+		 * or they don't finish a TLS handshake */
+		if ((client->numwatches > 0) && (client->last_heard != 0) && (!client->ssl_handshake)) {
+			continue;
+		}
+
+		if (difftime(now, client->last_heard) > 60) {
+			client_disconnect(client);
+		}
+	}
+}
+
+/* dispatch an event reported by poll() or epoll_wait() */
+static void handle_event(handler_t h, int hangup, int readable, int writable)
+{
+	if (hangup) {
+
+		switch(h.type)
+		{
+		case DRIVER:
+			sstate_disconnect((upstype_t *)h.data);
+			break;
+		case CLIENT:
+			client_disconnect((nut_ctype_t *)h.data);
+			break;
+		case SERVER:
+			upsdebugx(2, "%s: server disconnected", __func__);
+			break;
+		default:
+			upsdebugx(2, "%s: <unknown> disconnected", __func__);
+			break;
+		}
+
+		return;
+	}
+
+	if ((writable) && (h.type == CLIENT)) {
+		client_flush((nut_ctype_t *)h.data);
+	}
+
+	if (readable) {
+
+		switch(h.type)
+		{
+		case DRIVER:
+			sstate_readline((upstype_t *)h.data);
+			break;
+		case CLIENT:
+			client_readline((nut_ctype_t *)h.data);
+			break;
+		case SERVER:
+			client_connect((stype_t *)h.data);
+			break;
+		default:
+			upsdebugx(2, "%s: <unknown> has data available", __func__);
+			break;
+		}
+	}
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* wait on the epoll set, whose members are maintained by poll_add/poll_del */
+static void mainloop_epoll(time_t now)
+{
+	static time_t	lastcheck = 0;
+	struct epoll_event	events[UPSD_MAXEVENTS];
+	int	i, ret;
+
+	/* housekeeping is the only part that scales with the number
+	 * of connections, so don't do it more than once per second */
+	if (now != lastcheck) {
+		check_drivers();
+		check_clients(now);
+		lastcheck = now;
+	}
+
+	upsdebugx(2, "%s: waiting on %d filedescriptors", __func__, numconn);
+
+	ret = epoll_wait(epoll_fd, events, UPSD_MAXEVENTS, 2000);
+
+	if (ret == 0) {
+		upsdebugx(2, "%s: no data available", __func__);
+		return;
+	}
+
+	if (ret < 0) {
+		if (errno != EINTR) {
+			upslog_with_errno(LOG_ERR, "%s", __func__);
+		}
+		return;
+	}
+
+	for (i = 0; i < ret; i++) {
+		int	fd = events[i].data.fd;
+
+		/* may have been closed while handling a previous event */
+		if ((fd >= fdtable_size) || (!fdtable[fd].type)) {
+			continue;
+		}
+
+		handle_event(fdtable[fd], events[i].events & (EPOLLHUP|EPOLLERR),
+			events[i].events & EPOLLIN, events[i].events & EPOLLOUT);
+	}
+}
+#endif	/* HAVE_SYS_EPOLL_H */
+
 /* service requests and check on new data */
 static void mainloop(void)
 {
 	int	i, ret, nfds = 0;
 
 	upstype_t	*ups;
-	nut_ctype_t		*client, *cnext;
+	nut_ctype_t		*client;
 	stype_t		*server;
 	time_t	now;
 
@@ -690,22 +1276,23 @@ static void mainloop(void)
 		reload_flag = 0;
 	}
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd >= 0) {
+		mainloop_epoll(now);
+		return;
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	check_drivers();
+	check_clients(now);
+
 	/* scan through driver sockets */
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
-		/* see if we need to (re)connect to the socket */
 		if (ups->sock_fd < 0) {
-			ups->sock_fd = sstate_connect(ups);
 			continue;
 		}
 
-		/* throw some warnings if it's not feeding us data any more */
-		if (sstate_dead(ups, maxage)) {
-			ups_data_stale(ups);
-		} else {
-			ups_data_ok(ups);
-		}
-
 		fds[nfds].fd = ups->sock_fd;
 		fds[nfds].events = POLLIN;
 
@@ -716,23 +1303,10 @@ static void mainloop(void)
 	}
 
 	/* scan through client sockets */
-	for (client = firstclient; client; client = cnext) {
-
-		cnext = client->next;
-
-		if (difftime(now, client->last_heard) > 60) {
-			/* shed clients after 1 minute of inactivity */
-			client_disconnect(client);
-			continue;
-		}
-
-		if (nfds >= maxconn) {
-			/* ignore clients that we are unable to handle */
-			continue;
-		}
+	for (client = firstclient; client && (nfds < maxconn); client = client->next) {
 
 		fds[nfds].fd = client->sock_fd;
-		fds[nfds].events = POLLIN;
+		fds[nfds].events = client->pollout ? (POLLIN | POLLOUT) : POLLIN;
 
 		handler[nfds].type = CLIENT;
 		handler[nfds].data = client;
@@ -771,48 +1345,8 @@ static void mainloop(void)
 	}
 
 	for (i = 0; i < nfds; i++) {
-
-		if (fds[i].revents & (POLLHUP|POLLERR|POLLNVAL)) {
-
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_disconnect((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_disconnect((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				upsdebugx(2, "%s: server disconnected", __func__);
-				break;
-			default:
-				upsdebugx(2, "%s: <unknown> disconnected", __func__);
-				break;
-			}
-
-			continue;
-		}
-
-		if (fds[i].revents & POLLIN) {
-
-			switch(handler[i].type)
-			{
-			case DRIVER:
-				sstate_readline((upstype_t *)handler[i].data);
-				break;
-			case CLIENT:
-				client_readline((nut_ctype_t *)handler[i].data);
-				break;
-			case SERVER:
-				client_connect((stype_t *)handler[i].data);
-				break;
-			default:
-				upsdebugx(2, "%s: <unknown> has data available", __func__);
-				break;
-			}
-
-			continue;
-		}
+		handle_event(handler[i], fds[i].revents & (POLLHUP|POLLERR|POLLNVAL),
+			fds[i].revents & POLLIN, fds[i].revents & POLLOUT);
 	}
 }
 
@@ -1001,6 +1535,8 @@ int main(int argc, char **argv)
 	/* handle upsd.conf */
 	load_upsdconf(0);	/* 0 = initial */
 
+	netcmd_init();
+
 	/* start server */
 	server_load();
 
@@ -1038,6 +1574,9 @@ int main(int argc, char **argv)
 	/* initialize SSL (keyfile must be readable by nut user) */
 	ssl_init();
 
+	/* switch to epoll if available */
+	poll_init();
+
 	while (!exit_flag) {
 		mainloop();
 	}
@@ -51,6 +51,18 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* connection types known to the event loop */
+typedef enum {
+	DRIVER = 1,
+	CLIENT,
+	SERVER
+} handler_type_t;
+
+typedef struct {
+	handler_type_t	type;
+	void		*data;
+} handler_t;
+
 /* prototypes from upsd.c */
 
 upstype_t *get_ups_ptr(const char *upsname);
@@ -61,16 +73,20 @@ void listen_add(const char *addr, const char *port);
 void kick_login_clients(const char *upsname);
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+int client_flush(nut_ctype_t *client);
 int send_err(nut_ctype_t *client, const char *errtype);
 
 void server_load(void);
 void server_free(void);
 
+void poll_add(int fd, handler_type_t type, void *data);
+void poll_del(int fd);
+
 void check_perms(const char *fn);
 
 /* declarations from upsd.c */
 
-extern int		maxage, maxconn;
+extern int		maxage, maxconn, maxqueue;
 extern char		*statepath, *datapath;
 extern upstype_t	*firstups;
 extern nut_ctype_t	*firstclient;
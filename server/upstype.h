@@ -46,6 +46,7 @@ typedef struct upstype_s {
 	PCONF_CTX_t		sock_ctx;
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
+	struct watch_s		*watchlist;	/* clients subscribed with WATCH */
 
 	int	numlogins;
 	int	fsd;		/* forced shutdown in effect? */
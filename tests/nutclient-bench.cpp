@@ -0,0 +1,231 @@
+/* nutclient-bench.cpp - measure reply parsing in the C++ client library
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Forks a minimal server that answers "LIST VAR bench" with a canned
+ * reply of <vars> variables, then fetches it with TcpClient and reports
+ * how many lines per second are received and tokenized.  The tokenizer
+ * is also timed on its own, without the socket.
+ *
+ * usage: nutclient-bench [<passes> [<vars>]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nutclient.h"
+
+/* give access to the tokenizer */
+class BenchClient : public nut::TcpClient
+{
+public:
+	BenchClient(const std::string& host, int port):nut::TcpClient(host, port){}
+
+	static void tokenize(const std::string& line, size_t begin, std::vector<std::string>& res)
+	{
+		explode(line.data(), line.size(), begin, res);
+	}
+};
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* what upsd would send for a device with <vars> variables */
+static std::string make_reply(long vars)
+{
+	std::ostringstream	out;
+
+	out << "BEGIN LIST VAR bench\n";
+	for (long i = 0; i < vars; i++) {
+		out << "VAR bench outlet." << i << ".voltage \"" << 200 + i % 50 << ".4\"\n";
+	}
+	out << "END LIST VAR bench\n";
+
+	return out.str();
+}
+
+/* answer every request on <fd> with <reply>, until the client goes away */
+static void serve(int fd, const std::string& reply)
+{
+	char	buf[512];
+	ssize_t	ret;
+
+	while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+
+		/* one request per read is good enough for the benchmark */
+		if ((ret < 14) || strncmp(buf, "LIST VAR bench", 14)) {
+			break;
+		}
+
+		for (size_t sent = 0; sent < reply.size(); sent += ret) {
+			ret = write(fd, reply.data() + sent, reply.size() - sent);
+
+			if (ret < 0) {
+				return;
+			}
+		}
+	}
+}
+
+static pid_t start_server(const std::string& reply, int *port)
+{
+	struct sockaddr_in	sin;
+	socklen_t	len = sizeof(sin);
+	int	sock_fd, fd;
+	pid_t	pid;
+
+	sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = 0;
+
+	if ((sock_fd < 0) || (bind(sock_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+		(listen(sock_fd, 1) < 0) || (getsockname(sock_fd, (struct sockaddr *)&sin, &len) < 0)) {
+		perror("server socket");
+		exit(EXIT_FAILURE);
+	}
+
+	*port = ntohs(sin.sin_port);
+
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		if ((fd = accept(sock_fd, NULL, NULL)) >= 0) {
+			serve(fd, reply);
+			close(fd);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(sock_fd);
+
+	return pid;
+}
+
+/* receive and tokenize the whole reply <passes> times, returns lines/s */
+static double run_list(int port, long passes, long vars)
+{
+	struct timeval	start;
+	long	pass;
+
+	BenchClient	client("127.0.0.1", port);
+
+	gettimeofday(&start, NULL);
+
+	for (pass = 0; pass < passes; pass++) {
+		std::map<std::string,std::vector<std::string> >	res = client.getDeviceVariableValues("bench");
+
+		if ((long)res.size() != vars) {
+			std::cerr << "got " << res.size() << " variables instead of " << vars << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	client.disconnect();
+
+	return (vars + 2) * passes / elapsed(&start);
+}
+
+/* tokenize the lines of the reply <passes> times, returns lines/s */
+static double run_tokenize(const std::string& reply, long passes)
+{
+	std::vector<std::string>	lines, res;
+	std::istringstream	in(reply);
+	std::string	line;
+	struct timeval	start;
+	long	pass;
+	size_t	i;
+
+	while (std::getline(in, line)) {
+		lines.push_back(line);
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < lines.size(); i++) {
+			BenchClient::tokenize(lines[i], 0, res);
+		}
+	}
+
+	return lines.size() * passes / elapsed(&start);
+}
+
+int main(int argc, char **argv)
+{
+	long	passes = 200, vars = 1000;
+	int	port, status;
+	pid_t	pid;
+
+	if (argc > 1) {
+		passes = atol(argv[1]);
+	}
+
+	if (argc > 2) {
+		vars = atol(argv[2]);
+	}
+
+	if ((passes < 1) || (vars < 1)) {
+		std::cerr << "usage: " << argv[0] << " [<passes> [<vars>]]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	std::string	reply = make_reply(vars);
+
+	pid = start_server(reply, &port);
+
+	try {
+		printf("%-24s %16.0f\n", "LIST VAR l/s", run_list(port, passes, vars));
+	} catch (nut::NutException& ex) {
+		std::cerr << "LIST VAR failed: " << ex.str() << std::endl;
+		kill(pid, SIGTERM);
+		return EXIT_FAILURE;
+	}
+
+	waitpid(pid, &status, 0);
+
+	printf("%-24s %16.0f\n", "tokenize l/s", run_tokenize(reply, passes));
+
+	printf("\n%ld variables, %ld passes\n"
+		"l/s: reply lines received and tokenized per second\n", vars, passes);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/* parseconf-test.c - check pconf_buf() against pconf_char()
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* pconf_buf() must split lines exactly like pconf_char() does, one
+ * character at a time, however the input is cut into buffers, except that
+ * after a parse error it skips the rest of the line.  A few lines are also
+ * checked against their expected words.
+ */
+
+#include "common.h"
+#include "parseconf.h"
+
+/* the lines or errors found in some input, as text */
+typedef struct {
+	char	*buf;
+	size_t	len, size;
+} result_t;
+
+static int	failures = 0;
+
+static const char *corpus =
+	"SETINFO ups.status \"OL CHRG\"\n"
+	"SETINFO battery.charge 97\n"
+	"\n"
+	"   \t  \n"
+	"GET VAR myups ups.status\r\n"
+	"LIST VAR myups\n"
+	"SET VAR myups ups.delay.shutdown \"120\"\n"
+	"SETINFO ups.mfr \"Some \\\"quoted\\\" name\"\n"
+	"SETINFO path \"C:\\\\ups\\\\log\"\n"
+	"word\\ with\\ escaped\\ spaces next\n"
+	"key=value\n"
+	"key = \"value with = sign\"\n"
+	"comment # the rest is ignored \"even quotes\n"
+	"# a whole comment line\n"
+	"\"\" empty \"\" words\n"
+	"\"unbalanced # in quotes\" is an error\n"
+	"after the error\n"
+	"\"a quoted word that goes\n"
+	"on to the next line\"\n"
+	"continued\\\n"
+	"line\n"
+	"non-ascii \xc3\xa9t\xc3\xa9 value\n"
+	"one two three four five six seven eight nine ten eleven twelve\n"
+	"averyveryveryveryveryveryveryveryveryveryveryveryveryveryveryverylongword x\n"
+	"tab\tseparated\twords\n"
+	"DUMPDONE\n"
+	"no newline at the end";
+
+static void result_add(result_t *res, const char *fmt, const char *str)
+{
+	char	tmp[LARGEBUF];
+	size_t	len;
+
+	snprintf(tmp, sizeof(tmp), fmt, str);
+	len = strlen(tmp);
+
+	if (res->len + len + 1 > res->size) {
+		res->size = (res->len + len + 1) * 2;
+		res->buf = xrealloc(res->buf, res->size);
+	}
+
+	memcpy(res->buf + res->len, tmp, len + 1);
+	res->len += len;
+}
+
+static void result_line(result_t *res, PCONF_CTX_t *ctx)
+{
+	size_t	i;
+
+	result_add(res, "%s", "[");
+
+	for (i = 0; i < ctx->numargs; i++) {
+		result_add(res, (i == 0) ? "<%s>" : " <%s>", ctx->arglist[i]);
+	}
+
+	result_add(res, "%s", "]\n");
+}
+
+static void init(PCONF_CTX_t *ctx, result_t *res, int limits)
+{
+	pconf_init(ctx, NULL);
+
+	if (limits) {
+		ctx->arg_limit = 4;
+		ctx->wordlen_limit = 8;
+	}
+
+	memset(res, 0, sizeof(*res));
+	result_add(res, "%s", "");
+}
+
+/* one character at a time, skipping the rest of a line after an error */
+static void parse_reference(const char *input, size_t len, int limits, result_t *res)
+{
+	PCONF_CTX_t	ctx;
+	size_t	i;
+	int	skip = 0;
+
+	init(&ctx, res, limits);
+
+	for (i = 0; i < len; i++) {
+		if (skip) {
+			skip = (input[i] != '\n');
+			continue;
+		}
+
+		switch (pconf_char(&ctx, input[i]))
+		{
+		case 1:
+			result_line(res, &ctx);
+			break;
+
+		case -1:
+			result_add(res, "%s", "error\n");
+			skip = (input[i] != '\n');
+			break;
+		}
+	}
+
+	pconf_finish(&ctx);
+}
+
+/* through pconf_buf(), in pieces of <chunk> bytes (after <first> bytes) */
+static void parse_buf(const char *input, size_t len, size_t first, size_t chunk, int limits, result_t *res)
+{
+	PCONF_CTX_t	ctx;
+	size_t	pos, end, used;
+
+	init(&ctx, res, limits);
+
+	for (pos = 0; pos < len; pos = end) {
+		end = (pos == 0) ? first : pos + chunk;
+
+		if ((end > len) || (end == 0)) {
+			end = len;
+		}
+
+		while (pos < end) {
+			switch (pconf_buf(&ctx, input + pos, end - pos, &used))
+			{
+			case 1:
+				result_line(res, &ctx);
+				break;
+
+			case -1:
+				result_add(res, "%s", "error\n");
+				break;
+			}
+
+			if ((used == 0) || (used > end - pos)) {
+				printf("FAIL: pconf_buf used %d bytes of %d\n", (int)used, (int)(end - pos));
+				failures++;
+				used = end - pos;
+			}
+
+			pos += used;
+		}
+	}
+
+	pconf_finish(&ctx);
+}
+
+static void compare(const char *what, const result_t *ref, const result_t *got)
+{
+	if (strcmp(ref->buf, got->buf)) {
+		printf("FAIL: %s\n--- expected:\n%s--- got:\n%s", what, ref->buf, got->buf);
+		failures++;
+	}
+}
+
+static void check_splits(const char *input, int limits)
+{
+	result_t	ref, got;
+	size_t	len = strlen(input), first, chunk;
+	char	what[SMALLBUF];
+
+	parse_reference(input, len, limits, &ref);
+
+	/* whole, and cut once anywhere */
+	for (first = 0; first <= len; first++) {
+		parse_buf(input, len, first, len, limits, &got);
+		snprintf(what, sizeof(what), "limits %d, cut at %d", limits, (int)first);
+		compare(what, &ref, &got);
+		free(got.buf);
+	}
+
+	/* in pieces of every size up to 64 bytes */
+	for (chunk = 1; chunk <= 64; chunk++) {
+		parse_buf(input, len, chunk, chunk, limits, &got);
+		snprintf(what, sizeof(what), "limits %d, pieces of %d", limits, (int)chunk);
+		compare(what, &ref, &got);
+		free(got.buf);
+	}
+
+	free(ref.buf);
+}
+
+/* lines whose words are known */
+static void check_expected(const char *input, const char *expected)
+{
+	result_t	ref, got;
+
+	memset(&ref, 0, sizeof(ref));
+	ref.buf = (char *)expected;
+
+	parse_buf(input, strlen(input), 0, 0, 0, &got);
+	compare(input, &ref, &got);
+	free(got.buf);
+}
+
+int main(void)
+{
+	check_splits(corpus, 0);
+	check_splits(corpus, 1);
+
+	check_expected("SET VAR ups \"a b\"\n", "[<SET> <VAR> <ups> <a b>]\n");
+	check_expected("a=b\n", "[<a> <=> <b>]\n");
+	check_expected("\"x\\\"y\" z\n", "[<x\"y> <z>]\n");
+	check_expected("one # two\nthree\n", "[<one>]\n[<three>]\n");
+	check_expected("\n\n", "[]\n[]\n");
+	check_expected("\"a#b\" c\nd e\n", "error\n[<d> <e>]\n");
+	check_expected("\"two\nlines\"\n", "[<twolines>]\n");
+	check_expected("unfinished", "");
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("parseconf: all tests passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+/* protocmd-bench.c - measure command dispatch in the protocol parsers
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Feeds typical lines through pconf_char() and dispatches them the way
+ * parse_net() (upsd), parse_args() (upsd/sstate.c) and sock_arg()
+ * (drivers/dstate.c) do, once with a strcasecmp() scan over the command
+ * names in their original order and once with proto_cmd_lookup().
+ *
+ * usage: protocmd-bench [<passes>]
+ */
+
+#include "common.h"
+#include "timehead.h"
+#include "parseconf.h"
+#include "protocmd.h"
+
+typedef struct {
+	const char	*name;		/* parser being mimicked */
+	const char	**cmds;		/* command names, in the order they were tried */
+	const char	**lines;	/* typical input */
+} bench_set_t;
+
+static const char *net_cmds[] = {
+	"VER", "NETVER", "HELP", "STARTTLS", "GET", "LIST", "WATCH", "UNWATCH",
+	"USERNAME", "PASSWORD", "LOGIN", "LOGOUT", "MASTER", "FSD", "SET",
+	"INSTCMD", NULL
+};
+
+static const char *net_lines[] = {
+	"GET VAR myups ups.status\n",
+	"GET VAR myups battery.charge\n",
+	"LIST VAR myups\n",
+	"USERNAME monuser\n",
+	"PASSWORD secret\n",
+	"LOGIN myups\n",
+	"MASTER myups\n",
+	"INSTCMD myups test.battery.start\n",
+	"SET VAR myups ups.delay.shutdown 120\n",
+	"LOGOUT\n",
+	NULL
+};
+
+static const char *sstate_cmds[] = {
+	"PONG", "DUMPDONE", "DATASTALE", "DATAOK", "ADDCMD", "DELCMD", "DELINFO",
+	"SETFLAGS", "SETINFO", "ADDENUM", "ADDRANGE", "DELENUM", "DELRANGE",
+	"SETAUX", NULL
+};
+
+static const char *sstate_lines[] = {
+	"SETINFO ups.status \"OL CHRG\"\n",
+	"SETINFO battery.charge \"97\"\n",
+	"SETINFO input.voltage \"230.4\"\n",
+	"SETINFO output.voltage \"229.8\"\n",
+	"SETINFO ups.load \"23\"\n",
+	"SETFLAGS ups.delay.shutdown RW STRING\n",
+	"SETAUX ups.delay.shutdown 5\n",
+	"ADDCMD test.battery.start\n",
+	"DATAOK\n",
+	"PONG\n",
+	NULL
+};
+
+static const char *dstate_cmds[] = {
+	"DUMPALL", "PING", "INSTCMD", "SET", NULL
+};
+
+static const char *dstate_lines[] = {
+	"PING\n",
+	"PING\n",
+	"INSTCMD test.battery.start\n",
+	"SET ups.delay.shutdown 120\n",
+	"DUMPALL\n",
+	NULL
+};
+
+static bench_set_t	sets[] = {
+	{ "parse_net",	net_cmds,	net_lines	},
+	{ "parse_args",	sstate_cmds,	sstate_lines	},
+	{ "sock_arg",	dstate_cmds,	dstate_lines	},
+	{ NULL,		NULL,		NULL		}
+};
+
+static volatile int	sink;
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* the way the parsers looked up commands before */
+static int linear_lookup(const char **cmds, const char *word)
+{
+	int	i;
+
+	for (i = 0; cmds[i]; i++) {
+		if (!strcasecmp(cmds[i], word)) {
+			return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+/* tokenize and dispatch every line of <set> <passes> times, returns lines/s */
+static double run_parser(const bench_set_t *set, long passes, int use_switch)
+{
+	PCONF_CTX_t	ctx;
+	struct timeval	start;
+	long	pass, lines = 0;
+	int	i;
+
+	pconf_init(&ctx, NULL);
+	gettimeofday(&start, NULL);
+
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; set->lines[i]; i++) {
+			const char	*p;
+
+			for (p = set->lines[i]; *p; p++) {
+				if (pconf_char(&ctx, *p) != 1) {
+					continue;
+				}
+
+				if (use_switch) {
+					sink = proto_cmd_lookup(ctx.arglist[0]);
+				} else {
+					sink = linear_lookup(set->cmds, ctx.arglist[0]);
+				}
+
+				lines++;
+			}
+		}
+	}
+
+	pconf_finish(&ctx);
+
+	return lines / elapsed(&start);
+}
+
+/* dispatch only, the first word of every line is already split off */
+static double run_dispatch(const bench_set_t *set, long passes, int use_switch)
+{
+	char	words[32][SMALLBUF];
+	struct timeval	start;
+	long	pass, lines = 0;
+	int	i, n;
+
+	for (n = 0; set->lines[n] && (n < 32); n++) {
+		snprintf(words[n], sizeof(words[n]), "%s", set->lines[n]);
+		words[n][strcspn(words[n], " \n")] = '\0';
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (pass = 0; pass < passes * 10; pass++) {
+		for (i = 0; i < n; i++) {
+			if (use_switch) {
+				sink = proto_cmd_lookup(words[i]);
+			} else {
+				sink = linear_lookup(set->cmds, words[i]);
+			}
+		}
+
+		lines += n;
+	}
+
+	return lines / elapsed(&start);
+}
+
+int main(int argc, char **argv)
+{
+	long	passes = 200000;
+	int	i;
+
+	if (argc > 1) {
+		passes = atol(argv[1]);
+	}
+
+	if (passes < 1) {
+		fatalx(EXIT_FAILURE, "usage: %s [<passes>]", argv[0]);
+	}
+
+	/* make sure the lookup agrees with the tables it replaces */
+	for (i = 0; sets[i].name; i++) {
+		int	j;
+
+		for (j = 0; sets[i].cmds[j]; j++) {
+			if (proto_cmd_lookup(sets[i].cmds[j]) == PROTO_UNKNOWN) {
+				fatalx(EXIT_FAILURE, "%s: %s not found", sets[i].name, sets[i].cmds[j]);
+			}
+		}
+	}
+
+	printf("%-12s %16s %16s %16s %16s\n", "parser", "strcasecmp l/s",
+		"switch l/s", "strcasecmp d/s", "switch d/s");
+
+	for (i = 0; sets[i].name; i++) {
+		printf("%-12s %16.0f %16.0f %16.0f %16.0f\n", sets[i].name,
+			run_parser(&sets[i], passes, 0), run_parser(&sets[i], passes, 1),
+			run_dispatch(&sets[i], passes, 0), run_dispatch(&sets[i], passes, 1));
+	}
+
+	printf("\nl/s: lines tokenized and dispatched per second\n"
+		"d/s: command names looked up per second\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/* protocmd-test.c - check proto_cmd_lookup()
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Every command name must map to its own command, whatever its case, and
+ * any other word, including the ones a letter away from a command name,
+ * to PROTO_UNKNOWN.
+ */
+
+#include <ctype.h>
+
+#include "common.h"
+#include "protocmd.h"
+
+static const struct {
+	const char	*name;
+	proto_cmd_t	cmd;
+} commands[] = {
+	{ "ADDCMD", PROTO_ADDCMD },
+	{ "ADDENUM", PROTO_ADDENUM },
+	{ "ADDRANGE", PROTO_ADDRANGE },
+	{ "DATAOK", PROTO_DATAOK },
+	{ "DATASTALE", PROTO_DATASTALE },
+	{ "DELCMD", PROTO_DELCMD },
+	{ "DELENUM", PROTO_DELENUM },
+	{ "DELINFO", PROTO_DELINFO },
+	{ "DELRANGE", PROTO_DELRANGE },
+	{ "DUMPALL", PROTO_DUMPALL },
+	{ "DUMPDONE", PROTO_DUMPDONE },
+	{ "PING", PROTO_PING },
+	{ "PONG", PROTO_PONG },
+	{ "SETAUX", PROTO_SETAUX },
+	{ "SETFLAGS", PROTO_SETFLAGS },
+	{ "SETINFO", PROTO_SETINFO },
+	{ "INSTCMD", PROTO_INSTCMD },
+	{ "SET", PROTO_SET },
+	{ "FSD", PROTO_FSD },
+	{ "GET", PROTO_GET },
+	{ "HELP", PROTO_HELP },
+	{ "LIST", PROTO_LIST },
+	{ "LOGIN", PROTO_LOGIN },
+	{ "LOGOUT", PROTO_LOGOUT },
+	{ "MASTER", PROTO_MASTER },
+	{ "NETVER", PROTO_NETVER },
+	{ "PASSWORD", PROTO_PASSWORD },
+	{ "STARTTLS", PROTO_STARTTLS },
+	{ "UNWATCH", PROTO_UNWATCH },
+	{ "USERNAME", PROTO_USERNAME },
+	{ "VER", PROTO_VER },
+	{ "WATCH", PROTO_WATCH },
+	{ NULL, PROTO_UNKNOWN }
+};
+
+static const char *unknown[] = {
+	"", "X", "LOGON", "LOGINS", "LOG", "SETINF", "SETINFOS", "GETVAR",
+	"PINGPONG", "DUMP", "STARTTLS1", "UNWATCHED", "WATCHES", "USER",
+	"PASS", "VERSION", "NETVERS", "INSTCMDS", "MASTERFSD", "HELPME",
+	"LISTVAR", "DATA", "ADD", "DEL", "DELINFOS", "SETFLAG", "SE",
+	"L0GIN", "LOGIN ", " LOGIN", "LOG\tIN", "DATASTALES", "ADDRANGES",
+	NULL
+};
+
+static int	failures = 0;
+
+/* what <word> should map to */
+static proto_cmd_t expected(const char *word)
+{
+	int	i;
+
+	for (i = 0; commands[i].name; i++) {
+		if (!strcasecmp(word, commands[i].name)) {
+			return commands[i].cmd;
+		}
+	}
+
+	return PROTO_UNKNOWN;
+}
+
+static void check(const char *word, proto_cmd_t cmd)
+{
+	proto_cmd_t	got = proto_cmd_lookup(word);
+
+	if (got != cmd) {
+		printf("FAIL: \"%s\" gives %d, expected %d\n", word, got, cmd);
+		failures++;
+	}
+}
+
+/* every word one edit away from <name> */
+static void check_near_misses(const char *name)
+{
+	char	word[32];
+	size_t	len = strlen(name), i;
+	int	c;
+
+	for (i = 0; i < len; i++) {
+		/* one letter changed */
+		for (c = 'A'; c <= 'Z'; c++) {
+			snprintf(word, sizeof(word), "%s", name);
+			word[i] = c;
+			check(word, expected(word));
+		}
+
+		/* one letter dropped */
+		snprintf(word, sizeof(word), "%.*s%s", (int)i, name, name + i + 1);
+		check(word, expected(word));
+	}
+
+	/* one letter added at the end */
+	for (c = 'A'; c <= 'Z'; c++) {
+		snprintf(word, sizeof(word), "%s%c", name, c);
+		check(word, expected(word));
+	}
+}
+
+int main(void)
+{
+	char	word[32];
+	size_t	j;
+	int	i;
+
+	check(NULL, PROTO_UNKNOWN);
+
+	for (i = 0; commands[i].name; i++) {
+		check(commands[i].name, commands[i].cmd);
+
+		/* lower case */
+		for (j = 0; commands[i].name[j]; j++) {
+			word[j] = tolower((unsigned char)commands[i].name[j]);
+		}
+		word[j] = '\0';
+		check(word, commands[i].cmd);
+
+		/* mixed case, both ways */
+		for (j = 0; commands[i].name[j]; j++) {
+			word[j] = (j % 2) ? tolower((unsigned char)commands[i].name[j]) : commands[i].name[j];
+		}
+		check(word, commands[i].cmd);
+
+		for (j = 0; commands[i].name[j]; j++) {
+			word[j] = (j % 2) ? commands[i].name[j] : tolower((unsigned char)commands[i].name[j]);
+		}
+		check(word, commands[i].cmd);
+
+		check_near_misses(commands[i].name);
+	}
+
+	for (i = 0; unknown[i]; i++) {
+		check(unknown[i], PROTO_UNKNOWN);
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("protocmd: all tests passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+/* state-test.c - check the variable tree of common/state.c
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Adds, updates and deletes variables in sorted, reverse and shuffled
+ * order, and after each step checks that every variable can be found
+ * (whatever its case), that the tree is still ordered and that the
+ * heights are right and never differ by more than one between siblings.
+ */
+
+#include <ctype.h>
+
+#include "common.h"
+#include "state.h"
+
+#define NVARS	300
+
+static int	failures = 0;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static char	names[NVARS][32];
+static int	present[NVARS];
+
+/* returns the height of <node>, checking the subtree on the way */
+static int check_node(const st_tree_t *node, const char *min, const char *max, int *count)
+{
+	int	lh, rh;
+
+	if (!node) {
+		return 0;
+	}
+
+	CHECK(!min || (strcasecmp(min, node->var) < 0), "%s not after %s", node->var, min);
+	CHECK(!max || (strcasecmp(node->var, max) < 0), "%s not before %s", node->var, max);
+
+	lh = check_node(node->left, min, node->var, count);
+	rh = check_node(node->right, node->var, max, count);
+
+	CHECK((lh - rh <= 1) && (rh - lh <= 1), "%s unbalanced: %d / %d", node->var, lh, rh);
+	CHECK(node->height == 1 + ((lh > rh) ? lh : rh), "%s: height %d, expected %d",
+		node->var, node->height, 1 + ((lh > rh) ? lh : rh));
+
+	(*count)++;
+
+	return node->height;
+}
+
+static void check_tree(st_tree_t *root, const char *step)
+{
+	char	buf[32], val[32];
+	int	i, count = 0, expected = 0;
+	size_t	j;
+
+	check_node(root, NULL, NULL, &count);
+
+	for (i = 0; i < NVARS; i++) {
+		if (!present[i]) {
+			CHECK(state_getinfo(root, names[i]) == NULL, "%s: %s not deleted", step, names[i]);
+			continue;
+		}
+
+		expected++;
+
+		snprintf(val, sizeof(val), "%d", present[i]);
+		CHECK(state_getinfo(root, names[i]) && !strcmp(state_getinfo(root, names[i]), val),
+			"%s: %s is %s, expected %s", step, names[i],
+			state_getinfo(root, names[i]) ? state_getinfo(root, names[i]) : "(null)", val);
+
+		/* names are case insensitive */
+		for (j = 0; names[i][j]; j++) {
+			buf[j] = toupper((unsigned char)names[i][j]);
+		}
+		buf[j] = '\0';
+
+		CHECK(state_getinfo(root, buf) && !strcmp(state_getinfo(root, buf), val),
+			"%s: %s not found", step, buf);
+	}
+
+	CHECK(count == expected, "%s: %d nodes, expected %d", step, count, expected);
+}
+
+static void set(st_tree_t **root, int i, int value)
+{
+	char	val[32];
+
+	snprintf(val, sizeof(val), "%d", value);
+	CHECK(state_setinfo(root, names[i], val) == 1, "setting %s", names[i]);
+	present[i] = value;
+}
+
+static void del(st_tree_t **root, int i)
+{
+	CHECK(state_delinfo(root, names[i]) == 1, "deleting %s", names[i]);
+	present[i] = 0;
+}
+
+/* a repeatable shuffle of 0..NVARS-1 */
+static void shuffle(int *order)
+{
+	unsigned long	seed = 12345;
+	int	i, j, tmp;
+
+	for (i = 0; i < NVARS; i++) {
+		order[i] = i;
+	}
+
+	for (i = NVARS - 1; i > 0; i--) {
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 16) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+static void run(const char *name, const int *order)
+{
+	st_tree_t	*root = NULL;
+	char	step[64];
+	int	i;
+
+	memset(present, 0, sizeof(present));
+
+	for (i = 0; i < NVARS; i++) {
+		set(&root, order[i], i + 1);
+		snprintf(step, sizeof(step), "%s: add %d", name, i);
+		check_tree(root, step);
+	}
+
+	/* same value: no change; another one: updated in place */
+	CHECK(state_setinfo(&root, names[order[0]], "1") == 0, "%s: unchanged value", name);
+	set(&root, order[0], 1000);
+	check_tree(root, name);
+
+	CHECK(state_delinfo(&root, "no.such.var") == 0, "%s: deleted a missing variable", name);
+
+	/* every other one, then the rest, which takes the root several times */
+	for (i = 0; i < NVARS; i += 2) {
+		del(&root, order[i]);
+		snprintf(step, sizeof(step), "%s: delete %d", name, i);
+		check_tree(root, step);
+	}
+
+	for (i = NVARS - 1; i > 0; i -= 2) {
+		del(&root, order[i]);
+		snprintf(step, sizeof(step), "%s: delete %d", name, i);
+		check_tree(root, step);
+	}
+
+	CHECK(root == NULL, "%s: tree not empty", name);
+
+	/* and free a full one */
+	for (i = 0; i < NVARS; i++) {
+		set(&root, order[i], i + 1);
+	}
+
+	state_infofree(root);
+}
+
+int main(void)
+{
+	int	order[NVARS], i;
+
+	for (i = 0; i < NVARS; i++) {
+		snprintf(names[i], sizeof(names[i]), "var.%c%03d.value", 'a' + (i % 26), i);
+	}
+
+	for (i = 0; i < NVARS; i++) {
+		order[i] = i;
+	}
+	run("sorted", order);
+
+	for (i = 0; i < NVARS; i++) {
+		order[i] = NVARS - 1 - i;
+	}
+	run("reverse", order);
+
+	shuffle(order);
+	run("shuffled", order);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("state: all tests passed\n");
+	return EXIT_SUCCESS;
+}
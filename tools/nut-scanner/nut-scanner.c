@@ -38,7 +38,7 @@
 
 #define ERR_BAD_OPTION	(-1)
 
-const char optstring[] = "?ht:s:e:E:c:l:u:W:X:w:x:p:b:B:d:D:CUSMOAm:NPqIVa";
+const char optstring[] = "?ht:s:e:E:c:l:u:W:X:w:x:p:b:B:d:D:CUSMOAm:NPqIVaT:";
 
 #ifdef HAVE_GETOPT_LONG
 const struct option longopts[] =
@@ -72,6 +72,7 @@ const struct option longopts[] =
 	{ "help",no_argument,NULL,'h' },
 	{ "version",no_argument,NULL,'V' },
 	{ "available",no_argument,NULL,'a' },
+	{ "thread",required_argument,NULL,'T' },
 	{NULL,0,NULL,0}};
 #else
 #define getopt_long(a,b,c,d,e)	getopt(a,b,c) 
@@ -188,6 +189,13 @@ int main(int argc, char *argv[])
 					timeout = DEFAULT_TIMEOUT*1000*1000;
 				}
 				break;
+			case 'T':
+				nutscan_max_threads = atoi(optarg);
+				if( nutscan_max_threads <= 0 ) {
+					fprintf(stderr,"Illegal number of threads, using default %d\n", DEFAULT_THREAD);
+					nutscan_max_threads = DEFAULT_THREAD;
+				}
+				break;
 			case 's':
 				start_ip = strdup(optarg);
 				end_ip = start_ip;
@@ -386,6 +394,7 @@ display_help:
 				printf("  -s, --start_ip <IP address>: First IP address to scan.\n");
 				printf("  -e, --end_ip <IP address>: Last IP address to scan.\n");
 				printf("  -m, --mask_cidr <IP address/mask>: Give a range of IP using CIDR notation.\n");
+				printf("  -T, --thread <max number of threads>: Most addresses scanned at once by each network scan (default %d).\n", DEFAULT_THREAD);
 
 				if( nutscan_avail_snmp ) {
 					printf("\nSNMP v1 specific options:\n");
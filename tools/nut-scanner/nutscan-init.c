@@ -22,6 +22,7 @@
 */
 
 #include "common.h"
+#include "nutscan-init.h"
 #include <ltdl.h>
 
 int nutscan_avail_avahi = 0;
@@ -31,6 +32,8 @@ int nutscan_avail_snmp = 0;
 int nutscan_avail_usb = 0;
 int nutscan_avail_xml_http = 0;
 
+int nutscan_max_threads = DEFAULT_THREAD;
+
 int nutscan_load_usb_library(void);
 int nutscan_load_snmp_library(void);
 int nutscan_load_neon_library(void);
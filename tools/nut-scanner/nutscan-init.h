@@ -37,6 +37,10 @@ extern int nutscan_avail_snmp;
 extern int nutscan_avail_usb;
 extern int nutscan_avail_xml_http;
 
+/* Most threads each network scan (SNMP, NUT, IPMI) runs at once */
+#define DEFAULT_THREAD 128
+extern int nutscan_max_threads;
+
 void nutscan_init(void);
 void nutscan_free(void);
 
@@ -0,0 +1,185 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.c
+    \brief bounded pool of worker threads for network scans
+
+    Scanning an IP range used to start one thread per address, so a /16
+    meant 65536 threads.  The scanners now queue one job per address in a
+    pool: the queue holds as many jobs as there are workers, and adding a
+    job waits for room, so that memory and threads stay bounded whatever
+    the size of the range.
+*/
+
+#include "common.h"
+#include "nutscan-init.h"
+#include "nutscan-pool.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+typedef struct {
+	nutscan_job_func_t	func;
+	void			*arg;
+} nutscan_job_t;
+
+struct nutscan_pool {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;
+	pthread_cond_t	job_ready;	/* a job was queued, or the pool is done */
+	pthread_cond_t	job_taken;	/* room was made in the queue */
+	pthread_t	*threads;
+	size_t		max_threads;
+	size_t		nthreads;
+	size_t		idle;		/* workers waiting for a job */
+	nutscan_job_t	*jobs;		/* ring buffer of max_threads jobs */
+	size_t		head;
+	size_t		count;
+	int		done;
+#else
+	int		unused;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+static void * nutscan_pool_worker(void * arg)
+{
+	nutscan_pool_t	*pool = (nutscan_pool_t *)arg;
+	nutscan_job_t	job;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while ((pool->count == 0) && (!pool->done)) {
+			pool->idle++;
+			pthread_cond_wait(&pool->job_ready, &pool->lock);
+			pool->idle--;
+		}
+
+		if (pool->count == 0) {
+			break;
+		}
+
+		job = pool->jobs[pool->head];
+		pool->head = (pool->head + 1) % pool->max_threads;
+		pool->count--;
+		pthread_cond_signal(&pool->job_taken);
+
+		pthread_mutex_unlock(&pool->lock);
+		job.func(job.arg);
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+#endif
+
+nutscan_pool_t * nutscan_pool_new(void)
+{
+	nutscan_pool_t	*pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD
+	pool->max_threads = (nutscan_max_threads > 0) ? nutscan_max_threads : 1;
+	pool->threads = calloc(pool->max_threads, sizeof(*pool->threads));
+	pool->jobs = calloc(pool->max_threads, sizeof(*pool->jobs));
+
+	if ((pool->threads == NULL) || (pool->jobs == NULL)) {
+		free(pool->threads);
+		free(pool->jobs);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_ready, NULL);
+	pthread_cond_init(&pool->job_taken, NULL);
+#endif
+
+	return pool;
+}
+
+void nutscan_pool_add(nutscan_pool_t * pool, nutscan_job_func_t func, void * arg)
+{
+#ifdef HAVE_PTHREAD
+	if (pool == NULL) {
+		func(arg);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->count == pool->max_threads) {
+		pthread_cond_wait(&pool->job_taken, &pool->lock);
+	}
+
+	/* more queued jobs than idle workers: start another one */
+	if ((pool->idle <= pool->count) && (pool->nthreads < pool->max_threads)) {
+		if (pthread_create(&pool->threads[pool->nthreads], NULL,
+				nutscan_pool_worker, pool) == 0) {
+			pool->nthreads++;
+		}
+	}
+
+	if (pool->nthreads == 0) {
+		pthread_mutex_unlock(&pool->lock);
+		func(arg);
+		return;
+	}
+
+	pool->jobs[(pool->head + pool->count) % pool->max_threads].func = func;
+	pool->jobs[(pool->head + pool->count) % pool->max_threads].arg = arg;
+	pool->count++;
+	pthread_cond_signal(&pool->job_ready);
+
+	pthread_mutex_unlock(&pool->lock);
+#else
+	func(arg);
+#endif
+}
+
+void nutscan_pool_wait(nutscan_pool_t * pool)
+{
+#ifdef HAVE_PTHREAD
+	size_t	i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->done = 1;
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->job_taken);
+	pthread_cond_destroy(&pool->job_ready);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->jobs);
+	free(pool->threads);
+#endif
+	free(pool);
+}
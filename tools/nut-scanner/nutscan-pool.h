@@ -0,0 +1,43 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*! \file nutscan-pool.h
+    \brief bounded pool of worker threads for network scans
+*/
+
+#ifndef SCAN_POOL
+#define SCAN_POOL
+
+typedef void * (*nutscan_job_func_t)(void * arg);
+
+typedef struct nutscan_pool nutscan_pool_t;
+
+/* Start a pool running jobs on at most nutscan_max_threads threads.
+ * Workers are only started as jobs come, and at most as many jobs as
+ * there are workers wait in the queue.
+ * Return NULL on memory error: the functions below then run the jobs
+ * one after the other in the caller */
+nutscan_pool_t * nutscan_pool_new(void);
+
+/* Run func(arg) on a worker, waiting for room in the queue if needed.
+ * Without thread support (or if no worker can be started) the job runs
+ * right away in the caller. */
+void nutscan_pool_add(nutscan_pool_t * pool, nutscan_job_func_t func, void * arg);
+
+/* Wait for all jobs to complete, then free the pool */
+void nutscan_pool_wait(nutscan_pool_t * pool);
+
+#endif
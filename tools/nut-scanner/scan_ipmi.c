@@ -27,10 +27,14 @@
 
 #ifdef WITH_IPMI
 #include "upsclient.h"
+#include "nutscan-pool.h"
 #include <freeipmi/freeipmi.h>
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define NUT_IPMI_DRV_NAME	"nut-ipmipsu"
 
@@ -116,6 +120,17 @@ static void (*nut_ipmi_ctx_destroy) (ipmi_ctx_t ctx);
 /* Internal functions */
 static nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t * sec);
 
+/* remote devices found by nutscan_scan_ipmi() */
+static nutscan_device_t * dev_ret = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t dev_mutex;
+#endif
+
+struct scan_ipmi_arg {
+	char * ip;
+	nutscan_ipmi_t sec;
+};
+
 /* Return 0 on error */
 int nutscan_load_ipmi_library()
 {
@@ -561,6 +576,30 @@ nutscan_device_t * nutscan_scan_ipmi_device(const char * IPaddr, nutscan_ipmi_t
 	return current_nut_dev;
 }
 
+/* pool job: scan one remote address */
+static void * try_ipmi_device(void * arg)
+{
+	struct scan_ipmi_arg * ipmi_arg = (struct scan_ipmi_arg *)arg;
+	nutscan_device_t * nut_dev;
+
+	nut_dev = nutscan_scan_ipmi_device(ipmi_arg->ip, &ipmi_arg->sec);
+
+	if (nut_dev != NULL) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&dev_mutex);
+#endif
+		dev_ret = nutscan_add_device_to_device(dev_ret, nut_dev);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&dev_mutex);
+#endif
+	}
+
+	free(ipmi_arg->ip);
+	free(ipmi_arg);
+
+	return NULL;
+}
+
 /* General IPMI scan entry point: scan 1 to n devices, local or remote,
  * for IPMI support
  * Return NULL on error, or a valid nutscan_device_t otherwise */
@@ -568,9 +607,9 @@ nutscan_device_t * nutscan_scan_ipmi(const char * start_ip, const char * stop_ip
 {
 	nutscan_ip_iter_t ip;
 	char * ip_str = NULL;
-	nutscan_ipmi_t * tmp_sec;
-	nutscan_device_t * nut_dev = NULL;
+	struct scan_ipmi_arg * ipmi_arg;
 	nutscan_device_t * current_nut_dev = NULL;
+	nutscan_pool_t * pool;
 
 	if( !nutscan_avail_ipmi ) {
 		return NULL;
@@ -584,19 +623,34 @@ nutscan_device_t * nutscan_scan_ipmi(const char * start_ip, const char * stop_ip
 		current_nut_dev = nutscan_scan_ipmi_device(NULL, NULL);
 	}
 	else {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init(&dev_mutex, NULL);
+#endif
+		pool = nutscan_pool_new();
+
 		ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
 
 		while(ip_str != NULL) {
-			tmp_sec = malloc(sizeof(nutscan_ipmi_t));
-			memcpy(tmp_sec, sec, sizeof(nutscan_ipmi_t));
-
-			if ((current_nut_dev = nutscan_scan_ipmi_device(ip_str, tmp_sec)) != NULL) {
-				/* Store the positive result */
-				current_nut_dev = nutscan_add_device_to_device(current_nut_dev, nut_dev);
+			if ((ipmi_arg = malloc(sizeof(struct scan_ipmi_arg))) == NULL) {
+				free(ip_str);
+				break;
 			}
+			ipmi_arg->ip = ip_str;
+			memcpy(&ipmi_arg->sec, sec, sizeof(nutscan_ipmi_t));
+
+			nutscan_pool_add(pool, try_ipmi_device, ipmi_arg);
+
 			/* Prepare the next iteration */
 			ip_str = nutscan_ip_iter_inc(&ip);
 		};
+
+		nutscan_pool_wait(pool);
+#ifdef HAVE_PTHREAD
+		pthread_mutex_destroy(&dev_mutex);
+#endif
+
+		current_nut_dev = dev_ret;
+		dev_ret = NULL;
 	}
 
 	return nutscan_rewind_device(current_nut_dev);
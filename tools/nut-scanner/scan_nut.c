@@ -24,6 +24,7 @@
 #include "common.h"
 #include "upsclient.h"
 #include "nut-scan.h"
+#include "nutscan-pool.h"
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
@@ -211,15 +212,8 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 	char buf[SMALLBUF];
 	struct sigaction oldact;
 	int change_action_handler = 0;
-	int i;
 	struct scan_nut_arg *nut_arg;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-	pthread_t * thread_array = NULL;
-	int thread_count = 0;
-
-	pthread_mutex_init(&dev_mutex,NULL);
-#endif
+	nutscan_pool_t *pool;
 
         if( !nutscan_avail_nut ) {
                 return NULL;
@@ -233,6 +227,11 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 		}
 	}
 
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&dev_mutex,NULL);
+#endif
+	pool = nutscan_pool_new();
+
 	ip_str = nutscan_ip_iter_init(&ip,startIP,stopIP);
 
 	while( ip_str != NULL )
@@ -258,26 +257,14 @@ nutscan_device_t * nutscan_scan_nut(const char* startIP, const char* stopIP, con
 
 		nut_arg->timeout = usec_timeout;
 		nut_arg->hostname = ip_dest;
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,list_nut_devices,(void*)nut_arg)==0){
-			thread_count++;
-			thread_array = realloc(thread_array,
-					thread_count*sizeof(pthread_t));
-			thread_array[thread_count-1] = thread;
-		}
-#else
-		list_nut_devices(nut_arg);
-#endif
+		nutscan_pool_add(pool, list_nut_devices, nut_arg);
 		free(ip_str);
 		ip_str = nutscan_ip_iter_inc(&ip);
 	}
 
+	nutscan_pool_wait(pool);
 #ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
-	}
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 
 	if(change_action_handler) {
@@ -27,6 +27,7 @@
 #ifdef WITH_SNMP
 
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <stdio.h>
 #include <string.h>
 #include <ltdl.h>
@@ -59,6 +60,7 @@
 #include <pthread.h>
 #endif
 #include "nutscan-snmp.h"
+#include "nutscan-pool.h"
 
 /* Address API change */
 #ifndef usmAESPrivProtocol
@@ -69,11 +71,13 @@
 
 #define SysOID ".1.3.6.1.2.1.1.2.0"
 
+/* Hosts probed at once by the asynchronous sweep: each one has its own
+ * session and socket, all waited for by a single select() */
+#define SWEEP_WINDOW	512
+
 static nutscan_device_t * dev_ret = NULL;
 #ifdef HAVE_PTHREAD
 static pthread_mutex_t dev_mutex;
-static pthread_t * thread_array = NULL;
-static int thread_count = 0;
 #endif
 long g_usec_timeout ;
 
@@ -97,6 +101,14 @@ static int (*nut_snmp_sess_synch_response) (void *sessp, netsnmp_pdu *pdu,
 static int (*nut_snmp_oid_compare) (const oid *in_name1, size_t len1,
 			const oid *in_name2, size_t len2);
 static void (*nut_snmp_free_pdu) (netsnmp_pdu *pdu);
+static struct snmp_session * (*nut_snmp_open)(struct snmp_session *session);
+static int (*nut_snmp_close)(struct snmp_session *session);
+static int (*nut_snmp_async_send)(struct snmp_session *session,
+			netsnmp_pdu *pdu, netsnmp_callback callback, void *cb_data);
+static int (*nut_snmp_select_info)(int *numfds, fd_set *fdset,
+			struct timeval *timeout, int *block);
+static void (*nut_snmp_read)(fd_set *fdset);
+static void (*nut_snmp_timeout)(void);
 static int (*nut_generate_Ku)(const oid * hashtype, u_int hashtype_len,
 			u_char * P, size_t pplen, u_char * Ku, size_t * kulen);
 static const char * (*nut_snmp_api_errstring) (int snmp_errnumber);
@@ -194,6 +206,38 @@ int nutscan_load_snmp_library()
 		goto err;
 	}
 
+	*(void **) (&nut_snmp_open) = lt_dlsym(dl_handle, "snmp_open");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_close) = lt_dlsym(dl_handle, "snmp_close");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_async_send) = lt_dlsym(dl_handle,
+							"snmp_async_send");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_select_info) = lt_dlsym(dl_handle,
+							"snmp_select_info");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_read) = lt_dlsym(dl_handle, "snmp_read");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
+	*(void **) (&nut_snmp_timeout) = lt_dlsym(dl_handle, "snmp_timeout");
+	if ((dl_error = lt_dlerror()) != NULL)  {
+		goto err;
+	}
+
 	*(void **) (&nut_generate_Ku) = lt_dlsym(dl_handle, "generate_Ku");
 	if ((dl_error = lt_dlerror()) != NULL)  {
 		goto err;
@@ -542,22 +586,17 @@ static int init_session(struct snmp_session * snmp_sess, nutscan_snmp_t * sec)
 	return 1;
 }
 
-static void * try_SysOID(void * arg)
+/* open a synchronous session to sec->peername, NULL on error */
+static void * scan_snmp_open(nutscan_snmp_t * sec)
 {
 	struct snmp_session snmp_sess;
 	void * handle;
-	struct snmp_pdu *pdu, *response = NULL, *resp = NULL;
-        oid name[MAX_OID_LEN];
-        size_t name_len = MAX_OID_LEN;
-	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
-	int index = 0;
-	int sysoid_found = 0;
 
 	/* Initialize session */
 	if( !init_session(&snmp_sess,sec) ) {
-		goto try_SysOID_free;
+		return NULL;
 	}
-	
+
 	snmp_sess.retries = 0;
 	snmp_sess.timeout = g_usec_timeout;
 
@@ -566,6 +605,67 @@ static void * try_SysOID(void * arg)
 	if (handle == NULL) {
 		fprintf(stderr,"Failed to open SNMP session for %s.\n",
 			sec->peername);
+	}
+
+	return handle;
+}
+
+/* An SNMP agent answered at sec->handle: find out which MIB fits, from its
+ * sysObjectID if it gave one (sysoid_len > 0), else by trying them all */
+static void scan_snmp_identify(nutscan_snmp_t * sec, const oid * sysoid, size_t sysoid_len)
+{
+	struct snmp_pdu *resp = NULL;
+        oid name[MAX_OID_LEN];
+        size_t name_len;
+	int index = 0;
+	int sysoid_found = 0;
+
+	/* Check if the received OID match with a known sysOID */
+	while(sysoid_len > 0 && snmp_device_table[index].oid != NULL) {
+		if(snmp_device_table[index].sysoid == NULL ) {
+			index++;
+			continue;
+		}
+		name_len = MAX_OID_LEN;
+		if (!(*nut_snmp_parse_oid)(
+			snmp_device_table[index].sysoid,
+			name, &name_len)) {
+			index++;
+			continue;
+		}
+
+		if ( (*nut_snmp_oid_compare)(sysoid, sysoid_len,
+			name, name_len) == 0 ) {
+			/* we have found a relevent sysoid */
+			resp = scan_snmp_get_manufacturer(
+				snmp_device_table[index].oid,
+				sec->handle);
+			if( resp != NULL ) {
+				scan_snmp_add_device(sec,resp,
+					snmp_device_table[index].mib);
+				sysoid_found = 1;
+				(*nut_snmp_free_pdu)(resp);
+			}
+		}
+		index++;
+	}
+
+	/* try a list of known OID */
+	if( !sysoid_found ) {
+		try_all_oid(sec);
+	}
+}
+
+static void * try_SysOID(void * arg)
+{
+	void * handle;
+	struct snmp_pdu *pdu, *response = NULL;
+        oid name[MAX_OID_LEN];
+        size_t name_len = MAX_OID_LEN;
+	nutscan_snmp_t * sec = (nutscan_snmp_t *)arg;
+
+	handle = scan_snmp_open(sec);
+	if (handle == NULL) {
 		goto try_SysOID_free;
 	}
 
@@ -595,45 +695,13 @@ static void * try_SysOID(void * arg)
 
 		/* SNMP device found */
 		/* SysOID is supposed to give the required MIB. */
-
-		/* Check if the received OID match with a known sysOID */
 		if(response->variables != NULL &&
 				response->variables->val.objid != NULL){
-			while(snmp_device_table[index].oid != NULL) {
-				if(snmp_device_table[index].sysoid == NULL ) {
-					index++;
-					continue;
-				}
-				name_len = MAX_OID_LEN;
-				if (!(*nut_snmp_parse_oid)(
-					snmp_device_table[index].sysoid,
-					name, &name_len)) {
-					index++;
-					continue;
-				}
-
-				if ( (*nut_snmp_oid_compare)(
-					response->variables->val.objid,
-					response->variables->val_len/sizeof(oid),
-					name, name_len) == 0 ) {
-					/* we have found a relevent sysoid */
-					resp = scan_snmp_get_manufacturer(
-						snmp_device_table[index].oid,
-						handle);
-					if( resp != NULL ) {
-						scan_snmp_add_device(sec,resp,
-							snmp_device_table[index].mib);
-						sysoid_found = 1;
-						(*nut_snmp_free_pdu)(resp);
-					}
-				}
-				index++;
-			}
+			scan_snmp_identify(sec, response->variables->val.objid,
+				response->variables->val_len/sizeof(oid));
 		}
-
-		/* try a list of known OID */
-		if( !sysoid_found ) {
-			try_all_oid(sec);
+		else {
+			scan_snmp_identify(sec, NULL, 0);
 		}
 
 		(*nut_snmp_free_pdu)(response);
@@ -651,17 +719,241 @@ try_SysOID_free:
 	return NULL;
 }
 
+/* Asynchronous sweep (SNMP v1)
+ *
+ * With one synchronous GET per worker, a worker spends the whole timeout
+ * waiting for each address that does not answer, and most do not.  The
+ * sweep instead sends the sysObjectID GET to SWEEP_WINDOW addresses at a
+ * time from this thread and handles the answers (and timeouts) as they
+ * come, so the range goes by at SWEEP_WINDOW addresses per timeout.  Only
+ * the agents that answered are then identified, in the pool.
+ *
+ * SNMP v3 sessions discover the agent engine ID synchronously when opened,
+ * so v3 scans keep using the pool for the whole range.
+ */
+typedef struct snmp_probe {
+	nutscan_snmp_t		*sec;		/* copy, owns peername */
+	struct snmp_session	*session;	/* from snmp_open() */
+	int			done;
+	int			answered;
+	oid			sysoid[MAX_OID_LEN];
+	size_t			sysoid_len;
+	struct snmp_probe	*next;
+} snmp_probe_t;
+
+static void free_probe(snmp_probe_t * probe)
+{
+	if (probe->session != NULL) {
+		(*nut_snmp_close)(probe->session);
+	}
+	free(probe->sec->peername);
+	free(probe->sec);
+	free(probe);
+}
+
+/* called from snmp_read() or snmp_timeout(), the session must stay open */
+static int sweep_callback(int operation, struct snmp_session * session,
+		int reqid, struct snmp_pdu * pdu, void * magic)
+{
+	snmp_probe_t * probe = (snmp_probe_t *)magic;
+	netsnmp_variable_list * var;
+
+	if (operation == NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE && pdu != NULL) {
+		probe->answered = 1;
+
+		var = pdu->variables;
+		if (pdu->errstat == SNMP_ERR_NOERROR && var != NULL &&
+				var->type == ASN_OBJECT_ID &&
+				var->val.objid != NULL) {
+			probe->sysoid_len = var->val_len / sizeof(oid);
+			if (probe->sysoid_len > MAX_OID_LEN) {
+				probe->sysoid_len = MAX_OID_LEN;
+			}
+			memcpy(probe->sysoid, var->val.objid,
+				probe->sysoid_len * sizeof(oid));
+		}
+	}
+
+	probe->done = 1;
+
+	return 1;
+}
+
+/* send the sysObjectID GET to <peername>, NULL on error */
+static snmp_probe_t * sweep_start(nutscan_snmp_t * sec, char * peername,
+		oid * name, size_t name_len)
+{
+	struct snmp_session snmp_sess;
+	struct snmp_pdu * pdu;
+	snmp_probe_t * probe;
+
+	probe = calloc(1, sizeof(*probe));
+	if (probe == NULL) {
+		free(peername);
+		return NULL;
+	}
+
+	probe->sec = malloc(sizeof(nutscan_snmp_t));
+	if (probe->sec == NULL) {
+		free(peername);
+		free(probe);
+		return NULL;
+	}
+	memcpy(probe->sec, sec, sizeof(nutscan_snmp_t));
+	probe->sec->peername = peername;
+
+	if (!init_session(&snmp_sess, probe->sec)) {
+		free_probe(probe);
+		return NULL;
+	}
+
+	snmp_sess.retries = 0;
+	snmp_sess.timeout = g_usec_timeout;
+
+	probe->session = (*nut_snmp_open)(&snmp_sess);
+	if (probe->session == NULL) {
+		fprintf(stderr,"Failed to open SNMP session for %s.\n",
+			peername);
+		free_probe(probe);
+		return NULL;
+	}
+
+	pdu = (*nut_snmp_pdu_create)(SNMP_MSG_GET);
+	if (pdu == NULL) {
+		fprintf(stderr,"Not enough memory\n");
+		free_probe(probe);
+		return NULL;
+	}
+
+	(*nut_snmp_add_null_var)(pdu, name, name_len);
+
+	if (!(*nut_snmp_async_send)(probe->session, pdu, sweep_callback, probe)) {
+		(*nut_snmp_free_pdu)(pdu);
+		free_probe(probe);
+		return NULL;
+	}
+
+	return probe;
+}
+
+/* pool job: identify an agent found by the sweep */
+static void * try_sweep_answer(void * arg)
+{
+	snmp_probe_t * probe = (snmp_probe_t *)arg;
+	nutscan_snmp_t * sec = probe->sec;
+
+	sec->handle = scan_snmp_open(sec);
+	if (sec->handle != NULL) {
+		scan_snmp_identify(sec, probe->sysoid, probe->sysoid_len);
+		(*nut_snmp_sess_close)(sec->handle);
+	}
+
+	free_probe(probe);
+
+	return NULL;
+}
+
+/* probe the whole range, return the list of probes that got an answer */
+static snmp_probe_t * sweep_range(nutscan_snmp_t * sec, const char * start_ip,
+		const char * stop_ip)
+{
+	nutscan_ip_iter_t ip;
+	char * ip_str;
+	oid name[MAX_OID_LEN];
+	size_t name_len = MAX_OID_LEN;
+	snmp_probe_t * active = NULL, * answered = NULL;
+	snmp_probe_t * probe, ** link;
+	int count = 0;
+	int fds, block, ret;
+	fd_set fdset;
+	struct timeval tv;
+
+	if (!(*nut_snmp_parse_oid)(SysOID, name, &name_len)) {
+		fprintf(stderr,"SNMP errors: %s\n",
+				(*nut_snmp_api_errstring)((*nut_snmp_errno)));
+		return NULL;
+	}
+
+	ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
+
+	while (ip_str != NULL || active != NULL) {
+
+		/* keep SWEEP_WINDOW requests in flight */
+		while (ip_str != NULL && count < SWEEP_WINDOW) {
+			probe = sweep_start(sec, ip_str, name, name_len);
+			if (probe != NULL) {
+				probe->next = active;
+				active = probe;
+				count++;
+			}
+			ip_str = nutscan_ip_iter_inc(&ip);
+		}
+
+		if (active == NULL) {
+			break;
+		}
+
+		fds = 0;
+		block = 1;
+		FD_ZERO(&fdset);
+		timerclear(&tv);
+		(*nut_snmp_select_info)(&fds, &fdset, &tv, &block);
+
+		ret = select(fds, &fdset, NULL, NULL, block ? NULL : &tv);
+
+		if (ret > 0) {
+			(*nut_snmp_read)(&fdset);
+		}
+		else if (ret == 0) {
+			(*nut_snmp_timeout)();
+		}
+		else if (errno != EINTR) {
+			fprintf(stderr, "Error waiting for SNMP answers: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		/* sessions can only be closed outside of the callbacks */
+		link = &active;
+		while ((probe = *link) != NULL) {
+			if (!probe->done) {
+				link = &probe->next;
+				continue;
+			}
+
+			*link = probe->next;
+			count--;
+
+			if (probe->answered) {
+				(*nut_snmp_close)(probe->session);
+				probe->session = NULL;
+				probe->next = answered;
+				answered = probe;
+			}
+			else {
+				free_probe(probe);
+			}
+		}
+	}
+
+	/* only left on error */
+	while (active != NULL) {
+		probe = active;
+		active = probe->next;
+		free_probe(probe);
+	}
+	free(ip_str);
+
+	return answered;
+}
+
 nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip,long usec_timeout, nutscan_snmp_t * sec)
 {
-	int i;
 	nutscan_snmp_t * tmp_sec;
 	nutscan_ip_iter_t ip;
 	char * ip_str = NULL;
-#ifdef HAVE_PTHREAD
-	pthread_t thread;
-
-	pthread_mutex_init(&dev_mutex,NULL);
-#endif
+	nutscan_pool_t * pool;
+	snmp_probe_t * probe, * answered;
 
         if( !nutscan_avail_snmp ) {
                 return NULL;
@@ -673,32 +965,37 @@ nutscan_device_t * nutscan_scan_snmp(const char * start_ip, const char * stop_ip
 	/* Initialize the SNMP library */
 	(*nut_init_snmp)("nut-scanner");
 
-	ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&dev_mutex,NULL);
+#endif
+	pool = nutscan_pool_new();
 
-	while(ip_str != NULL) {
-		tmp_sec = malloc(sizeof(nutscan_snmp_t));
-		memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
-		tmp_sec->peername = ip_str;
+	/* SNMP v1: sweep the range, then identify who answered */
+	if( sec->community != NULL || sec->secLevel == NULL ) {
+		answered = sweep_range(sec, start_ip, stop_ip);
 
-#ifdef HAVE_PTHREAD
-		if (pthread_create(&thread,NULL,try_SysOID,(void*)tmp_sec)==0){
-			thread_count++;
-			thread_array = realloc(thread_array,
-						thread_count*sizeof(pthread_t));
-			thread_array[thread_count-1] = thread;
+		while( answered != NULL ) {
+			probe = answered;
+			answered = probe->next;
+			nutscan_pool_add(pool, try_sweep_answer, probe);
 		}
-#else
-		try_SysOID((void *)tmp_sec);
-#endif
-		ip_str = nutscan_ip_iter_inc(&ip);
-	};
+	}
+	else {
+		ip_str = nutscan_ip_iter_init(&ip, start_ip, stop_ip);
 
-#ifdef HAVE_PTHREAD
-	for ( i=0; i < thread_count ; i++) {
-		pthread_join(thread_array[i],NULL);
+		while(ip_str != NULL) {
+			tmp_sec = malloc(sizeof(nutscan_snmp_t));
+			memcpy(tmp_sec, sec, sizeof(nutscan_snmp_t));
+			tmp_sec->peername = ip_str;
+
+			nutscan_pool_add(pool, try_SysOID, tmp_sec);
+			ip_str = nutscan_ip_iter_inc(&ip);
+		};
 	}
+
+	nutscan_pool_wait(pool);
+#ifdef HAVE_PTHREAD
 	pthread_mutex_destroy(&dev_mutex);
-	free(thread_array);
 #endif
 
 	return nutscan_rewind_device(dev_ret);